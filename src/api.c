@@ -8,16 +8,36 @@
 # include <string.h>
 # include <stdlib.h>
 # include <assert.h>
+# include <inttypes.h>
 
 # include "conf.h"
 # include "utils.h"
+# include "protocol.h"
 
-static char packf_fmt[4096];
+static char encode_code[1 << 20];
+static bool encode_use_n;
+static size_t encode_code_len;
+static size_t record_max_len;
 static FILE *fpc;
 static FILE *fph;
+static FILE *fpp;
 
 # define ph(fmt, args...) fprintf(fph, fmt "\n", ##args)
 # define pc(fmt, args...) fprintf(fpc, fmt "\n", ##args)
+# define pp(fmt, args...) fprintf(fpp, fmt "\n", ##args)
+# define pe(fmt, args...) encode_code_len += snprintf(encode_code + encode_code_len, \
+        sizeof(encode_code) - encode_code_len, fmt "\n", ##args)
+
+static uint64_t schema_fingerprint(void);
+
+/* server name in upper case, for macros */
+static char const *macro_name(void)
+{
+    static char name[128];
+    snprintf(name, sizeof(name), "%s", settings.server_name);
+
+    return strtoupper(name);
+}
 
 static int generate_h_api_h(void)
 {
@@ -54,21 +74,26 @@ static int generate_h_api_h(void)
         "char",
     };
 
-    static char const *packf_str[] =
+    static char const *put_str[] =
     {
         "",
-        "c",
-        "w",
-        "d",
-        "D",
-        "f",
-        "F",
+        "put_u8(p, (uint8_t)",
+        "put_u16(p, (uint16_t)",
+        "put_u32(p, (uint32_t)",
+        "put_u64(p, (uint64_t)",
+        "put_float(p, ",
+        "put_double(p, ",
     };
 
-    memset(packf_fmt, 0, sizeof(packf_fmt));
-    strcat(packf_fmt, "[");
+    static size_t const types_len[] =
+    {
+        0, 1, 2, 4, 8, 4, 8,
+    };
+
+    encode_code_len = 0;
+    encode_use_n = false;
+    record_max_len = 0;
 
-    size_t line_num = 0;
     struct column *curr = settings.columns;
     while (curr)
     {
@@ -106,7 +131,8 @@ static int generate_h_api_h(void)
         }
 
         unsigned length = curr->length;
-        char fmt[20] = { 0 };
+        bool is_str = false;
+        bool is_len8 = false;
 
         if ((!curr->is_const_length) && \
                 (curr->type >= COLUMN_TYPE_CHAR && curr->type <= COLUMN_TYPE_TEXT))
@@ -117,52 +143,76 @@ static int generate_h_api_h(void)
         if (curr->is_const_length)
         {
             assert(curr->type >= COLUMN_TYPE_CHAR && curr->type <= COLUMN_TYPE_BLOB);
-            snprintf(fmt, sizeof(fmt), "%uc", length);
+            pe("    memcpy(p, log->%s, %u);", curr->name, length);
+            pe("    p += %u;", length);
         }
         else if (curr->is_zero_end)
         {
             assert(curr->type >= COLUMN_TYPE_CHAR && curr->type <= COLUMN_TYPE_TEXT);
-            snprintf(fmt, sizeof(fmt), "%uS", length);
+            encode_use_n = true;
+            pe("    n = strnlen(log->%s, %u);", curr->name, length - 1);
+            pe("    memcpy(p, log->%s, n);", curr->name);
+            pe("    p[n] = 0;");
+            pe("    p += n + 1;");
         }
         else if (curr->is_unix_timestamp)
         {
             assert(curr->type >= COLUMN_TYPE_DATE && curr->type <= COLUMN_TYPE_DATETIME);
-            snprintf(fmt, sizeof(fmt), "%c", 'D');
+            pe("    p = put_u64(p, (uint64_t)log->%s);", curr->name);
         }
         else
         {
             if (curr->type == COLUMN_TYPE_CHAR || curr->type == COLUMN_TYPE_TINY_TEXT)
             {
                 len_type = "uint8_t";
-                snprintf(fmt, sizeof(fmt), "-%us", length);
+                is_len8 = true;
+                is_str = true;
             }
             else if (curr->type == COLUMN_TYPE_VARCHAR || curr->type == COLUMN_TYPE_TEXT)
             {
                 len_type = "uint16_t";
-                snprintf(fmt, sizeof(fmt), "=%us", length);
+                is_str = true;
             }
             else if (curr->type == COLUMN_TYPE_BINARY || curr->type == COLUMN_TYPE_TINY_BLOB)
             {
                 len_type = "uint8_t";
-                snprintf(fmt, sizeof(fmt), "-%uc", length);
+                is_len8 = true;
             }
             else if (curr->type == COLUMN_TYPE_VARBINARY || curr->type == COLUMN_TYPE_BLOB)
             {
                 len_type = "uint16_t";
-                snprintf(fmt, sizeof(fmt), "=%uc", length);
             }
             else if (curr->type >= COLUMN_TYPE_DATE && curr->type <= COLUMN_TYPE_DATETIME)
             {
                 len_type = "uint8_t";
-                snprintf(fmt, sizeof(fmt), "-%us", length);
+                is_len8 = true;
+                is_str = true;
             }
             else
             {
-                snprintf(fmt, sizeof(fmt), "%s", packf_str[curr->type]);
+                pe("    p = %slog->%s);", put_str[curr->type], curr->name);
             }
 
             if (curr->type >= COLUMN_TYPE_CHAR)
+            {
                 ph("    %-20s %s_len;", len_type, curr->name);
+
+                /* length prefix, limit by buffer size and length type */
+                unsigned max = is_str ? length - 1 : length;
+                if (is_len8 && max > UINT8_MAX)
+                    max = UINT8_MAX;
+                else if (max > UINT16_MAX)
+                    max = UINT16_MAX;
+
+                encode_use_n = true;
+                pe("    n = log->%s_len < %u ? log->%s_len : %u;", curr->name, max, curr->name, max);
+                if (is_len8)
+                    pe("    *p++ = (uint8_t)n;");
+                else
+                    pe("    p = put_u16(p, (uint16_t)n);");
+                pe("    memcpy(p, log->%s, n);", curr->name);
+                pe("    p += n;");
+            }
         }
 
         if (curr->is_unix_timestamp)
@@ -178,27 +228,56 @@ static int generate_h_api_h(void)
             ph("    %-20s %s;", type, curr->name);
         }
 
-        strcat(packf_fmt, fmt);
-
-        if ((line_num == 0 && strlen(packf_fmt) >= 30) || \
-                (line_num && strlen(packf_fmt) >= (30 + 72 * line_num + 1)))
-        {
-            strcat(packf_fmt, "\"\n                \"");
-            ++line_num;
-        }
+        /* max encoded length of one record */
+        if (curr->is_unix_timestamp)
+            record_max_len += sizeof(int64_t);
+        else if (curr->type >= COLUMN_TYPE_CHAR)
+            record_max_len += length + (len_type ? sizeof(uint16_t) : 0);
+        else
+            record_max_len += types_len[curr->type];
 
         curr = curr->next;
     }
 
-    strcat(packf_fmt, "]");
-
     ph("} log_%s;", settings.server_name);
     ph();
     ph("# pragma pack()");
     ph();
+    ph("/* columns, kinds and lengths of log_%s, the C++ api check it */", settings.server_name);
+    ph("# define LOG_%s_SCHEMA_FINGERPRINT 0x%016" PRIx64 "ULL", macro_name(), schema_fingerprint());
+    ph();
     ph("int send_%s_log(struct sockaddr_in const *addr, log_%s const *log);", \
             settings.server_name, settings.server_name);
     ph();
+    ph("/* Send n logs, pack as many logs as possible in one udp package */");
+    ph("int send_%s_logs(struct sockaddr_in const *addr, log_%s const *log, int n);", \
+            settings.server_name, settings.server_name);
+    ph();
+    if (settings.local_queue_shm_key || settings.local_socket_path)
+    {
+        ph("/* Send log to logdb on the same host by share memory queue or unix socket,");
+        ph(" * need compile with queue.c and queue.h in logdb src.");
+        ph(" * Return -1 if local queue is full, caller should retry later */");
+        ph("int send_%s_local_log(log_%s const *log);", \
+                settings.server_name, settings.server_name);
+        ph();
+    }
+    if (settings.is_api_async)
+    {
+        ph("/* Asynchronous batching client, need link with -lpthread.");
+        ph(" * Every producer thread write to its own lock free ring, a background thread");
+        ph(" * pack records into batch packages and send by sendmmsg, when a package is full");
+        ph(" * or every LOGDB_ASYNC_FLUSH_MS. send_%s_log_async return -1 and count", settings.server_name);
+        ph(" * the record as dropped if the ring is full, or rejected by a busy receiver.");
+        ph(" * Sending pause when receiver reply with a retry after hint */");
+        ph("int send_%s_log_async_init(struct sockaddr_in const *addr);", settings.server_name);
+        ph("int send_%s_log_async(log_%s const *log);", \
+                settings.server_name, settings.server_name);
+        ph("void send_%s_log_async_stat(uint64_t *sent, uint64_t *dropped);", settings.server_name);
+        ph("/* Stop background thread after send all records in rings */");
+        ph("int send_%s_log_async_fini(void);", settings.server_name);
+        ph();
+    }
     ph("/* Exec a sql statement");
     ph(" * Don't support SELECT or other which return result */");
     ph("int send_%s_sql(struct sockaddr_in const *addr, char const *fmt, ...)", \
@@ -209,34 +288,585 @@ static int generate_h_api_h(void)
     return 0;
 }
 
+static void generate_c_encode_c(void)
+{
+    pc("# define LOGDB_HEAD_LEN 8");
+    pc("# define LOGDB_PKG_MAX_LEN %d   /* max udp payload */", PROTOCOL_PKG_MAX_LEN);
+    pc("/* loginf add 6 bytes client addr when forward, leave room for it */");
+    pc("# define LOGDB_CLIENT_PKG_MAX_LEN %zu", PROTOCOL_CLIENT_PKG_MAX_LEN);
+    pc("# define LOGDB_RECORD_MAX_LEN %zu", record_max_len);
+    pc();
+    pc("# ifndef NEG_RET_LN");
+    pc("# define NEG_RET_LN(x) do { \\");
+    pc("    if ((x) < 0) { \\");
+    pc("        return -__LINE__; \\");
+    pc("    } \\");
+    pc("} while (0)");
+    pc("# endif");
+    pc();
+    pc("/* big endian store */");
+    pc("static inline uint8_t *put_u8(uint8_t *p, uint8_t v)");
+    pc("{");
+    pc("    p[0] = v;");
+    pc("    return p + 1;");
+    pc("}");
+    pc();
+    pc("static inline uint8_t *put_u16(uint8_t *p, uint16_t v)");
+    pc("{");
+    pc("    p[0] = (uint8_t)(v >> 8);");
+    pc("    p[1] = (uint8_t)(v);");
+    pc("    return p + 2;");
+    pc("}");
+    pc();
+    pc("static inline uint8_t *put_u32(uint8_t *p, uint32_t v)");
+    pc("{");
+    pc("    p[0] = (uint8_t)(v >> 24);");
+    pc("    p[1] = (uint8_t)(v >> 16);");
+    pc("    p[2] = (uint8_t)(v >> 8);");
+    pc("    p[3] = (uint8_t)(v);");
+    pc("    return p + 4;");
+    pc("}");
+    pc();
+    pc("static inline uint8_t *put_u64(uint8_t *p, uint64_t v)");
+    pc("{");
+    pc("    put_u32(p, (uint32_t)(v >> 32));");
+    pc("    put_u32(p + 4, (uint32_t)(v));");
+    pc("    return p + 8;");
+    pc("}");
+    pc();
+    pc("static inline uint8_t *put_float(uint8_t *p, float v)");
+    pc("{");
+    pc("    uint32_t i;");
+    pc("    memcpy(&i, &v, sizeof(i));");
+    pc("    return put_u32(p, i);");
+    pc("}");
+    pc();
+    pc("static inline uint8_t *put_double(uint8_t *p, double v)");
+    pc("{");
+    pc("    uint64_t i;");
+    pc("    memcpy(&i, &v, sizeof(i));");
+    pc("    return put_u64(p, i);");
+    pc("}");
+    pc();
+    pc("/* result, command, sequence, echo len, no echo */");
+    pc("static inline int encode_head(uint8_t *buf, uint8_t command)");
+    pc("{");
+    pc("    memset(buf, 0, LOGDB_HEAD_LEN);");
+    pc("    buf[1] = command;");
+    pc();
+    pc("    return LOGDB_HEAD_LEN;");
+    pc("}");
+    pc();
+    pc("/* buf should have at least LOGDB_RECORD_MAX_LEN bytes */");
+    pc("static int encode_log(uint8_t *buf, log_%s const *log)", settings.server_name);
+    pc("{");
+    pc("    uint8_t *p = buf;");
+    if (encode_use_n)
+        pc("    size_t n;");
+    pc();
+    fputs(encode_code, fpc);
+    pc();
+    pc("    return (int)(p - buf);");
+    pc("}");
+    pc();
+}
+
+static void generate_c_local_api_c(void)
+{
+    pc("# define LOGDB_LOCAL_QUEUE_SHM_KEY %d", settings.local_queue_shm_key);
+    if (settings.local_socket_path)
+        pc("# define LOGDB_LOCAL_SOCKET_PATH \"%s\"", settings.local_socket_path);
+    pc();
+    pc("static queue_t local_queue;");
+    pc("static int local_queue_flag = 0;");
+    pc("static time_t local_queue_last_try = 0;");
+    pc("static int local_sockfd = -1;");
+    pc();
+    pc("static int send_local_pkg(void *pkg, int len)");
+    pc("{");
+    pc("    if (LOGDB_LOCAL_QUEUE_SHM_KEY && local_queue_flag == 0)");
+    pc("    {");
+    pc("        /* logdb may start later, try attach queue once per second */");
+    pc("        time_t now = time(NULL);");
+    pc("        if (now != local_queue_last_try)");
+    pc("        {");
+    pc("            local_queue_last_try = now;");
+    pc("            if (queue_attach(&local_queue, \"%s\", LOGDB_LOCAL_QUEUE_SHM_KEY) == 0)", \
+            settings.server_name);
+    pc("                local_queue_flag = 1;");
+    pc("        }");
+    pc("    }");
+    pc();
+    pc("    if (local_queue_flag)");
+    pc("        return queue_push(&local_queue, pkg, len);");
+    pc();
+    pc("# ifdef LOGDB_LOCAL_SOCKET_PATH");
+    pc("    if (local_sockfd < 0)");
+    pc("    {");
+    pc("        local_sockfd = socket(AF_UNIX, SOCK_DGRAM, 0);");
+    pc("        if (local_sockfd < 0)");
+    pc("            return -__LINE__;");
+    pc("    }");
+    pc();
+    pc("    struct sockaddr_un addr;");
+    pc("    memset(&addr, 0, sizeof(addr));");
+    pc("    addr.sun_family = AF_UNIX;");
+    pc("    strncpy(addr.sun_path, LOGDB_LOCAL_SOCKET_PATH, sizeof(addr.sun_path) - 1);");
+    pc();
+    pc("    /* block when socket buffer is full */");
+    pc("    NEG_RET_LN(sendto(local_sockfd, pkg, len, 0, (struct sockaddr *)&addr, sizeof(addr)));");
+    pc();
+    pc("    return 0;");
+    pc("# else");
+    pc("    return -__LINE__;");
+    pc("# endif");
+    pc("}");
+    pc();
+    pc("int send_%s_local_log(log_%s const *log)", settings.server_name, settings.server_name);
+    pc("{");
+    pc("    uint8_t buf[LOGDB_HEAD_LEN + LOGDB_RECORD_MAX_LEN];");
+    pc("    int len = encode_head(buf, LOGDB_COMMAND_LOG);");
+    pc("    len += encode_log(buf + len, log);");
+    pc();
+    pc("    return send_local_pkg(buf, len);");
+    pc("}");
+    pc();
+}
+
+static void generate_c_async_api_c(void)
+{
+    pc("# ifndef LOGDB_ASYNC_RING_SIZE");
+    pc("# define LOGDB_ASYNC_RING_SIZE  (1 << 20)   /* bytes of each thread ring, power of 2 */");
+    pc("# endif");
+    pc("# ifndef LOGDB_ASYNC_MAX_THREAD");
+    pc("# define LOGDB_ASYNC_MAX_THREAD 64");
+    pc("# endif");
+    pc("# ifndef LOGDB_ASYNC_FLUSH_MS");
+    pc("# define LOGDB_ASYNC_FLUSH_MS   10");
+    pc("# endif");
+    pc("# define LOGDB_ASYNC_PKG_SIZE   LOGDB_CLIENT_PKG_MAX_LEN");
+    pc("# define LOGDB_ASYNC_MMSG_NUM   16");
+    pc();
+    pc("/* single producer single consumer ring, one per producer thread */");
+    pc("struct logdb_ring");
+    pc("{");
+    pc("    volatile int        in_use;");
+    pc("    volatile uint64_t   head;   /* write by producer */");
+    pc("    volatile uint64_t   tail;   /* write by flusher */");
+    pc("    volatile uint64_t   sent;");
+    pc("    volatile uint64_t   drop;");
+    pc("    char                buf[LOGDB_ASYNC_RING_SIZE];");
+    pc("};");
+    pc();
+    pc("static struct logdb_ring *volatile async_rings[LOGDB_ASYNC_MAX_THREAD];");
+    pc("static volatile uint64_t async_no_ring_drop;");
+    pc("static volatile uint64_t async_busy_drop;");
+    pc("static volatile uint64_t async_send_drop;   /* packed, but sendmmsg fail */");
+    pc("static uint64_t async_pause_until;  /* ms, receiver ask to retry after */");
+    pc("static __thread struct logdb_ring *async_ring;");
+    pc("static pthread_key_t async_key;");
+    pc("static pthread_t async_thread;");
+    pc("static volatile int async_running;");
+    pc("static int async_sockfd = -1;");
+    pc("static struct sockaddr_in async_addr;");
+    pc();
+    pc("static void async_ring_release(void *arg)");
+    pc("{");
+    pc("    /* left data will be send by flusher, ring can be reused by new thread */");
+    pc("    __sync_lock_release(&((struct logdb_ring *)arg)->in_use);");
+    pc("}");
+    pc();
+    pc("static struct logdb_ring *async_ring_get(void)");
+    pc("{");
+    pc("    if (async_ring)");
+    pc("        return async_ring;");
+    pc();
+    pc("    int i;");
+    pc("    for (i = 0; i < LOGDB_ASYNC_MAX_THREAD; ++i)");
+    pc("    {");
+    pc("        struct logdb_ring *ring = async_rings[i];");
+    pc("        if (ring == NULL)");
+    pc("        {");
+    pc("            ring = calloc(1, sizeof(*ring));");
+    pc("            if (ring == NULL)");
+    pc("                return NULL;");
+    pc("            ring->in_use = 1;");
+    pc();
+    pc("            if (!__sync_bool_compare_and_swap(&async_rings[i], NULL, ring))");
+    pc("            {");
+    pc("                free(ring);");
+    pc("                continue;");
+    pc("            }");
+    pc("        }");
+    pc("        else if (__sync_lock_test_and_set(&ring->in_use, 1))");
+    pc("        {");
+    pc("            continue;");
+    pc("        }");
+    pc();
+    pc("        async_ring = ring;");
+    pc("        pthread_setspecific(async_key, ring);");
+    pc();
+    pc("        return ring;");
+    pc("    }");
+    pc();
+    pc("    return NULL;");
+    pc("}");
+    pc();
+    pc("static void ring_write(struct logdb_ring *ring, uint64_t pos, void const *data, size_t len)");
+    pc("{");
+    pc("    size_t off   = pos & (LOGDB_ASYNC_RING_SIZE - 1);");
+    pc("    size_t first = LOGDB_ASYNC_RING_SIZE - off;");
+    pc();
+    pc("    if (first >= len)");
+    pc("    {");
+    pc("        memcpy(ring->buf + off, data, len);");
+    pc("    }");
+    pc("    else");
+    pc("    {");
+    pc("        memcpy(ring->buf + off, data, first);");
+    pc("        memcpy(ring->buf, (char const *)data + first, len - first);");
+    pc("    }");
+    pc("}");
+    pc();
+    pc("static void ring_read(struct logdb_ring *ring, uint64_t pos, void *data, size_t len)");
+    pc("{");
+    pc("    size_t off   = pos & (LOGDB_ASYNC_RING_SIZE - 1);");
+    pc("    size_t first = LOGDB_ASYNC_RING_SIZE - off;");
+    pc();
+    pc("    if (first >= len)");
+    pc("    {");
+    pc("        memcpy(data, ring->buf + off, len);");
+    pc("    }");
+    pc("    else");
+    pc("    {");
+    pc("        memcpy(data, ring->buf + off, first);");
+    pc("        memcpy((char *)data + first, ring->buf, len - first);");
+    pc("    }");
+    pc("}");
+    pc();
+    pc("static char async_pkgs[LOGDB_ASYNC_MMSG_NUM][LOGDB_ASYNC_PKG_SIZE];");
+    pc("static struct iovec async_iovs[LOGDB_ASYNC_MMSG_NUM];");
+    pc("static struct mmsghdr async_msgs[LOGDB_ASYNC_MMSG_NUM];");
+    pc("static uint16_t async_pkg_recs[LOGDB_ASYNC_MMSG_NUM];");
+    pc("static int async_pkg_num;");
+    pc("static int async_pkg_len;");
+    pc("static uint16_t async_rec_num;");
+    pc();
+    pc("static void async_send_pkgs(void)");
+    pc("{");
+    pc("    int i = 0;");
+    pc("    while (i < async_pkg_num)");
+    pc("    {");
+    pc("        int ret = sendmmsg(async_sockfd, async_msgs + i, async_pkg_num - i, 0);");
+    pc("        if (ret <= 0)");
+    pc("        {");
+    pc("            if (ret < 0 && errno == EINTR)");
+    pc("                continue;");
+    pc();
+    pc("            /* skip the package which can't be send, its records are dropped */");
+    pc("            async_send_drop += async_pkg_recs[i];");
+    pc("            ret = 1;");
+    pc("        }");
+    pc();
+    pc("        i += ret;");
+    pc("    }");
+    pc();
+    pc("    async_pkg_num = 0;");
+    pc("}");
+    pc();
+    pc("static void async_close_pkg(void)");
+    pc("{");
+    pc("    if (async_rec_num == 0)");
+    pc("        return;");
+    pc();
+    pc("    uint8_t *pkg = (uint8_t *)async_pkgs[async_pkg_num];");
+    pc("    /* record num is after head: result, command, sequence, echo len */");
+    pc("    pkg[8] = (uint8_t)(async_rec_num >> 8);");
+    pc("    pkg[9] = (uint8_t)(async_rec_num);");
+    pc();
+    pc("    async_iovs[async_pkg_num].iov_base = pkg;");
+    pc("    async_iovs[async_pkg_num].iov_len  = async_pkg_len;");
+    pc("    memset(&async_msgs[async_pkg_num], 0, sizeof(async_msgs[0]));");
+    pc("    async_msgs[async_pkg_num].msg_hdr.msg_name    = &async_addr;");
+    pc("    async_msgs[async_pkg_num].msg_hdr.msg_namelen = sizeof(async_addr);");
+    pc("    async_msgs[async_pkg_num].msg_hdr.msg_iov     = &async_iovs[async_pkg_num];");
+    pc("    async_msgs[async_pkg_num].msg_hdr.msg_iovlen  = 1;");
+    pc();
+    pc("    async_pkg_recs[async_pkg_num] = async_rec_num;");
+    pc("    async_rec_num = 0;");
+    pc("    if (++async_pkg_num == LOGDB_ASYNC_MMSG_NUM)");
+    pc("        async_send_pkgs();");
+    pc("}");
+    pc();
+    pc("static void async_add_rec(struct logdb_ring *ring, uint64_t pos, uint16_t len)");
+    pc("{");
+    pc("    if (async_rec_num && (async_pkg_len + 2 + len > LOGDB_ASYNC_PKG_SIZE || \\");
+    pc("                async_rec_num == UINT16_MAX))");
+    pc("        async_close_pkg();");
+    pc();
+    pc("    uint8_t *pkg = (uint8_t *)async_pkgs[async_pkg_num];");
+    pc("    if (async_rec_num == 0)");
+    pc("    {");
+    pc("        /* result, command, sequence, empty echo, record num */");
+    pc("        memset(pkg, 0, 10);");
+    pc("        pkg[1] = LOGDB_COMMAND_LOG_BATCH;");
+    pc("        async_pkg_len = 10;");
+    pc("    }");
+    pc();
+    pc("    pkg[async_pkg_len]     = (uint8_t)(len >> 8);");
+    pc("    pkg[async_pkg_len + 1] = (uint8_t)(len);");
+    pc("    ring_read(ring, pos, pkg + async_pkg_len + 2, len);");
+    pc("    async_pkg_len += 2 + len;");
+    pc("    async_rec_num += 1;");
+    pc("}");
+    pc();
+    pc("/* return 1 if there are at least one full package */");
+    pc("static int async_flush(void)");
+    pc("{");
+    pc("    int full = 0;");
+    pc("    int i;");
+    pc("    for (i = 0; i < LOGDB_ASYNC_MAX_THREAD; ++i)");
+    pc("    {");
+    pc("        struct logdb_ring *ring = async_rings[i];");
+    pc("        if (ring == NULL)");
+    pc("            continue;");
+    pc();
+    pc("        uint64_t tail = ring->tail;");
+    pc("        uint64_t head = ring->head;");
+    pc("        __sync_synchronize();");
+    pc();
+    pc("        if (head - tail >= LOGDB_ASYNC_PKG_SIZE)");
+    pc("            full = 1;");
+    pc();
+    pc("        uint64_t num = 0;");
+    pc("        while (tail < head)");
+    pc("        {");
+    pc("            uint16_t len;");
+    pc("            ring_read(ring, tail, &len, sizeof(len));");
+    pc("            async_add_rec(ring, tail + sizeof(len), len);");
+    pc("            tail += sizeof(len) + len;");
+    pc("            ++num;");
+    pc("        }");
+    pc();
+    pc("        __sync_synchronize();");
+    pc("        ring->tail = tail;");
+    pc("        ring->sent += num;");
+    pc("    }");
+    pc();
+    pc("    async_close_pkg();");
+    pc("    async_send_pkgs();");
+    pc();
+    pc("    return full;");
+    pc("}");
+    pc();
+    pc("static uint64_t async_now_ms(void)");
+    pc("{");
+    pc("    struct timeval now;");
+    pc("    gettimeofday(&now, NULL);");
+    pc();
+    pc("    return now.tv_sec * 1000ull + now.tv_usec / 1000;");
+    pc("}");
+    pc();
+    pc("/* read replies, count records rejected as busy and keep the retry after hint */");
+    pc("static void async_recv_replies(void)");
+    pc("{");
+    pc("    uint8_t buf[LOGDB_HEAD_LEN + 2 + 8192 + 2];");
+    pc("    int len;");
+    pc("    while ((len = recv(async_sockfd, buf, sizeof(buf), MSG_DONTWAIT)) >= LOGDB_HEAD_LEN)");
+    pc("    {");
+    pc("        int pos = LOGDB_HEAD_LEN + ((buf[6] << 8) | buf[7]);");
+    pc("        if (buf[1] != LOGDB_COMMAND_LOG_BATCH || pos + 2 > len)");
+    pc("            continue;");
+    pc();
+    pc("        uint16_t num = (uint16_t)((buf[pos] << 8) | buf[pos + 1]);");
+    pc("        pos += 2 + (num + 7) / 8;");
+    pc("        if (buf[0] == LOGDB_RESULT_BUSY)");
+    pc("            async_busy_drop += num;");
+    pc();
+    pc("        if (pos + 2 <= len)");
+    pc("        {");
+    pc("            uint16_t retry_after = (uint16_t)((buf[pos] << 8) | buf[pos + 1]);");
+    pc("            async_pause_until = async_now_ms() + retry_after;");
+    pc("        }");
+    pc("    }");
+    pc("}");
+    pc();
+    pc("static void *async_flush_thread(void *arg)");
+    pc("{");
+    pc("    (void)arg;");
+    pc();
+    pc("    while (async_running)");
+    pc("    {");
+    pc("        async_recv_replies();");
+    pc();
+    pc("        /* receiver is busy, records wait in rings */");
+    pc("        if (async_now_ms() < async_pause_until)");
+    pc("        {");
+    pc("            usleep(LOGDB_ASYNC_FLUSH_MS * 1000);");
+    pc("            continue;");
+    pc("        }");
+    pc();
+    pc("        /* flush when a package is full or every LOGDB_ASYNC_FLUSH_MS */");
+    pc("        if (async_flush() == 0)");
+    pc("            usleep(LOGDB_ASYNC_FLUSH_MS * 1000);");
+    pc("    }");
+    pc();
+    pc("    async_flush();");
+    pc();
+    pc("    return NULL;");
+    pc("}");
+    pc();
+    pc("int send_%s_log_async_init(struct sockaddr_in const *addr)", settings.server_name);
+    pc("{");
+    pc("    if (async_running)");
+    pc("        return -__LINE__;");
+    pc();
+    pc("    async_sockfd = socket(AF_INET, SOCK_DGRAM, 0);");
+    pc("    if (async_sockfd < 0)");
+    pc("        return -__LINE__;");
+    pc();
+    pc("    memcpy(&async_addr, addr, sizeof(async_addr));");
+    pc();
+    pc("    static int key_flag = 0;");
+    pc("    if (key_flag == 0)");
+    pc("    {");
+    pc("        if (pthread_key_create(&async_key, async_ring_release) != 0)");
+    pc("            return -__LINE__;");
+    pc("        key_flag = 1;");
+    pc("    }");
+    pc();
+    pc("    async_running = 1;");
+    pc("    if (pthread_create(&async_thread, NULL, async_flush_thread, NULL) != 0)");
+    pc("    {");
+    pc("        async_running = 0;");
+    pc("        close(async_sockfd);");
+    pc("        async_sockfd = -1;");
+    pc();
+    pc("        return -__LINE__;");
+    pc("    }");
+    pc();
+    pc("    return 0;");
+    pc("}");
+    pc();
+    pc("int send_%s_log_async(log_%s const *log)", settings.server_name, settings.server_name);
+    pc("{");
+    pc("    if (async_running == 0)");
+    pc("        return -__LINE__;");
+    pc();
+    pc("    struct logdb_ring *ring = async_ring_get();");
+    pc("    if (ring == NULL)");
+    pc("    {");
+    pc("        __sync_fetch_and_add(&async_no_ring_drop, 1);");
+    pc("        return -1;");
+    pc("    }");
+    pc();
+    pc("    uint8_t rec[LOGDB_RECORD_MAX_LEN];");
+    pc("    int len = encode_log(rec, log);");
+    pc("    if (len > UINT16_MAX)");
+    pc("        return -__LINE__;");
+    pc();
+    pc("    uint16_t rlen = (uint16_t)len;");
+    pc("    uint64_t head = ring->head;");
+    pc("    if (head + sizeof(rlen) + rlen - ring->tail > LOGDB_ASYNC_RING_SIZE)");
+    pc("    {");
+    pc("        /* ring full, drop the newest */");
+    pc("        ring->drop += 1;");
+    pc("        return -1;");
+    pc("    }");
+    pc();
+    pc("    ring_write(ring, head, &rlen, sizeof(rlen));");
+    pc("    ring_write(ring, head + sizeof(rlen), rec, rlen);");
+    pc("    __sync_synchronize();");
+    pc("    ring->head = head + sizeof(rlen) + rlen;");
+    pc();
+    pc("    return 0;");
+    pc("}");
+    pc();
+    pc("void send_%s_log_async_stat(uint64_t *sent, uint64_t *dropped)", settings.server_name);
+    pc("{");
+    pc("    /* read drops before ring sent, which count them already */");
+    pc("    uint64_t busy_drop = async_busy_drop;");
+    pc("    uint64_t send_drop = async_send_drop;");
+    pc("    __sync_synchronize();");
+    pc();
+    pc("    uint64_t s = 0;");
+    pc("    uint64_t d = async_no_ring_drop + busy_drop + send_drop;");
+    pc();
+    pc("    int i;");
+    pc("    for (i = 0; i < LOGDB_ASYNC_MAX_THREAD; ++i)");
+    pc("    {");
+    pc("        struct logdb_ring *ring = async_rings[i];");
+    pc("        if (ring == NULL)");
+    pc("            continue;");
+    pc();
+    pc("        s += ring->sent;");
+    pc("        d += ring->drop;");
+    pc("    }");
+    pc();
+    pc("    /* ring sent count records when packed, not those fail to send or");
+    pc("     * rejected by a busy receiver */");
+    pc("    if (sent)");
+    pc("        *sent = s - send_drop - busy_drop;");
+    pc("    if (dropped)");
+    pc("        *dropped = d;");
+    pc("}");
+    pc();
+    pc("int send_%s_log_async_fini(void)", settings.server_name);
+    pc("{");
+    pc("    if (async_running == 0)");
+    pc("        return -__LINE__;");
+    pc();
+    pc("    async_running = 0;");
+    pc("    pthread_join(async_thread, NULL);");
+    pc();
+    pc("    close(async_sockfd);");
+    pc("    async_sockfd = -1;");
+    pc();
+    pc("    return 0;");
+    pc("}");
+}
+
 static int generate_c_api_c(void)
 {
+    if (settings.is_api_async)
+    {
+        pc("# define _GNU_SOURCE");
+        pc();
+    }
     pc("# include <stdio.h>");
     pc("# include <string.h>");
     pc("# include <netinet/in.h>");
     pc("# include <sys/socket.h>");
     pc("# include <arpa/inet.h>");
     pc();
-    pc("# include \"packf.h\"");
+    if (settings.local_queue_shm_key || settings.local_socket_path)
+    {
+        pc("# include <time.h>");
+        pc("# include <sys/un.h>");
+        pc();
+        pc("# include \"queue.h\"");
+    }
+    if (settings.is_api_async)
+    {
+        pc("# include <stdlib.h>");
+        pc("# include <errno.h>");
+        pc("# include <unistd.h>");
+        pc("# include <pthread.h>");
+        pc("# include <sys/time.h>");
+        pc();
+    }
     pc("# include \"%s\"", basepath(settings.api_head_path));
     pc();
     pc("enum");
     pc("{");
     pc("    LOGDB_COMMAND_LOG,");
     pc("    LOGDB_COMMAND_SQL,");
+    pc("    LOGDB_COMMAND_LOG_BATCH,");
     pc("};");
     pc();
-    pc("# pragma pack(1)");
-    pc("typedef struct");
-    pc("{");
-    pc("    %-20s result;", "uint8_t");
-    pc("    %-20s command;", "uint8_t");
-    pc("    %-20s sequence;", "uint32_t");
-    pc("    %-20s echo_len;", "uint16_t");
-    pc("    %-20s echo_buf[100];", "uint8_t");
-    pc("} log_head;");
-    pc("# pragma pack()");
+    pc("# define LOGDB_RESULT_BUSY 3");
     pc();
+    generate_c_encode_c();
     pc("static int sockfd = 0;");
     pc("static int init_flag = 0;");
     pc();
@@ -252,23 +882,17 @@ static int generate_c_api_c(void)
     pc("        init_flag = 1;");
     pc("    }");
     pc();
-    pc("    log_head head;");
-    pc("    memset(&head, 0, sizeof(head));");
-    pc("    head.command = LOGDB_COMMAND_LOG;");
-    pc();
-    pc("    char buf[UINT16_MAX - 6];");
-    pc("    void *p  = buf;");
-    pc("    int left = sizeof(buf);");
-    pc("    int  len = 0;");
+    pc("    uint8_t buf[LOGDB_HEAD_LEN + LOGDB_RECORD_MAX_LEN];");
+    pc("    int len = encode_head(buf, LOGDB_COMMAND_LOG);");
+    pc("    len += encode_log(buf + len, log);");
     pc();
-    pc("    NEG_RET_LN(len += vpackf(&p, &left, \"[ccd=100c]\", &head));");
-    pc("    NEG_RET_LN(len += vpackf(&p, &left, \"%s\", log));", packf_fmt);
     pc("    NEG_RET_LN(sendto(sockfd, buf, len, 0, (struct sockaddr *)addr, sizeof(*addr)));");
     pc();
     pc("    return 0;");
     pc("}");
     pc();
-    pc("int send_%s_sql(struct sockaddr_in const *addr, char const *fmt, ...)", settings.server_name);
+    pc("int send_%s_logs(struct sockaddr_in const *addr, log_%s const *log, int n)", \
+            settings.server_name, settings.server_name);
     pc("{");
     pc("    if (init_flag == 0)");
     pc("    {");
@@ -279,22 +903,84 @@ static int generate_c_api_c(void)
     pc("        init_flag = 1;");
     pc("    }");
     pc();
-    pc("    log_head head;");
-    pc("    memset(&head, 0, sizeof(head));");
-    pc("    head.command = LOGDB_COMMAND_SQL;");
+    pc("    uint8_t buf[LOGDB_CLIENT_PKG_MAX_LEN];");
+    pc("    uint8_t rec[LOGDB_RECORD_MAX_LEN];");
+    pc("    int i = 0;");
+    pc();
+    pc("    while (i < n)");
+    pc("    {");
+    pc("        int len = encode_head(buf, LOGDB_COMMAND_LOG_BATCH);");
+    pc();
+    pc("        /* record num, fill later */");
+    pc("        int num_pos = len;");
+    pc("        uint16_t num = 0;");
+    pc("        len += 2;");
+    pc();
+    pc("        while (i < n && num < UINT16_MAX)");
+    pc("        {");
+    pc("            int rlen;");
+    pc("            if (len + 2 + LOGDB_RECORD_MAX_LEN <= (int)sizeof(buf))");
+    pc("            {");
+    pc("                /* encode in place */");
+    pc("                rlen = encode_log(buf + len + 2, &log[i]);");
+    pc("            }");
+    pc("            else");
+    pc("            {");
+    pc("                rlen = encode_log(rec, &log[i]);");
+    pc("                if (len + 2 + rlen > (int)sizeof(buf))");
+    pc("                {");
+    pc("                    if (num == 0)");
+    pc("                        return -__LINE__;");
+    pc("                    break;");
+    pc("                }");
+    pc();
+    pc("                memcpy(buf + len + 2, rec, rlen);");
+    pc("            }");
+    pc();
+    pc("            put_u16(buf + len, (uint16_t)rlen);");
+    pc("            len += 2 + rlen;");
+    pc();
+    pc("            ++num;");
+    pc("            ++i;");
+    pc("        }");
+    pc();
+    pc("        put_u16(buf + num_pos, num);");
+    pc();
+    pc("        NEG_RET_LN(sendto(sockfd, buf, len, 0, (struct sockaddr *)addr, sizeof(*addr)));");
+    pc("    }");
+    pc();
+    pc("    return 0;");
+    pc("}");
+    pc();
+    if (settings.local_queue_shm_key || settings.local_socket_path)
+    {
+        generate_c_local_api_c();
+    }
+    if (settings.is_api_async)
+    {
+        generate_c_async_api_c();
+    }
+    pc("int send_%s_sql(struct sockaddr_in const *addr, char const *fmt, ...)", settings.server_name);
+    pc("{");
+    pc("    if (init_flag == 0)");
+    pc("    {");
+    pc("        sockfd = socket(AF_INET, SOCK_DGRAM, 0);");
+    pc("        if (sockfd < 0)");
+    pc("            return -__LINE__;");
     pc();
-    pc("    char buf[UINT16_MAX - 6];");
-    pc("    void *p  = buf;");
-    pc("    int left = sizeof(buf);");
-    pc("    int  len = 0;");
+    pc("        init_flag = 1;");
+    pc("    }");
     pc();
-    pc("    NEG_RET_LN(len += vpackf(&p, &left, \"[ccd=100c]\", &head));");
+    pc("    uint8_t buf[LOGDB_CLIENT_PKG_MAX_LEN];");
+    pc("    int len = encode_head(buf, LOGDB_COMMAND_SQL);");
     pc();
     pc("    va_list args;");
     pc("    va_start(args, fmt);");
-    pc("    NEG_RET_LN(len += vsnprintf((char *)p, left, fmt, args));");
+    pc("    NEG_RET_LN(len += vsnprintf((char *)buf + len, sizeof(buf) - len, fmt, args));");
     pc("    va_end(args);");
     pc("    len += 1;");
+    pc("    if (len > (int)sizeof(buf))");
+    pc("        return -__LINE__;");
     pc();
     pc("    NEG_RET_LN(sendto(sockfd, buf, len, 0, (struct sockaddr *)addr, sizeof(*addr)));");
     pc();
@@ -305,6 +991,628 @@ static int generate_c_api_c(void)
     return 0;
 }
 
+struct cpp_column
+{
+    char const  *kind;      /* column_kind in c++ header */
+    char const  *type;      /* value type for number */
+    char const  *put;       /* big endian store for number */
+    char const  *put_type;  /* argument type of put */
+    unsigned    cap;        /* max bytes of value */
+    unsigned    prefix;     /* bytes of length prefix */
+    bool        is_zero_end;
+    bool        is_fixed;
+};
+
+static void cpp_column_info(struct column *curr, struct cpp_column *info)
+{
+    static char const *kinds[][2] =
+    {
+        { "", "" },
+        { "i8", "u8" },
+        { "i16", "u16" },
+        { "i32", "u32" },
+        { "i64", "u64" },
+        { "f32", "f32" },
+        { "f64", "f64" },
+    };
+
+    static char const *types[][2] =
+    {
+        { "", "" },
+        { "int8_t", "uint8_t" },
+        { "int16_t", "uint16_t" },
+        { "int32_t", "uint32_t" },
+        { "int64_t", "uint64_t" },
+        { "float", "float" },
+        { "double", "double" },
+    };
+
+    static char const *put_fun[][2] =
+    {
+        { "", "" },
+        { "put_u8", "uint8_t" },
+        { "put_u16", "uint16_t" },
+        { "put_u32", "uint32_t" },
+        { "put_u64", "uint64_t" },
+        { "put_float", "float" },
+        { "put_double", "double" },
+    };
+
+    static unsigned const sizes[] = { 0, 1, 2, 4, 8, 4, 8 };
+
+    memset(info, 0, sizeof(*info));
+
+    if (curr->is_unix_timestamp)
+    {
+        info->kind = "unix_time";
+        info->type = "int64_t";
+        info->put  = "put_u64";
+        info->put_type = "uint64_t";
+        info->cap  = sizeof(int64_t);
+    }
+    else if (curr->type <= COLUMN_TYPE_DOUBLE)
+    {
+        info->kind = kinds[curr->type][curr->is_unsigned];
+        info->type = types[curr->type][curr->is_unsigned];
+        info->put  = put_fun[curr->type][0];
+        info->put_type = put_fun[curr->type][1];
+        info->cap  = sizes[curr->type];
+    }
+    else if (curr->is_const_length)
+    {
+        info->kind = "fixed";
+        info->cap  = curr->length;
+        info->is_fixed = true;
+    }
+    else if (curr->is_zero_end)
+    {
+        info->kind = "zero_end";
+        info->cap  = curr->length;
+        info->is_zero_end = true;
+    }
+    else
+    {
+        switch (curr->type)
+        {
+        case COLUMN_TYPE_CHAR:
+        case COLUMN_TYPE_TINY_TEXT:
+            info->kind   = "str8";
+            info->prefix = 1;
+            info->cap    = curr->length;
+            break;
+        case COLUMN_TYPE_VARCHAR:
+        case COLUMN_TYPE_TEXT:
+            info->kind   = "str16";
+            info->prefix = 2;
+            info->cap    = curr->length;
+            break;
+        case COLUMN_TYPE_BINARY:
+        case COLUMN_TYPE_TINY_BLOB:
+            info->kind   = "bin8";
+            info->prefix = 1;
+            info->cap    = curr->length;
+            break;
+        case COLUMN_TYPE_VARBINARY:
+        case COLUMN_TYPE_BLOB:
+            info->kind   = "bin16";
+            info->prefix = 2;
+            info->cap    = curr->length;
+            break;
+        default:
+            /* date and time string, without the last '\0' */
+            info->kind   = "str8";
+            info->prefix = 1;
+            info->cap    = curr->length - 1;
+            break;
+        }
+
+        if (info->prefix == 1 && info->cap > UINT8_MAX)
+            info->cap = UINT8_MAX;
+        else if (info->cap > UINT16_MAX)
+            info->cap = UINT16_MAX;
+    }
+}
+
+static char const *cpp_kinds[] =
+{
+    "i8", "u8", "i16", "u16", "i32", "u32", "i64", "u64", "f32", "f64",
+    "unix_time", "fixed", "zero_end", "str8", "str16", "bin8", "bin16",
+};
+
+static int cpp_kind_index(char const *kind)
+{
+    size_t i;
+    for (i = 0; i < sizeof(cpp_kinds) / sizeof(cpp_kinds[0]); ++i)
+    {
+        if (strcmp(cpp_kinds[i], kind) == 0)
+            return (int)i;
+    }
+
+    return -1;
+}
+
+static uint64_t fnv1a(uint64_t h, uint8_t b)
+{
+    return (h ^ b) * 0x100000001b3ULL;
+}
+
+/* fnv1a of name, kind and cap of each column, same as detail::fingerprint in c++ header */
+static uint64_t schema_fingerprint(void)
+{
+    uint64_t fingerprint = 0xcbf29ce484222325ULL;
+
+    struct cpp_column info;
+    struct column *curr;
+
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (is_local_generate(curr))
+            continue;
+
+        cpp_column_info(curr, &info);
+
+        char const *c;
+        for (c = curr->name; *c; ++c)
+            fingerprint = fnv1a(fingerprint, (uint8_t)*c);
+        fingerprint = fnv1a(fingerprint, (uint8_t)cpp_kind_index(info.kind));
+
+        int i;
+        for (i = 0; i < 4; ++i)
+            fingerprint = fnv1a(fingerprint, (uint8_t)(info.cap >> (8 * i)));
+    }
+
+    return fingerprint;
+}
+
+static int generate_cpp_api_hpp(void)
+{
+    char const *name = settings.server_name;
+
+    uint64_t fingerprint = schema_fingerprint();
+    size_t max_len = 0;
+    size_t fixed_len = 0;
+    size_t column_num = 0;
+
+    struct cpp_column info;
+    struct column *curr;
+
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (is_local_generate(curr))
+            continue;
+
+        cpp_column_info(curr, &info);
+
+        max_len += info.prefix + info.cap + (info.is_zero_end ? 1 : 0);
+        if (info.prefix == 0 && !info.is_zero_end)
+            fixed_len += info.cap;
+        else
+            fixed_len += info.prefix + (info.is_zero_end ? 1 : 0);
+
+        ++column_num;
+    }
+
+    pp("# pragma once");
+    pp();
+    pp("# include <cstddef>");
+    pp("# include <cstdint>");
+    pp("# include <cstring>");
+    pp("# include <string_view>");
+    pp("# include <netinet/in.h>");
+    pp("# include <sys/socket.h>");
+    pp();
+    pp("# include \"%s\"", basepath(settings.api_head_path));
+    pp();
+    pp("namespace logdb {");
+    pp("namespace %s {", name);
+    pp();
+    pp("enum class column_kind : uint8_t");
+    pp("{");
+    size_t i;
+    for (i = 0; i < sizeof(cpp_kinds) / sizeof(cpp_kinds[0]); ++i)
+        pp("    %s,", cpp_kinds[i]);
+    pp("};");
+    pp();
+    pp("struct column_desc");
+    pp("{");
+    pp("    char const  *name;");
+    pp("    column_kind kind;");
+    pp("    uint32_t    cap;    /* max bytes of value */");
+    pp("};");
+    pp();
+    pp("inline constexpr column_desc columns[] =");
+    pp("{");
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (is_local_generate(curr))
+            continue;
+        cpp_column_info(curr, &info);
+        pp("    { \"%s\", column_kind::%s, %u },", curr->name, info.kind, info.cap);
+    }
+    pp("};");
+    pp();
+    pp("inline constexpr size_t   column_num         = %zu;", column_num);
+    pp("inline constexpr size_t   head_len           = 8;");
+    pp("/* max udp payload less 6 bytes client addr loginf add when forward */");
+    pp("inline constexpr size_t   pkg_max_len        = %zu;", PROTOCOL_CLIENT_PKG_MAX_LEN);
+    pp("inline constexpr size_t   record_max_len     = %zu;", max_len);
+    pp("inline constexpr uint64_t schema_fingerprint = 0x%016" PRIx64 "ULL;", fingerprint);
+    pp();
+    pp("enum : uint8_t");
+    pp("{");
+    pp("    command_log,");
+    pp("    command_sql,");
+    pp("    command_log_batch,");
+    pp("};");
+    pp();
+    pp("namespace detail {");
+    pp();
+    pp("constexpr uint64_t fnv1a(uint64_t h, uint8_t b)");
+    pp("{");
+    pp("    return (h ^ b) * 0x100000001b3ULL;");
+    pp("}");
+    pp();
+    pp("constexpr uint64_t fingerprint()");
+    pp("{");
+    pp("    uint64_t h = 0xcbf29ce484222325ULL;");
+    pp("    for (auto const &c : columns)");
+    pp("    {");
+    pp("        for (char const *p = c.name; *p; ++p)");
+    pp("            h = fnv1a(h, static_cast<uint8_t>(*p));");
+    pp("        h = fnv1a(h, static_cast<uint8_t>(c.kind));");
+    pp("        for (int i = 0; i < 4; ++i)");
+    pp("            h = fnv1a(h, static_cast<uint8_t>(c.cap >> (8 * i)));");
+    pp("    }");
+    pp();
+    pp("    return h;");
+    pp("}");
+    pp();
+    pp("constexpr size_t max_len()");
+    pp("{");
+    pp("    size_t n = 0;");
+    pp("    for (auto const &c : columns)");
+    pp("    {");
+    pp("        switch (c.kind)");
+    pp("        {");
+    pp("        case column_kind::zero_end: n += c.cap + 1; break;");
+    pp("        case column_kind::str8:");
+    pp("        case column_kind::bin8:     n += c.cap + 1; break;");
+    pp("        case column_kind::str16:");
+    pp("        case column_kind::bin16:    n += c.cap + 2; break;");
+    pp("        default:                    n += c.cap;     break;");
+    pp("        }");
+    pp("    }");
+    pp();
+    pp("    return n;");
+    pp("}");
+    pp();
+    pp("/* bytes of column in log_%s of the C api, value and its length before it */", name);
+    pp("constexpr size_t c_size(column_desc const &c)");
+    pp("{");
+    pp("    switch (c.kind)");
+    pp("    {");
+    pp("    case column_kind::fixed:    return c.cap;");
+    pp("    case column_kind::zero_end: return c.cap + 1;");
+    pp("    case column_kind::str8:     return 1 + c.cap + 1;");
+    pp("    case column_kind::str16:    return 2 + c.cap + 1;");
+    pp("    case column_kind::bin8:     return 1 + c.cap;");
+    pp("    case column_kind::bin16:    return 2 + c.cap;");
+    pp("    default:                    return c.cap;");
+    pp("    }");
+    pp("}");
+    pp();
+    pp("/* offset of value of column i in log_%s, which the C encoder read */", name);
+    pp("constexpr size_t c_offset(size_t i)");
+    pp("{");
+    pp("    size_t n = 0;");
+    pp("    for (size_t k = 0; k < i; ++k)");
+    pp("        n += c_size(columns[k]);");
+    pp();
+    pp("    switch (columns[i].kind)");
+    pp("    {");
+    pp("    case column_kind::str8:");
+    pp("    case column_kind::bin8:     return n + 1;");
+    pp("    case column_kind::str16:");
+    pp("    case column_kind::bin16:    return n + 2;");
+    pp("    default:                    return n;");
+    pp("    }");
+    pp("}");
+    pp();
+    pp("constexpr size_t c_struct_size()");
+    pp("{");
+    pp("    size_t n = 0;");
+    pp("    for (auto const &c : columns)");
+    pp("        n += c_size(c);");
+    pp();
+    pp("    return n;");
+    pp("}");
+    pp();
+    pp("inline uint8_t *put_u8(uint8_t *p, uint8_t v) noexcept");
+    pp("{");
+    pp("    p[0] = v;");
+    pp("    return p + 1;");
+    pp("}");
+    pp();
+    pp("inline uint8_t *put_u16(uint8_t *p, uint16_t v) noexcept");
+    pp("{");
+    pp("    p[0] = static_cast<uint8_t>(v >> 8);");
+    pp("    p[1] = static_cast<uint8_t>(v);");
+    pp("    return p + 2;");
+    pp("}");
+    pp();
+    pp("inline uint8_t *put_u32(uint8_t *p, uint32_t v) noexcept");
+    pp("{");
+    pp("    p[0] = static_cast<uint8_t>(v >> 24);");
+    pp("    p[1] = static_cast<uint8_t>(v >> 16);");
+    pp("    p[2] = static_cast<uint8_t>(v >> 8);");
+    pp("    p[3] = static_cast<uint8_t>(v);");
+    pp("    return p + 4;");
+    pp("}");
+    pp();
+    pp("inline uint8_t *put_u64(uint8_t *p, uint64_t v) noexcept");
+    pp("{");
+    pp("    put_u32(p, static_cast<uint32_t>(v >> 32));");
+    pp("    put_u32(p + 4, static_cast<uint32_t>(v));");
+    pp("    return p + 8;");
+    pp("}");
+    pp();
+    pp("inline uint8_t *put_float(uint8_t *p, float v) noexcept");
+    pp("{");
+    pp("    uint32_t i;");
+    pp("    std::memcpy(&i, &v, sizeof(i));");
+    pp("    return put_u32(p, i);");
+    pp("}");
+    pp();
+    pp("inline uint8_t *put_double(uint8_t *p, double v) noexcept");
+    pp("{");
+    pp("    uint64_t i;");
+    pp("    std::memcpy(&i, &v, sizeof(i));");
+    pp("    return put_u64(p, i);");
+    pp("}");
+    pp();
+    pp("inline uint32_t copy_in(char *dst, uint32_t cap, std::string_view v) noexcept");
+    pp("{");
+    pp("    uint32_t n = v.size() < cap ? static_cast<uint32_t>(v.size()) : cap;");
+    pp("    std::memcpy(dst, v.data(), n);");
+    pp("    return n;");
+    pp("}");
+    pp();
+    pp("} // namespace detail");
+    pp();
+    pp("/* the column table must not be edited by hand, it locks the wire layout */");
+    pp("static_assert(detail::fingerprint() == schema_fingerprint, \"column table does not match schema\");");
+    pp("static_assert(detail::max_len() == record_max_len, \"record max length does not match schema\");");
+    pp();
+    pp("/* both api must come from the same schema, and the table must match the C struct */");
+    pp("static_assert(schema_fingerprint == LOG_%s_SCHEMA_FINGERPRINT, \"C api is generated from another schema\");", \
+            macro_name());
+    pp("static_assert(detail::c_struct_size() == sizeof(::log_%s), \"column table does not match C struct\");", name);
+    size_t k = 0;
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (is_local_generate(curr))
+            continue;
+        pp("static_assert(offsetof(::log_%s, %s) == detail::c_offset(%zu), \"column %s does not match C struct\");", \
+                name, curr->name, k, curr->name);
+        ++k;
+    }
+    pp();
+    pp("struct byte_span");
+    pp("{");
+    pp("    uint8_t *data;");
+    pp("    size_t  size;");
+    pp("};");
+    pp();
+    pp("/* fixed capacity record, setters never allocate, too long values are truncated */");
+    pp("class record");
+    pp("{");
+    pp("public:");
+
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (is_local_generate(curr))
+            continue;
+        cpp_column_info(curr, &info);
+
+        if (info.type)
+        {
+            pp("    record &set_%s(%s v) noexcept", curr->name, info.type);
+            pp("    {");
+            pp("        %s_ = v;", curr->name);
+            pp("        return *this;");
+            pp("    }");
+        }
+        else
+        {
+            pp("    record &set_%s(std::string_view v) noexcept", curr->name);
+            pp("    {");
+            if (info.is_fixed)
+            {
+                pp("        uint32_t n = detail::copy_in(%s_, %u, v);", curr->name, info.cap);
+                pp("        std::memset(%s_ + n, 0, %u - n);", curr->name, info.cap);
+            }
+            else
+            {
+                pp("        %s_len_ = detail::copy_in(%s_, %u, v);", curr->name, curr->name, info.cap);
+            }
+            pp("        return *this;");
+            pp("    }");
+            if (strncmp(info.kind, "bin", 3) == 0 || info.is_fixed)
+            {
+                pp("    record &set_%s(void const *data, size_t size) noexcept", curr->name);
+                pp("    {");
+                pp("        return set_%s(std::string_view(static_cast<char const *>(data), size));", \
+                        curr->name);
+                pp("    }");
+            }
+        }
+        pp();
+    }
+
+    pp("    size_t encoded_size() const noexcept");
+    pp("    {");
+    fprintf(fpp, "        return %zu", fixed_len);
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (is_local_generate(curr))
+            continue;
+        cpp_column_info(curr, &info);
+        if (info.prefix || info.is_zero_end)
+            fprintf(fpp, " + %s_len_", curr->name);
+    }
+    pp(";");
+    pp("    }");
+    pp();
+    pp("    /* return bytes written, 0 if out is too small */");
+    pp("    size_t encode(byte_span out) const noexcept");
+    pp("    {");
+    pp("        if (out.size < encoded_size())");
+    pp("            return 0;");
+    pp();
+    pp("        return encode_unchecked(out.data);");
+    pp("    }");
+    pp();
+    pp("    /* out should have at least encoded_size() bytes */");
+    pp("    size_t encode_unchecked(uint8_t *out) const noexcept");
+    pp("    {");
+    pp("        uint8_t *p = out;");
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (is_local_generate(curr))
+            continue;
+        cpp_column_info(curr, &info);
+
+        if (info.type)
+        {
+            pp("        p = detail::%s(p, static_cast<%s>(%s_));", \
+                    info.put, info.put_type, curr->name);
+        }
+        else if (info.is_fixed)
+        {
+            pp("        std::memcpy(p, %s_, %u);", curr->name, info.cap);
+            pp("        p += %u;", info.cap);
+        }
+        else if (info.is_zero_end)
+        {
+            pp("        std::memcpy(p, %s_, %s_len_);", curr->name, curr->name);
+            pp("        p[%s_len_] = 0;", curr->name);
+            pp("        p += %s_len_ + 1;", curr->name);
+        }
+        else
+        {
+            if (info.prefix == 1)
+                pp("        p = detail::put_u8(p, static_cast<uint8_t>(%s_len_));", curr->name);
+            else
+                pp("        p = detail::put_u16(p, static_cast<uint16_t>(%s_len_));", curr->name);
+            pp("        std::memcpy(p, %s_, %s_len_);", curr->name, curr->name);
+            pp("        p += %s_len_;", curr->name);
+        }
+    }
+    pp();
+    pp("        return static_cast<size_t>(p - out);");
+    pp("    }");
+    pp();
+    pp("private:");
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (is_local_generate(curr))
+            continue;
+        cpp_column_info(curr, &info);
+
+        if (info.type)
+        {
+            pp("    %-20s %s_ = 0;", info.type, curr->name);
+        }
+        else
+        {
+            if (!info.is_fixed)
+                pp("    %-20s %s_len_ = 0;", "uint32_t", curr->name);
+            pp("    %-20s %s_[%u] = {};", "char", curr->name, info.cap ? info.cap : 1);
+        }
+    }
+    pp("};");
+    pp();
+    pp("/* result, command, sequence, echo len, no echo */");
+    pp("inline uint8_t *encode_head(uint8_t *p, uint8_t command) noexcept");
+    pp("{");
+    pp("    std::memset(p, 0, head_len);");
+    pp("    p[1] = command;");
+    pp("    return p + head_len;");
+    pp("}");
+    pp();
+    pp("/* one record one package, return bytes written, 0 if out is too small */");
+    pp("inline size_t encode_pkg(record const &r, byte_span out) noexcept");
+    pp("{");
+    pp("    if (out.size < head_len + r.encoded_size())");
+    pp("        return 0;");
+    pp();
+    pp("    return head_len + r.encode_unchecked(encode_head(out.data, command_log));");
+    pp("}");
+    pp();
+    pp("/* pack many records in one package */");
+    pp("class batch");
+    pp("{");
+    pp("public:");
+    pp("    batch() noexcept { clear(); }");
+    pp();
+    pp("    void clear() noexcept");
+    pp("    {");
+    pp("        encode_head(buf_, command_log_batch);");
+    pp("        len_ = head_len + 2;");
+    pp("        num_ = 0;");
+    pp("    }");
+    pp();
+    pp("    /* return false if package is full, send and clear then add again */");
+    pp("    bool add(record const &r) noexcept");
+    pp("    {");
+    pp("        size_t n = r.encoded_size();");
+    pp("        if (num_ == UINT16_MAX || len_ + 2 + n > pkg_max_len)");
+    pp("            return false;");
+    pp();
+    pp("        detail::put_u16(buf_ + len_, static_cast<uint16_t>(n));");
+    pp("        len_ += 2 + r.encode_unchecked(buf_ + len_ + 2);");
+    pp("        detail::put_u16(buf_ + head_len, ++num_);");
+    pp();
+    pp("        return true;");
+    pp("    }");
+    pp();
+    pp("    bool empty() const noexcept { return num_ == 0; }");
+    pp("    uint16_t size() const noexcept { return num_; }");
+    pp("    uint8_t const *data() const noexcept { return buf_; }");
+    pp("    size_t length() const noexcept { return len_; }");
+    pp();
+    pp("private:");
+    pp("    uint8_t  buf_[pkg_max_len];");
+    pp("    size_t   len_;");
+    pp("    uint16_t num_;");
+    pp("};");
+    pp();
+    pp("inline int send_log(int sockfd, sockaddr_in const &addr, record const &r) noexcept");
+    pp("{");
+    pp("    uint8_t buf[head_len + record_max_len];");
+    pp("    size_t len = encode_pkg(r, byte_span{ buf, sizeof(buf) });");
+    pp("    if (sendto(sockfd, buf, len, 0, reinterpret_cast<sockaddr const *>(&addr), sizeof(addr)) < 0)");
+    pp("        return -__LINE__;");
+    pp();
+    pp("    return 0;");
+    pp("}");
+    pp();
+    pp("inline int send_batch(int sockfd, sockaddr_in const &addr, batch const &b) noexcept");
+    pp("{");
+    pp("    if (b.empty())");
+    pp("        return 0;");
+    pp("    if (sendto(sockfd, b.data(), b.length(), 0, reinterpret_cast<sockaddr const *>(&addr), sizeof(addr)) < 0)");
+    pp("        return -__LINE__;");
+    pp();
+    pp("    return 0;");
+    pp("}");
+    pp();
+    pp("} // namespace %s", name);
+    pp("} // namespace logdb");
+
+    return 0;
+}
+
 static int generate_c_api(void)
 {
     fph = fopen(settings.api_head_path, "w+");
@@ -332,8 +1640,29 @@ static int generate_c_api(void)
     return 0;
 }
 
+static int generate_cpp_api(void)
+{
+    fpp = fopen(settings.api_cpp_head_path, "w+");
+    if (fpp == NULL)
+    {
+        fprintf(stderr, "open file: %s fail\n", settings.api_cpp_head_path);
+        return -__LINE__;
+    }
+
+    if (generate_cpp_api_hpp() < 0)
+        return -__LINE__;
+
+    fclose(fpp);
+
+    return 0;
+}
+
 int generate_api(void)
 {
-    return generate_c_api();
+    if (generate_c_api() < 0)
+        return -__LINE__;
+
+    /* need column length set by generate_c_api */
+    return generate_cpp_api();
 }
 
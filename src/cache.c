@@ -1,110 +1,281 @@
 /*
- * Description: 
+ * Description: slab allocator for buffers of loginf in flight.
  *     History: damonyang@tencent.com, 2013/07/01, create
+ *
+ * Sizes are rounded up to classes, 16 bytes apart up to 128, then 4
+ * classes every power of 2 up to 80 KB. Objects of a class are cut from
+ * slabs, slabs are mapped aligned to their size, so the slab of an object
+ * is found by masking its address. Each class keeps the slabs which have
+ * free objects in a list, and at most one empty slab, other empty slabs
+ * are unmapped. Buffers larger than the classes are malloc directly.
+ * All memory counts toward max size, alloc fail when it is reached.
+ * Alloc and free are thread safe, by one lock.
  */
 
-
 # include <stdint.h>
 # include <stdlib.h>
+# include <stdbool.h>
+# include <string.h>
+# include <pthread.h>
+# include <sys/mman.h>
+
+# include "list.h"
+# include "cache.h"
+
+# define SMALL_CLASS_NUM    8
+# define SMALL_CLASS_STEP   16
+# define CLASS_NUM          45
+# define CLASS_MAX_SIZE     (80 * 1024)
+# define SLAB_MIN_SIZE      (64 * 1024)
+# define SLAB_MIN_OBJS      8
+# define SLAB_HEAD_SIZE     64
 
-# define INITIAL_POOL_SIZE 64
+struct slab
+{
+    struct list_head    list;
+    void                *free;
+    uint32_t            free_num;
+    uint32_t            total;
+};
 
-struct cache_t
+struct size_class
 {
-    size_t buf_size;
-    size_t free_total;
-    size_t free_curr;
-    void   **free_ptr;
+    size_t              size;
+    size_t              slab_size;
+    struct list_head    partial;
+    struct slab         *empty;
 };
 
-static struct cache_t *const_cache_create(size_t buf_size)
+static struct size_class classes[CLASS_NUM];
+static size_t max_size;
+static struct cache_stat stats;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int get_class(size_t size)
+{
+    if (size == 0)
+        size = 1;
+
+    if (size <= SMALL_CLASS_NUM * SMALL_CLASS_STEP)
+        return (size - 1) / SMALL_CLASS_STEP;
+
+    size_t s = size - 1;
+    int lg = 63 - __builtin_clzl(s);
+
+    return SMALL_CLASS_NUM + (lg - 7) * 4 + ((s >> (lg - 2)) & 3);
+}
+
+static size_t class_size(int i)
+{
+    if (i < SMALL_CLASS_NUM)
+        return (i + 1) * SMALL_CLASS_STEP;
+
+    int lg = (i - SMALL_CLASS_NUM) / 4 + 7;
+    int q  = (i - SMALL_CLASS_NUM) % 4;
+
+    return (size_t)(5 + q) << (lg - 2);
+}
+
+int cache_init(size_t max)
+{
+    max_size = max;
+
+    int i;
+    for (i = 0; i < CLASS_NUM; ++i)
+    {
+        struct size_class *c = &classes[i];
+
+        c->size = class_size(i);
+        c->slab_size = SLAB_MIN_SIZE;
+        while (c->slab_size < SLAB_HEAD_SIZE + c->size * SLAB_MIN_OBJS)
+            c->slab_size *= 2;
+
+        INIT_LIST_HEAD(&c->partial);
+        c->empty = NULL;
+    }
+
+    if (class_size(CLASS_NUM - 1) != CLASS_MAX_SIZE)
+        return -__LINE__;
+
+    return 0;
+}
+
+static bool reserve(size_t size)
 {
-    struct cache_t *cache = calloc(1, sizeof(struct cache_t));
-    if (cache == NULL)
+    if (max_size && stats.mem_size + size > max_size)
+        return false;
+
+    stats.mem_size += size;
+
+    return true;
+}
+
+/* mmap twice of the size, and unmap the unaligned head and tail */
+static void *map_aligned(size_t size)
+{
+    char *p = mmap(NULL, size * 2, PROT_READ | PROT_WRITE, \
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    char *aligned = (char *)(((uintptr_t)p + size - 1) & ~(uintptr_t)(size - 1));
+    if (aligned != p)
+        munmap(p, aligned - p);
+    munmap(aligned + size, p + size - aligned);
+
+    return aligned;
+}
+
+static struct slab *slab_create(struct size_class *c)
+{
+    if (!reserve(c->slab_size))
         return NULL;
 
-    cache->free_ptr = calloc(INITIAL_POOL_SIZE, sizeof(void *));
-    if (cache->free_ptr == NULL)
+    struct slab *slab = map_aligned(c->slab_size);
+    if (slab == NULL)
+    {
+        stats.mem_size -= c->slab_size;
+
         return NULL;
+    }
+
+    slab->total = (c->slab_size - SLAB_HEAD_SIZE) / c->size;
+    slab->free_num = slab->total;
+    slab->free = NULL;
+
+    /* link objects from the end, so the first is allocated first */
+    char *base = (char *)slab + SLAB_HEAD_SIZE;
+    uint32_t i;
+    for (i = slab->total; i > 0; --i)
+    {
+        void *obj = base + (i - 1) * c->size;
+        *(void **)obj = slab->free;
+        slab->free = obj;
+    }
 
-    cache->free_total = INITIAL_POOL_SIZE;
-    cache->buf_size = buf_size;
+    ++stats.slab_num;
 
-    return cache;
+    return slab;
 }
 
-static void *const_cache_alloc(struct cache_t *cache)
+static void slab_destroy(struct size_class *c, struct slab *slab)
 {
-    if (cache->free_curr > 0)
-        return cache->free_ptr[--cache->free_curr];
+    munmap(slab, c->slab_size);
 
-    return malloc(cache->buf_size);
+    stats.mem_size -= c->slab_size;
+    --stats.slab_num;
 }
 
-static void const_cache_free(struct cache_t *cache, void *obj)
+static void *inner_alloc(size_t size)
 {
-    if (cache->free_curr < cache->free_total)
+    if (size > CLASS_MAX_SIZE)
     {
-        cache->free_ptr[cache->free_curr++] = obj;
+        void *ptr = NULL;
+        if (reserve(size) && (ptr = malloc(size)) == NULL)
+            stats.mem_size -= size;
+
+        if (ptr == NULL)
+        {
+            ++stats.fail_num;
+
+            return NULL;
+        }
+
+        stats.used_size += size;
+        ++stats.alloc_num;
+
+        return ptr;
+    }
+
+    struct size_class *c = &classes[get_class(size)];
+
+    struct slab *slab;
+    if (c->partial.next != &c->partial)
+    {
+        slab = list_entry(c->partial.next, struct slab, list);
     }
     else
     {
-        size_t new_total = cache->free_total * 2;
-        void **new_free = realloc(cache->free_ptr, new_total * sizeof(void *));
-        if (new_free != NULL)
-        {
-            cache->free_total = new_total;
-            cache->free_ptr = new_free;
-            cache->free_ptr[cache->free_curr++] = obj;
-        }
-        else
+        slab = c->empty;
+        c->empty = NULL;
+        if (slab == NULL)
+            slab = slab_create(c);
+        if (slab == NULL)
         {
-            free(obj);
+            ++stats.fail_num;
+
+            return NULL;
         }
+
+        list_add(&slab->list, &c->partial);
     }
-}
 
-static struct cache_t *g_caches[14];
+    void *obj = slab->free;
+    slab->free = *(void **)obj;
+    if (--slab->free_num == 0)
+        list_del(&slab->list);
 
-int cache_init(void)
+    stats.used_size += size;
+    ++stats.alloc_num;
+
+    return obj;
+}
+
+void *cache_alloc(size_t size)
 {
-    int i;
-    for (i = 0; i < 14; ++i)
-    {
-        if ((g_caches[i] = const_cache_create(1 << (i + 3))) == NULL)
-            return -__LINE__;
-    }
+    pthread_mutex_lock(&lock);
+    void *ptr = inner_alloc(size);
+    pthread_mutex_unlock(&lock);
 
-    return 0;
+    return ptr;
 }
 
-static inline struct cache_t *cache_choice(size_t size)
+static void inner_free(void *ptr, size_t size)
 {
-    int i;
-    for (i = 0; i < 14; ++i)
+    stats.used_size -= size;
+
+    if (size > CLASS_MAX_SIZE)
     {
-        if (size < ((size_t)1 << (i + 3)))
-            return g_caches[i];
+        free(ptr);
+        stats.mem_size -= size;
+
+        return;
     }
 
-    return NULL;
-}
+    struct size_class *c = &classes[get_class(size)];
+    struct slab *slab = (struct slab *)((uintptr_t)ptr & ~(uintptr_t)(c->slab_size - 1));
 
-void *cache_alloc(size_t size)
-{
-    struct cache_t *cache = cache_choice(size);
-    if (cache == NULL)
-        return malloc(size);
+    *(void **)ptr = slab->free;
+    slab->free = ptr;
+
+    if (slab->free_num++ == 0)
+        list_add(&slab->list, &c->partial);
+
+    /* keep one empty slab, avoid map and unmap on every alloc and free */
+    if (slab->free_num == slab->total)
+    {
+        list_del(&slab->list);
 
-    return const_cache_alloc(cache);
+        if (c->empty == NULL)
+            c->empty = slab;
+        else
+            slab_destroy(c, slab);
+    }
 }
 
 void cache_free(void *ptr, size_t size)
 {
-    struct cache_t *cache = cache_choice(size);
-    if (cache == NULL)
-        return free(ptr);
+    if (ptr == NULL)
+        return;
 
-    const_cache_free(cache, ptr);
+    pthread_mutex_lock(&lock);
+    inner_free(ptr, size);
+    pthread_mutex_unlock(&lock);
 }
 
+void cache_get_stat(struct cache_stat *s)
+{
+    pthread_mutex_lock(&lock);
+    *s = stats;
+    pthread_mutex_unlock(&lock);
+}
@@ -6,10 +6,25 @@
 # pragma once
 
 # include <stddef.h>
+# include <stdint.h>
 
-int cache_init(void);
+struct cache_stat
+{
+    size_t              mem_size;   /* slabs and large buffers */
+    size_t              used_size;  /* size of buffers in use */
+    size_t              slab_num;
+    uint64_t            alloc_num;
+    uint64_t            fail_num;
+};
 
+/* max_size limit memory of all buffers, 0 means no limit */
+int cache_init(size_t max_size);
+
+/* return NULL if max size is reached */
 void *cache_alloc(size_t size);
 
+/* size must be the same as alloc */
 void cache_free(void *ptr, size_t size);
 
+void cache_get_stat(struct cache_stat *stat);
+
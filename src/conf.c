@@ -13,6 +13,8 @@
 # include "conf.h"
 # include "ini.h"
 # include "utils.h"
+# include "sink.h"
+# include "seq.h"
 
 struct settings settings;
 
@@ -437,6 +439,44 @@ int read_settings(char const *config_file_path)
     if (ini_read_int(conf, "", "cache size", &settings.cache_len, 1000000) < 0)
         return -__LINE__;
 
+    if (ini_read_bool(conf, "", "adaptive cache", &settings.is_adaptive_cache, false) < 0)
+        return -__LINE__;
+
+    if (settings.is_adaptive_cache)
+    {
+        if (settings.cache_time_in_ms <= 0)
+        {
+            fprintf(stderr, "'adaptive cache' need 'cache time in ms' greater than 0\n");
+
+            return -__LINE__;
+        }
+
+        if (ini_read_int(conf, "", "cache size min", &settings.cache_len_min, \
+                    settings.cache_len / 16) < 0)
+            return -__LINE__;
+
+        if (ini_read_int(conf, "", "cache time min in ms", &settings.cache_time_min_in_ms, \
+                    (settings.cache_time_in_ms + 9) / 10) < 0)
+            return -__LINE__;
+
+        if (ini_read_int(conf, "", "latency slo in ms", &settings.latency_slo_in_ms, \
+                    settings.cache_time_in_ms * 2) < 0)
+            return -__LINE__;
+
+        if (settings.cache_len_min <= 0 || settings.cache_len_min > settings.cache_len || \
+                settings.cache_time_min_in_ms <= 0 || \
+                settings.cache_time_min_in_ms > settings.cache_time_in_ms)
+        {
+            fprintf(stderr, "'cache size min' and 'cache time min in ms' should be in (0, max]\n");
+
+            return -__LINE__;
+        }
+
+        settings.check_time_in_ms = (settings.cache_time_min_in_ms + 4) / 5;
+        if (settings.check_time_in_ms > 100)
+            settings.check_time_in_ms = 100;
+    }
+
     if (ini_read_str(conf, "", "default log path", \
                 &settings.default_log_path, "../log/default") < 0)
         return -__LINE__;
@@ -445,6 +485,9 @@ int read_settings(char const *config_file_path)
                 &settings.default_log_flag, "fatal, error, warn, info, notice") < 0)
         return -__LINE__;
 
+    if (ini_read_bool(conf, "", "async log", &settings.is_async_log, true) < 0)
+        return -__LINE__;
+
     if (ini_read_str(conf, "", "fail enqueue log path", \
                 &settings.fail_enqueue_log_path, "../log/enqueue_fail") < 0)
         return -__LINE__;
@@ -453,6 +496,19 @@ int read_settings(char const *config_file_path)
                 &settings.fail_insert_log_path, "../log/insert_fail") < 0)
         return -__LINE__;
 
+    char *fail_log_format = NULL;
+    if (ini_read_str(conf, "", "fail log format", &fail_log_format, "text") < 0)
+        return -__LINE__;
+    if (strcasecmp(fail_log_format, "binary") == 0)
+        settings.is_binary_fail_log = true;
+    else if (strcasecmp(fail_log_format, "text") != 0)
+    {
+        fprintf(stderr, "unknown fail log format: %s\n", fail_log_format);
+
+        return -__LINE__;
+    }
+    free(fail_log_format);
+
     if (ini_read_int(conf, "", "worker process num", \
                 &settings.worker_proc_num, 1) < 0)
         return -__LINE__;
@@ -484,10 +540,94 @@ int read_settings(char const *config_file_path)
                 &settings.queue_bin_file_max_size, 10 * 1024 * 1024 * 1024ull) < 0)
         return -__LINE__;
 
+    if (ini_read_int(conf, "", "local queue shm key", \
+                &settings.local_queue_shm_key, 0) < 0)
+        return -__LINE__;
+
+    if (ini_read_uint32(conf, "", "local queue memory size", \
+                &settings.local_queue_mem_size, 8 * 1024 * 1024) < 0)
+        return -__LINE__;
+
+    if (ini_read_str(conf, "", "local socket path", \
+                &settings.local_socket_path, NULL) < 0)
+        return -__LINE__;
+
+    if (ini_read_unsigned(conf, "", "dedup window time", \
+                &settings.dedup_window_time, 0) < 0)
+        return -__LINE__;
+
+    if (ini_read_uint32(conf, "", "dedup window size", \
+                &settings.dedup_window_size, 100000) < 0)
+        return -__LINE__;
+
+    if (ini_read_int(conf, "", "dedup shm key", \
+                &settings.dedup_shm_key, 0) < 0)
+        return -__LINE__;
+
+    if (ini_read_str(conf, "", "rate limit", &settings.rate_limit, NULL) < 0)
+        return -__LINE__;
+
+    if (ini_read_uint32(conf, "", "global rate limit", \
+                &settings.global_rate_limit, 0) < 0)
+        return -__LINE__;
+
+    if (ini_read_uint64(conf, "", "backpressure low water", \
+                &settings.backpressure_low_water, 0) < 0)
+        return -__LINE__;
+
+    if (ini_read_uint64(conf, "", "backpressure high water", \
+                &settings.backpressure_high_water, settings.backpressure_low_water * 4) < 0)
+        return -__LINE__;
+
+    if (settings.backpressure_low_water && \
+            settings.backpressure_high_water <= settings.backpressure_low_water)
+    {
+        fprintf(stderr, "'backpressure high water' should be greater than 'backpressure low water'\n");
+
+        return -__LINE__;
+    }
+
+    if (ini_read_uint16(conf, "", "backpressure retry after", \
+                &settings.backpressure_retry_after, 1000) < 0)
+        return -__LINE__;
+
     if (ini_read_str(conf, "", "global sequence file", \
                 &settings.global_sequence_file, "../binlog/global_sequence") < 0)
         return -__LINE__;
 
+    if (ini_read_uint32(conf, "", "global sequence lease size", \
+                &settings.global_sequence_lease_size, 1000) < 0)
+        return -__LINE__;
+
+    char *global_sequence_type = NULL;
+    if (ini_read_str(conf, "", "global sequence type", &global_sequence_type, "file") < 0)
+        return -__LINE__;
+    if (strcasecmp(global_sequence_type, "file") == 0)
+        settings.global_sequence_type = SEQUENCE_BY_FILE;
+    else if (strcasecmp(global_sequence_type, "snowflake") == 0)
+        settings.global_sequence_type = SEQUENCE_BY_TIME;
+    else
+    {
+        fprintf(stderr, "unknown global sequence type: %s\n", global_sequence_type);
+
+        return -__LINE__;
+    }
+    free(global_sequence_type);
+
+    if (ini_read_uint16(conf, "", "global sequence instance id", \
+                &settings.global_sequence_instance_id, 0) < 0)
+        return -__LINE__;
+
+    if (ini_read_str(conf, "", "sink", &settings.sink_name, "mysql") < 0)
+        return -__LINE__;
+
+    if (sink_init() < 0)
+    {
+        fprintf(stderr, "unknown sink: %s\n", settings.sink_name);
+
+        return -__LINE__;
+    }
+
     if (ini_read_str(conf, "", "db host", &settings.db_host, "localhost") < 0)
         return -__LINE__;
 
@@ -516,6 +656,21 @@ int read_settings(char const *config_file_path)
     if (ini_read_str(conf, "", "db engine", &settings.db_engine, "MyISAM") < 0)
         return -__LINE__;
 
+    if (ini_read_str(conf, "", "sqlite file", &settings.sqlite_file, NULL) < 0)
+        return -__LINE__;
+
+    if (settings.sqlite_file == NULL)
+    {
+        settings.sqlite_file = malloc(strlen(settings.db_name) + 20);
+        if (settings.sqlite_file == NULL)
+            return -__LINE__;
+
+        sprintf(settings.sqlite_file, "../data/%s.db", settings.db_name);
+    }
+
+    if (ini_read_str(conf, "", "segment path", &settings.segment_path, "../data/segment") < 0)
+        return -__LINE__;
+
     if (ini_read_str(conf, "", "db table name", &settings.db_table_name, NULL) != 0)
     {
         fprintf(stderr, "'db table name' is required field\n");
@@ -533,6 +688,31 @@ int read_settings(char const *config_file_path)
 
     NEG_RET(read_columns(conf));
 
+    if (settings.global_sequence_type == SEQUENCE_BY_TIME)
+    {
+        struct column *curr = settings.columns;
+        while (curr)
+        {
+            if (curr->is_global_sequence && curr->type != COLUMN_TYPE_BIG_INT)
+            {
+                fprintf(stderr, "in column %s, snowflake 'global sequence' must be bigint\n", \
+                        curr->name);
+
+                return -__LINE__;
+            }
+
+            curr = curr->next;
+        }
+
+        if (settings.global_sequence_instance_id >= (1 << SEQUENCE_NODE_BITS))
+        {
+            fprintf(stderr, "'global sequence instance id' should be less than %d\n", \
+                    1 << SEQUENCE_NODE_BITS);
+
+            return -__LINE__;
+        }
+    }
+
     if (ini_read_int(conf, "", "hash table num", &settings.hash_table_num, 1) < 0)
         return -__LINE__;
 
@@ -586,12 +766,25 @@ int read_settings(char const *config_file_path)
     if ((settings.tables = calloc(settings.hash_table_num, sizeof(struct table))) == NULL)
         return -__LINE__;
 
+    int i;
+    for (i = 0; i < settings.hash_table_num; ++i)
+    {
+        settings.tables[i].flush_len = settings.cache_len;
+        settings.tables[i].flush_time_in_ms = settings.cache_time_in_ms;
+    }
+
     if (ini_read_str(conf, "", "api head file", &settings.api_head_path, NULL) < 0)
         return -__LINE__;
 
     if (ini_read_str(conf, "", "api source file", &settings.api_source_path, NULL) < 0)
         return -__LINE__;
 
+    if (ini_read_str(conf, "", "api cpp head file", &settings.api_cpp_head_path, NULL) < 0)
+        return -__LINE__;
+
+    if (ini_read_bool(conf, "", "api async", &settings.is_api_async, false) < 0)
+        return -__LINE__;
+
     if (settings.api_head_path == NULL)
     {
         settings.api_head_path = malloc(strlen(settings.server_name) + 20);
@@ -610,6 +803,15 @@ int read_settings(char const *config_file_path)
         sprintf(settings.api_source_path, "../api/log_%s_api.c", settings.server_name);
     }
 
+    if (settings.api_cpp_head_path == NULL)
+    {
+        settings.api_cpp_head_path = malloc(strlen(settings.server_name) + 20);
+        if (settings.api_cpp_head_path == NULL)
+            return -__LINE__;
+
+        sprintf(settings.api_cpp_head_path, "../api/log_%s_api.hpp", settings.server_name);
+    }
+
     ini_free(conf);
 
     return 0;
@@ -11,7 +11,9 @@
 # include <sys/time.h>
 
 # include "queue.h"
+# include "bhash.h"
 # include "dlog.h"
+# include "faillog.h"
 
 enum column_type
 {
@@ -43,6 +45,12 @@ enum shift_type
     TABLE_NO_SHIFT,
 };
 
+enum sequence_type
+{
+    SEQUENCE_BY_FILE = 1,
+    SEQUENCE_BY_TIME,
+};
+
 enum alter_type
 {
     ALTER_ADD = 1,
@@ -92,13 +100,36 @@ struct table
     size_t              buf_use;
     bool                not_first;
     struct timeval      start;
+
+    /* insert statement head, rebuilt when table shift */
+    char                *prefix;
+    size_t              prefix_size;
+    size_t              prefix_len;
+    int                 prefix_period;
+
+    /* flush bound, tuned by receiver if adaptive cache is on */
+    size_t              flush_len;
+    int                 flush_time_in_ms;
+    uint64_t            arrive_bytes;
+    double              arrive_rate;    /* bytes per ms */
+};
+
+/* write by worker, read by receiver, in share memory */
+struct worker_stat
+{
+    volatile uint64_t   insert_num;
+    volatile uint64_t   insert_bytes;
+    volatile uint64_t   insert_us;
+    /* fit insert us = fixed + bytes * per byte */
+    volatile double     insert_bytes_sq;
+    volatile double     insert_bytes_us;
 };
 
 struct worker
 {
     int                 pid;
-    int                 pipefd[2];
     queue_t             queue;
+    struct worker_stat  *stat;
 };
 
 struct settings
@@ -112,12 +143,17 @@ struct settings
 
     char                *default_log_path;
     char                *default_log_flag;
+    bool                is_async_log;
 
     char                *fail_enqueue_log_path;
     dlog_t              *fail_enqueue_log;
     char                *fail_insert_log_path;
     dlog_t              *fail_insert_log;
 
+    bool                is_binary_fail_log;
+    faillog_t           *fail_enqueue_bin;
+    faillog_t           *fail_insert_bin;
+
     int                 worker_proc_num;
     struct worker       *workers;
 
@@ -128,10 +164,31 @@ struct settings
 
     queue_t             cache_queue;
 
+    int                 local_queue_shm_key;
+    uint32_t            local_queue_mem_size;
+    queue_t             local_queue;
+    char                *local_socket_path;
+
+    unsigned            dedup_window_time;
+    uint32_t            dedup_window_size;
+    int                 dedup_shm_key;
+    bhash_t             dedup;
+
+    char                *rate_limit;
+    uint32_t            global_rate_limit;
+
+    uint64_t            backpressure_low_water;
+    uint64_t            backpressure_high_water;
+    uint16_t            backpressure_retry_after;
+
     struct column       *columns;
     char                *columns_str;
     size_t              columns_str_len;
 
+    char                *sink_name;
+    char                *sqlite_file;
+    char                *segment_path;
+
     uint16_t             db_port;
     char                *db_host;
     char                *db_name;
@@ -148,6 +205,11 @@ struct settings
     int                 cache_time_in_ms;
     int                 check_time_in_ms;
 
+    bool                is_adaptive_cache;
+    int                 cache_len_min;
+    int                 cache_time_min_in_ms;
+    int                 latency_slo_in_ms;
+
     int                 shift_table_type;
     int                 hash_table_num;
     struct column       *hash_table_column;
@@ -156,9 +218,16 @@ struct settings
 
     bool                has_global_sequence;
     char                *global_sequence_file;
+    /* ids leased from the file at a time */
+    uint32_t            global_sequence_lease_size;
+    /* file or snowflake, time + instance + counter */
+    int                 global_sequence_type;
+    uint16_t            global_sequence_instance_id;
 
     char                *api_head_path;
     char                *api_source_path;
+    char                *api_cpp_head_path;
+    bool                is_api_async;
 };
 
 extern struct settings settings;
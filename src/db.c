@@ -16,9 +16,12 @@
 # include "db.h"
 # include "utils.h"
 # include "utf8.h"
+# include "sql.h"
+# include "sink.h"
 
 static MYSQL *mysql_conn;
 static bool connect_flag;
+static int  last_query_ret;
 
 char *db_error(void)
 {
@@ -96,7 +99,8 @@ int db_query(const void *query, size_t length)
 
 int db_safe_query(const void *query, size_t length)
 {
-    NEG_RET(db_query(query, length));
+    last_query_ret = db_query(query, length);
+    NEG_RET(last_query_ret);
 
     MYSQL_RES *result = mysql_store_result(mysql_conn);
     if (result != NULL)
@@ -110,6 +114,51 @@ int db_affected_rows(void)
     return (int)mysql_affected_rows(mysql_conn);
 }
 
+/* same as mysql_real_escape_string, for sinks which don't connect mysql */
+static int escape_string(char *to, const char *from, size_t len)
+{
+    char *p = to;
+    size_t i;
+    for (i = 0; i < len; ++i)
+    {
+        char c = from[i];
+        char e = 0;
+        switch (c)
+        {
+        case '\0':
+            e = '0';
+            break;
+        case '\n':
+            e = 'n';
+            break;
+        case '\r':
+            e = 'r';
+            break;
+        case '\032':
+            e = 'Z';
+            break;
+        case '\\':
+        case '\'':
+        case '"':
+            e = c;
+            break;
+        }
+
+        if (e)
+        {
+            *p++ = '\\';
+            *p++ = e;
+        }
+        else
+        {
+            *p++ = c;
+        }
+    }
+    *p = '\0';
+
+    return (int)(p - to);
+}
+
 int db_escape_string(char *to, const char *from, size_t len)
 {
     if (settings.is_utf8)
@@ -151,9 +200,15 @@ int db_escape_string(char *to, const char *from, size_t len)
         char str[len + 1];
         n = u8encode(us, str, len + 1, NULL);
 
+        if (connect_flag == false)
+            return escape_string(to, str, n);
+
         return mysql_real_escape_string(mysql_conn, to, str, (unsigned long)n);
     }
 
+    if (connect_flag == false)
+        return escape_string(to, from, len);
+
     return mysql_real_escape_string(mysql_conn, to, from, (unsigned long)len);
 }
 
@@ -319,3 +374,67 @@ int db_show_create_table(char *table, char **create_table)
     return 0;
 }
 
+
+static int mysql_sink_open(void)
+{
+    return db_connect();
+}
+
+static int mysql_create_table(char const *table)
+{
+    char *create_sql = create_table_sql((char *)table);
+    if (create_sql == NULL)
+        return -__LINE__;
+
+    log_info("worker: %d, sql: %s", settings.worker_id, create_sql);
+
+    return db_safe_query(create_sql, 0);
+}
+
+static int mysql_drop_table(char const *table)
+{
+    char sql[30 + strlen(table)];
+    sprintf(sql, "DROP TABLE IF EXISTS `%s`", table);
+
+    log_debug("worker: %d, sql: %s", settings.worker_id, sql);
+
+    return db_safe_query(sql, 0);
+}
+
+static int mysql_exec(char const *sql, size_t len)
+{
+    return db_safe_query(sql, len);
+}
+
+static int mysql_insert_sql(char const *sql, size_t len)
+{
+    NEG_RET(db_safe_query(sql, len));
+
+    return db_affected_rows();
+}
+
+static int mysql_error_class(void)
+{
+    if (last_query_ret == -1)
+        return SINK_ERR_RETRY;
+
+    return SINK_ERR_FATAL;
+}
+
+static char const *mysql_sink_error(void)
+{
+    return db_error();
+}
+
+struct sink const mysql_sink =
+{
+    .name           = "mysql",
+    .open           = mysql_sink_open,
+    .close          = db_close,
+    .create_table   = mysql_create_table,
+    .drop_table     = mysql_drop_table,
+    .exec           = mysql_exec,
+    .insert_sql     = mysql_insert_sql,
+    .error_class    = mysql_error_class,
+    .error          = mysql_sink_error,
+};
@@ -17,6 +17,8 @@
 # include <limits.h>
 # include <unistd.h>
 # include <inttypes.h>
+# include <pthread.h>
+# include <semaphore.h>
 # include <sys/types.h>
 # include <sys/stat.h>
 # include <sys/time.h>
@@ -25,6 +27,7 @@
 # include <arpa/inet.h>
 
 # include "dlog.h"
+# include "utils.h"
 
 dlog_t *default_dlog = NULL;
 int     default_dlog_flag = 0;
@@ -33,6 +36,9 @@ int     default_dlog_flag = 0;
 # define WRITE_BUFFER_CHECK_LEN (32 * 1024)     /* 32 KB */
 # define WRITE_BUFFER_LEN       (64 * 1024)     /* 64 KB */
 
+# define ASYNC_RING_NUM         16
+# define ASYNC_BUFFER_MAX       (64 * 1024 * 1024)  /* 64 MB */
+
 # ifdef DEBUG
 static int write_times = 0;
 # endif
@@ -43,21 +49,25 @@ static dlog_t *lp_list_head = NULL;
 /* use to make sure dlog_atexit only call once */
 static int init_flag = 0;
 
-static char *log_suffix(int type, time_t sec, int i)
+static char *log_suffix(int type, int raw, time_t sec, int i)
 {
-    static char str[30];
+    char const *ext = raw ? "bin" : "log";
+
+    /* writer thread of async log use it too */
+    static __thread char str[30];
 
     if (type == DLOG_SHIFT_BY_SIZE)
     {
         if (i)
-            snprintf(str, sizeof(str), "%d.log", i);
+            snprintf(str, sizeof(str), "%d.%s", i, ext);
         else
-            snprintf(str, sizeof(str), ".log");
+            snprintf(str, sizeof(str), ".%s", ext);
 
         return str;
     }
 
-    struct tm *t = localtime(&sec);
+    struct tm tm;
+    struct tm *t = localtime_r(&sec, &tm);
     ssize_t n = 0;
 
     switch (type)
@@ -85,19 +95,13 @@ static char *log_suffix(int type, time_t sec, int i)
     }
 
     if (i)
-        snprintf(str + n, sizeof(str) - n, "_%d.log", i);
+        snprintf(str + n, sizeof(str) - n, "_%d.%s", i, ext);
     else
-        snprintf(str + n, sizeof(str) - n, ".log");
+        snprintf(str + n, sizeof(str) - n, ".%s", ext);
 
     return str;
 }
 
-static inline uint64_t timeval_diff(struct timeval *old, struct timeval *new)
-{
-    return (new->tv_sec - old->tv_sec) * (1000 * 1000) -
-        (old->tv_usec - new->tv_usec);
-}
-
 static int _unlink_expire(dlog_t *lp, time_t expire_time)
 {
     char path[PATH_MAX];
@@ -109,7 +113,7 @@ static int _unlink_expire(dlog_t *lp, time_t expire_time)
         for (i = 0;; ++i)
         {
             snprintf(path, PATH_MAX, "%s%s", lp->base_name,
-                    log_suffix(lp->shift_type, expire_time, i));
+                    log_suffix(lp->shift_type, lp->raw, expire_time, i));
             if (access(path, F_OK) == 0)
                 ++num;
             else
@@ -124,7 +128,7 @@ static int _unlink_expire(dlog_t *lp, time_t expire_time)
     for (i = 0; i < num; ++i)
     {
         snprintf(path, PATH_MAX, "%s%s", lp->base_name,
-                log_suffix(lp->shift_type, expire_time, i));
+                log_suffix(lp->shift_type, lp->raw, expire_time, i));
 
         unlink(path);
     }
@@ -199,7 +203,7 @@ static int unlink_expire(dlog_t *lp, struct timeval *now)
 static char *log_name(dlog_t *lp, struct timeval *now)
 {
     sprintf(lp->name, "%s%s", lp->base_name,
-            log_suffix(lp->shift_type, now->tv_sec, 0));
+            log_suffix(lp->shift_type, lp->raw, now->tv_sec, 0));
 
     return lp->name;
 }
@@ -222,7 +226,7 @@ static int _shift_log(dlog_t *lp, struct timeval *now)
         for (i = 0;; ++i)
         {
             snprintf(path, PATH_MAX, "%s%s", lp->base_name,
-                    log_suffix(lp->shift_type, now->tv_sec, i));
+                    log_suffix(lp->shift_type, lp->raw, now->tv_sec, i));
             if (access(path, F_OK) == 0)
                 ++num;
             else
@@ -237,12 +241,12 @@ static int _shift_log(dlog_t *lp, struct timeval *now)
     for (i = num - 1; i >= 0; --i)
     {
         snprintf(path, PATH_MAX, "%s%s", lp->base_name,
-                log_suffix(lp->shift_type, now->tv_sec, i));
+                log_suffix(lp->shift_type, lp->raw, now->tv_sec, i));
 
         if (access(path, F_OK) == 0)
         {
             snprintf(new_path, PATH_MAX, "%s%s", lp->base_name,
-                    log_suffix(lp->shift_type, now->tv_sec, i + 1));
+                    log_suffix(lp->shift_type, lp->raw, now->tv_sec, i + 1));
 
             rename(path, new_path);
         }
@@ -298,40 +302,288 @@ static int shift_log(dlog_t *lp, struct timeval *now)
     return ret;
 }
 
-static ssize_t xwrite(int fd, const void *buf, size_t len)
+struct dlog_chunk
+{
+    char                *buf;
+    size_t              len;
+    struct timeval      time;
+};
+
+/*
+ * buffers are passed from producer to writer by a single producer single
+ * consumer ring, producer only move head, writer only move tail.
+ */
+struct dlog_async
+{
+    pid_t               pid;    /* process the writer running in */
+    pthread_t           writer;
+    sem_t               wake;
+    sem_t               room;   /* posted when producer wait for room */
+    int                 waiting;
+    int                 no_drop;
+    int                 stop;
+    unsigned            head;
+    unsigned            tail;
+    struct dlog_chunk   ring[ASYNC_RING_NUM];
+    uint64_t            drop;
+
+    int                 fd;
+    size_t              size;
+    char                *name;
+};
+
+/* run in writer thread */
+static void async_write(dlog_t *lp, struct dlog_chunk *c)
+{
+    struct dlog_async *a = lp->async;
+
+    log_name(lp, &c->time);
+    if (a->fd >= 0 && strcmp(a->name, lp->name) != 0)
+    {
+        close(a->fd);
+        a->fd = -1;
+    }
+
+    unlink_expire(lp, &c->time);
+    if (a->fd >= 0 && lp->max_size && a->size >= lp->max_size)
+    {
+        close(a->fd);
+        a->fd = -1;
+        _shift_log(lp, &c->time);
+    }
+
+    if (a->fd < 0)
+    {
+        a->fd = open(lp->name, O_WRONLY | O_APPEND | O_CREAT, 0664);
+        if (a->fd < 0)
+            return;
+
+        struct stat fs;
+        a->size = (fstat(a->fd, &fs) == 0) ? (size_t)fs.st_size : 0;
+        strcpy(a->name, lp->name);
+    }
+
+    if (write_in_full(a->fd, c->buf, c->len) > 0)
+        a->size += c->len;
+}
+
+static void *async_writer(void *arg)
 {
-    ssize_t nr;
+    dlog_t *lp = arg;
+    struct dlog_async *a = lp->async;
+
     while (1)
     {
-        nr = write(fd, buf, len);
-        if ((nr < 0) && (errno == EAGAIN || errno == EINTR))
-            continue;
+        while (sem_wait(&a->wake) < 0 && errno == EINTR)
+            ;
 
-        return nr;
+        int stop = __atomic_load_n(&a->stop, __ATOMIC_ACQUIRE);
+        unsigned head = __atomic_load_n(&a->head, __ATOMIC_ACQUIRE);
+        while (a->tail != head)
+        {
+            struct dlog_chunk *c = &a->ring[a->tail % ASYNC_RING_NUM];
+            async_write(lp, c);
+            free(c->buf);
+            __atomic_store_n(&a->tail, a->tail + 1, __ATOMIC_SEQ_CST);
+            if (__atomic_exchange_n(&a->waiting, 0, __ATOMIC_SEQ_CST))
+                sem_post(&a->room);
+        }
+
+        if (stop)
+            break;
     }
+
+    return NULL;
 }
 
-static ssize_t write_in_full(int fd, const void *buf, size_t count)
+static int async_start(dlog_t *lp)
 {
-    const char *p = buf;
-    ssize_t total = 0;
+    struct dlog_async *a = lp->async;
 
-    while (count > 0)
+    /* ring entries inherited from parent belong to its writer, it may
+     * have written or freed them, drop them without touch */
+    a->tail = a->head;
+
+    if (a->fd >= 0)
+        close(a->fd);
+    a->fd   = -1;
+    a->stop = 0;
+    a->waiting = 0;
+    a->pid  = getpid();
+
+    if (sem_init(&a->wake, 0, 0) < 0)
+        return -1;
+    if (sem_init(&a->room, 0, 0) < 0)
     {
-        ssize_t written = xwrite(fd, p, count);
-        if (written < 0)
-            return -1;
-        if (!written)
+        sem_destroy(&a->wake);
+
+        return -1;
+    }
+    if (pthread_create(&a->writer, NULL, async_writer, lp) != 0)
+    {
+        sem_destroy(&a->wake);
+        sem_destroy(&a->room);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+/* hand the buffer to writer, keep it if the ring is full */
+static int async_push(dlog_t *lp, struct timeval *now)
+{
+    struct dlog_async *a = lp->async;
+
+    if (a->pid != getpid() && async_start(lp) < 0)
+        return -1;
+
+    unsigned tail = __atomic_load_n(&a->tail, __ATOMIC_ACQUIRE);
+    if (a->head - tail == ASYNC_RING_NUM)
+        return -2;
+
+    char *buf = malloc(WRITE_BUFFER_LEN);
+    if (buf == NULL)
+        return -3;
+
+    struct dlog_chunk *c = &a->ring[a->head % ASYNC_RING_NUM];
+    c->buf  = lp->buf;
+    c->len  = lp->w_len;
+    c->time = *now;
+    __atomic_store_n(&a->head, a->head + 1, __ATOMIC_RELEASE);
+    sem_post(&a->wake);
+
+    lp->buf     = buf;
+    lp->buf_len = WRITE_BUFFER_LEN;
+    lp->w_len   = 0;
+    lp->last_write = *now;
+
+    /* a text line in raw log break its format */
+    if (a->drop && !lp->raw)
+    {
+        lp->w_len = snprintf(lp->buf, lp->buf_len, "[dlog] async buffer full, "
+                "%"PRIu64" lines dropped\n", a->drop);
+        a->drop = 0;
+    }
+
+    return 0;
+}
+
+/* hand the buffer to writer, wait writer free a ring entry if it is full */
+static int async_push_wait(dlog_t *lp, struct timeval *now)
+{
+    struct dlog_async *a = lp->async;
+
+    int ret;
+    while ((ret = async_push(lp, now)) == -2)
+    {
+        /* writer post room only if it see waiting after move tail */
+        __atomic_store_n(&a->waiting, 1, __ATOMIC_SEQ_CST);
+        unsigned tail = __atomic_load_n(&a->tail, __ATOMIC_SEQ_CST);
+        if (a->head - tail < ASYNC_RING_NUM)
         {
-            errno = ENOSPC;
-            return -1;
+            /* writer have cleared it, take its post */
+            if (__atomic_exchange_n(&a->waiting, 0, __ATOMIC_SEQ_CST) == 0)
+            {
+                while (sem_wait(&a->room) < 0 && errno == EINTR)
+                    ;
+            }
+            continue;
         }
-        count -= written;
-        p += written;
-        total += written;
+
+        while (sem_wait(&a->room) < 0 && errno == EINTR)
+            ;
+    }
+
+    return ret;
+}
+
+/* make room for a line of len, return 0 if ok */
+static int async_reserve(dlog_t *lp, size_t len, struct timeval *now)
+{
+    size_t need = lp->w_len + len + 2;
+    if (need <= lp->buf_len)
+        return 0;
+
+    struct dlog_async *a = lp->async;
+    if (need > ASYNC_BUFFER_MAX && a->no_drop && lp->w_len)
+    {
+        if (async_push_wait(lp, now) < 0)
+            return -1;
+
+        need = lp->w_len + len + 2;
+        if (need <= lp->buf_len)
+            return 0;
+    }
+
+    if (need > ASYNC_BUFFER_MAX && !a->no_drop)
+    {
+        ++a->drop;
+
+        return -1;
+    }
+
+    size_t n = lp->buf_len;
+    while (n < need)
+        n *= 2;
+    char *buf = realloc(lp->buf, n);
+    if (buf == NULL)
+    {
+        /* a new buffer after writer take this one */
+        if (a->no_drop && lp->w_len && async_push_wait(lp, now) == 0)
+            return async_reserve(lp, len, now);
+
+        ++a->drop;
+
+        return -1;
+    }
+    lp->buf = buf;
+    lp->buf_len = n;
+
+    return 0;
+}
+
+static void async_fini(dlog_t *lp, struct timeval *now)
+{
+    struct dlog_async *a = lp->async;
+
+    if (a->pid == getpid())
+    {
+        if (lp->w_len)
+            async_push(lp, now);
+
+        __atomic_store_n(&a->stop, 1, __ATOMIC_RELEASE);
+        sem_post(&a->wake);
+        pthread_join(a->writer, NULL);
+        sem_destroy(&a->wake);
+        sem_destroy(&a->room);
     }
 
-    return total;
+    /* ring entries inherited from parent belong to its writer */
+    if (a->pid != getpid())
+        a->tail = a->head;
+
+    /* ring was full when push */
+    while (a->tail != a->head)
+    {
+        struct dlog_chunk *c = &a->ring[a->tail % ASYNC_RING_NUM];
+        async_write(lp, c);
+        free(c->buf);
+        ++a->tail;
+    }
+
+    if (lp->w_len)
+    {
+        struct dlog_chunk c = { lp->buf, lp->w_len, *now };
+        async_write(lp, &c);
+        lp->w_len = 0;
+    }
+
+    if (a->fd >= 0)
+        close(a->fd);
+    free(a->name);
+    free(a);
+    lp->async = NULL;
 }
 
 static int flush_log(dlog_t *lp, struct timeval *now)
@@ -339,6 +591,9 @@ static int flush_log(dlog_t *lp, struct timeval *now)
     if (lp->w_len == 0)
         return 0;
 
+    if (lp->async)
+        return async_push(lp, now);
+
     ssize_t n = 0;
     int ret_val = 0;
 
@@ -410,6 +665,11 @@ static void dlog_atexit(void)
 
 static void *dlog_free(dlog_t *lp)
 {
+    if (lp->async)
+    {
+        free(((struct dlog_async *)lp->async)->name);
+        free(lp->async);
+    }
     free(lp->base_name);
     free(lp->name);
     free(lp->buf);
@@ -460,6 +720,15 @@ dlog_t *dlog_init(char *base_name, int flag,
     int remote_log = flag & DLOG_REMOTE_LOG;
     flag &= ~DLOG_REMOTE_LOG;
 
+    int async = flag & DLOG_ASYNC;
+    flag &= ~DLOG_ASYNC;
+
+    int no_drop = flag & DLOG_NO_DROP;
+    flag &= ~DLOG_NO_DROP;
+
+    int raw = flag & DLOG_RAW;
+    flag &= ~DLOG_RAW;
+
     dlog_t *lp = calloc(1, sizeof(dlog_t));
     if (lp == NULL)
         return NULL;
@@ -491,11 +760,28 @@ dlog_t *dlog_init(char *base_name, int flag,
     lp->shift_type = flag;
     lp->use_fork   = use_fork;
     lp->no_cache   = no_cache;
+    lp->raw        = raw;
     lp->max_size   = max_size;
     lp->log_num    = log_num;
     lp->keep_time  = keep_time;
     lp->remote_log = remote_log;
 
+    /* writer do shift and unlink, no need to fork */
+    if (async && !remote_log)
+    {
+        struct dlog_async *a = calloc(1, sizeof(struct dlog_async));
+        if (a == NULL || (a->name = malloc(strlen(base_name) + 30)) == NULL)
+        {
+            free(a);
+
+            return dlog_free(lp);
+        }
+        a->fd = -1;
+        a->no_drop = no_drop;
+        lp->async = a;
+        lp->use_fork = 0;
+    }
+
     struct timeval now;
     gettimeofday(&now, NULL);
     lp->last_write = now;
@@ -540,26 +826,17 @@ static inline void _dlog_check(dlog_t *lp, struct timeval *now)
     }
 }
 
-void dlog_check(dlog_t *lp, struct timeval *tv)
+/* dlog may be called by other threads, buf is only touched with lock */
+static void dlog_check_one(dlog_t *lp, struct timeval *now)
 {
-    if (lp)
-    {
-        if (lp->w_len == 0)
-            return;
-    }
-    else
-    {
-        lp = lp_list_head;
-        while (lp)
-        {
-            if (lp->w_len)
-                break;
-            lp = (dlog_t *)lp->next;
-        }
-        if (lp == NULL)
-            return;
-    }
+    pthread_mutex_lock(&lp->lock);
+    if (lp->w_len)
+        _dlog_check(lp, now);
+    pthread_mutex_unlock(&lp->lock);
+}
 
+void dlog_check(dlog_t *lp, struct timeval *tv)
+{
     struct timeval now;
 
     if (tv == NULL)
@@ -570,32 +847,19 @@ void dlog_check(dlog_t *lp, struct timeval *tv)
 
     if (lp)
     {
-        _dlog_check(lp, tv);
+        dlog_check_one(lp, tv);
     }
     else
     {
         lp = lp_list_head;
         while (lp)
         {
-            if (lp->w_len)
-                _dlog_check(lp, tv);
+            dlog_check_one(lp, tv);
             lp = (dlog_t *)lp->next;
         }
     }
 }
 
-static char *timeval_str(struct timeval *tv)
-{
-    static char str[64];
-
-    struct tm *t = localtime(&tv->tv_sec);
-    snprintf(str, sizeof(str), "%04d-%02d-%02d %02d:%02d:%02d.%.6d",
-            t->tm_year + 1900, t->tm_mon + 1, t->tm_mday, t->tm_hour,
-            t->tm_min, t->tm_sec, (int)tv->tv_usec);
-
-    return str;
-}
-
 static int _dlog(dlog_t *lp, const char *fmt, va_list ap) 
 {
     if (!lp || !fmt)
@@ -603,11 +867,22 @@ static int _dlog(dlog_t *lp, const char *fmt, va_list ap)
 
     struct timeval now;
     gettimeofday(&now, NULL);
-    char *timestamp = timeval_str(&now);
+    char *timestamp = get_timeval_str(&now);
 
     ssize_t n  = 0;
     ssize_t ret;
 
+    va_list cap;
+    if (lp->async)
+    {
+        /* format in buffer always, grow it if need */
+        va_copy(cap, ap);
+        ret = vsnprintf(NULL, 0, fmt, cap);
+        va_end(cap);
+        if (ret < 0 || async_reserve(lp, strlen(timestamp) + 3 + ret, &now) < 0)
+            return -1;
+    }
+
     char *p = lp->buf + lp->w_len;
     size_t len = lp->buf_len - lp->w_len;
 
@@ -619,9 +894,9 @@ static int _dlog(dlog_t *lp, const char *fmt, va_list ap)
     len -= ret;
     n += ret;
 
-    va_list cap;
     va_copy(cap, ap);
     ret = vsnprintf(p, len, fmt, cap);
+    va_end(cap);
 
     if (ret < 0)
     {
@@ -680,6 +955,57 @@ int dlog(dlog_t *lp, const char *fmt, ...)
     return ret;
 }
 
+int dlog_write(dlog_t *lp, void const *data, size_t len)
+{
+    if (!lp || !lp->raw || lp->remote_log)
+        return -1;
+
+    pthread_mutex_lock(&lp->lock);
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    int ret = 0;
+    if (lp->async)
+    {
+        ret = async_reserve(lp, len, &now);
+    }
+    else if (lp->w_len + len > lp->buf_len)
+    {
+        flush_log(lp, &now);
+
+        /* keep it in one write */
+        if (len > lp->buf_len)
+        {
+            char *buf = realloc(lp->buf, len);
+            if (buf == NULL)
+            {
+                ret = -1;
+            }
+            else
+            {
+                lp->buf = buf;
+                lp->buf_len = len;
+            }
+        }
+    }
+
+    if (ret == 0)
+    {
+        memcpy(lp->buf + lp->w_len, data, len);
+        lp->w_len += len;
+
+        if (lp->no_cache)
+            flush_log(lp, &now);
+        else
+            _dlog_check(lp, &now);
+    }
+
+    pthread_mutex_unlock(&lp->lock);
+
+    return ret;
+}
+
 # ifdef DLOG_SERVER
 int dlog_server(dlog_t *lp, char *buf, size_t size, struct sockaddr_in *addr)
 {
@@ -753,7 +1079,10 @@ int dlog_fini(dlog_t *lp)
     struct timeval now;
     gettimeofday(&now, NULL);
 
-    flush_log(lp, &now);
+    if (lp->async)
+        async_fini(lp, &now);
+    else
+        flush_log(lp, &now);
 
     dlog_free(lp);
 # ifdef DEBUG
@@ -763,19 +1092,6 @@ int dlog_fini(dlog_t *lp)
     return 0;
 }
 
-static char *strtolower(char *str)
-{
-    char *s = str;
-    while (*s)
-    {
-        if (*s >= 'A' && *s <= 'Z')
-            *s += ('a' - 'A');
-        ++s;
-    }
-
-    return str;
-}
-
 int dlog_read_flag(char *str)
 {
     if (str == NULL)
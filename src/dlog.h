@@ -34,6 +34,7 @@ typedef struct
     time_t              last_shift;
     int                 use_fork;
     int                 no_cache;
+    int                 raw;
     size_t              max_size;
     int                 log_num;
     int                 keep_time;
@@ -42,6 +43,7 @@ typedef struct
     int                 sockfd;
     struct sockaddr_in  addr;
     pthread_mutex_t     lock;
+    void                *async;
     void                *next;
 } dlog_t;
 
@@ -63,6 +65,27 @@ typedef struct
  */
 # define DLOG_REMOTE_LOG 0x40000
 
+/*
+ * use DLOG_ASYNC with flag, full buffers are handed to a writer thread,
+ * which keep the log file open, and do shift and remove expire log files.
+ * dlog never block on file I/O. the thread is created in the process
+ * which first flush, so it is fine to init before fork.
+ */
+# define DLOG_ASYNC 0x80000
+
+/*
+ * use DLOG_NO_DROP with DLOG_ASYNC, when the buffer reach its max, dlog
+ * wait the writer take it instead of drop lines, only the caller of this
+ * log wait.
+ */
+# define DLOG_NO_DROP 0x100000
+
+/*
+ * use DLOG_RAW with flag, dlog_write append data as it is, without time
+ * or newline, log files end with .bin instead of .log.
+ */
+# define DLOG_RAW 0x200000
+
 /*
  * example:
  * dlog_init("test", DLOG_SHIFT_BY_DAY | DLOG_USE_FORK, 1000 * 1000 * 1000, 0, 30);
@@ -76,6 +99,9 @@ dlog_t *dlog_init(char *base_name, int flag,
 
 int dlog(dlog_t *lp, const char *fmt, ...) __attribute__ ((format(printf, 2, 3)));
 
+/* append data to a DLOG_RAW log, it is written to file in one piece */
+int dlog_write(dlog_t *lp, void const *data, size_t len);
+
 /* call dlog_check in main loop, will help write log to file as soon as possible */
 void dlog_check(dlog_t *lp, struct timeval *tv);
 
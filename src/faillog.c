@@ -0,0 +1,413 @@
+/*
+ * Description: binary fail log
+ *
+ * A file is a sequence of records, integers in little endian:
+ *
+ *     "LDBF" u32 body_len
+ *     u64 time_ms u16 reason_len reason u8 kind
+ *     FAILLOG_ROWS: u16 table_len table u32 row_num u16 column_num values
+ *     FAILLOG_SQL:  u32 sql_len sql
+ *
+ * Every value is a u8 tag and:
+ *     FAILLOG_NULL:            nothing
+ *     FAILLOG_UINT, NINT:      varint of the value, or of -value
+ *     FAILLOG_INT, FLOAT:      varint length + decimal text
+ *     FAILLOG_TEXT, BLOB:      varint length + bytes
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <inttypes.h>
+# include <sys/time.h>
+
+# include "conf.h"
+# include "utils.h"
+# include "faillog.h"
+
+enum
+{
+    FAILLOG_ROWS = 1,
+    FAILLOG_SQL,
+};
+
+enum
+{
+    FAILLOG_NULL,
+    FAILLOG_UINT,
+    FAILLOG_NINT,
+    FAILLOG_INT,    /* integer not fit in 64 bits */
+    FAILLOG_FLOAT,
+    FAILLOG_TEXT,
+    FAILLOG_BLOB,
+};
+
+# define FAILLOG_HEAD_LEN 8
+
+struct faillog_buf
+{
+    char                *data;
+    size_t              len;
+    size_t              use;
+};
+
+static int buf_put(struct faillog_buf *b, void const *p, size_t n)
+{
+    if (auto_realloc((void **)&b->data, &b->len, b->use + n) == NULL)
+        return -__LINE__;
+    memcpy(b->data + b->use, p, n);
+    b->use += n;
+
+    return 0;
+}
+
+static int buf_put_u64(struct faillog_buf *b, uint64_t v, size_t n)
+{
+    uint8_t bytes[8];
+    size_t i;
+    for (i = 0; i < n; ++i)
+        bytes[i] = (uint8_t)(v >> (i * 8));
+
+    return buf_put(b, bytes, n);
+}
+
+static int buf_put_varint(struct faillog_buf *b, uint64_t v)
+{
+    uint8_t bytes[10];
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        bytes[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    bytes[n++] = (uint8_t)v;
+
+    return buf_put(b, bytes, n);
+}
+
+static int buf_put_str(struct faillog_buf *b, uint8_t tag, char const *s, size_t n)
+{
+    NEG_RET_LN(buf_put(b, &tag, 1));
+    NEG_RET_LN(buf_put_varint(b, n));
+
+    return buf_put(b, s, n);
+}
+
+/* decimal integer without sign, leading zero, or overflow */
+static int parse_uint(char const *s, size_t n, uint64_t *v)
+{
+    if (n == 0 || n > 20 || (n > 1 && s[0] == '0'))
+        return -__LINE__;
+
+    uint64_t r = 0;
+    size_t i;
+    for (i = 0; i < n; ++i)
+    {
+        if (s[i] < '0' || s[i] > '9')
+            return -__LINE__;
+        uint64_t d = s[i] - '0';
+        if (r > (UINT64_MAX - d) / 10)
+            return -__LINE__;
+        r = r * 10 + d;
+    }
+    *v = r;
+
+    return 0;
+}
+
+static int put_value(struct faillog_buf *b, struct sink_value const *v)
+{
+    uint8_t tag;
+    uint64_t u;
+
+    switch (v->type)
+    {
+    case SINK_VALUE_NULL:
+        tag = FAILLOG_NULL;
+
+        return buf_put(b, &tag, 1);
+    case SINK_VALUE_INT:
+        if (v->len && v->str[0] == '-' && parse_uint(v->str + 1, v->len - 1, &u) == 0 && u)
+            tag = FAILLOG_NINT;
+        else if (parse_uint(v->str, v->len, &u) == 0)
+            tag = FAILLOG_UINT;
+        else
+            return buf_put_str(b, FAILLOG_INT, v->str, v->len);
+
+        NEG_RET_LN(buf_put(b, &tag, 1));
+
+        return buf_put_varint(b, u);
+    case SINK_VALUE_FLOAT:
+        return buf_put_str(b, FAILLOG_FLOAT, v->str, v->len);
+    case SINK_VALUE_TEXT:
+        return buf_put_str(b, FAILLOG_TEXT, v->str, v->len);
+    case SINK_VALUE_BLOB:
+        return buf_put_str(b, FAILLOG_BLOB, v->str, v->len);
+    }
+
+    return -__LINE__;
+}
+
+static int encode(struct faillog_buf *b, char const *reason, char const *sql, size_t len, int parse)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    size_t reason_len = strlen(reason);
+    if (reason_len > UINT16_MAX)
+        reason_len = UINT16_MAX;
+
+    b->use = 0;
+    NEG_RET_LN(buf_put(b, FAILLOG_MAGIC, 4));
+    NEG_RET_LN(buf_put_u64(b, 0, 4));
+    NEG_RET_LN(buf_put_u64(b, now.tv_sec * 1000ull + now.tv_usec / 1000, 8));
+    NEG_RET_LN(buf_put_u64(b, reason_len, 2));
+    NEG_RET_LN(buf_put(b, reason, reason_len));
+
+    struct sink_rows rows;
+    size_t table_len = 0;
+    if (parse && sink_parse_insert(sql, len, &rows) == 0)
+        table_len = strlen(rows.table);
+
+    uint8_t kind;
+    if (table_len && table_len <= UINT16_MAX && rows.row_num && rows.row_num <= UINT32_MAX)
+    {
+        kind = FAILLOG_ROWS;
+        NEG_RET_LN(buf_put(b, &kind, 1));
+        NEG_RET_LN(buf_put_u64(b, table_len, 2));
+        NEG_RET_LN(buf_put(b, rows.table, table_len));
+        NEG_RET_LN(buf_put_u64(b, rows.row_num, 4));
+        NEG_RET_LN(buf_put_u64(b, rows.column_num, 2));
+
+        size_t i, n = rows.row_num * rows.column_num;
+        for (i = 0; i < n; ++i)
+            NEG_RET_LN(put_value(b, &rows.values[i]));
+    }
+    else
+    {
+        while (len && sql[len - 1] == '\0')
+            --len;
+
+        kind = FAILLOG_SQL;
+        NEG_RET_LN(buf_put(b, &kind, 1));
+        NEG_RET_LN(buf_put_u64(b, len, 4));
+        NEG_RET_LN(buf_put(b, sql, len));
+    }
+
+    size_t body_len = b->use - FAILLOG_HEAD_LEN;
+    if (body_len > UINT32_MAX)
+        return -__LINE__;
+    int i;
+    for (i = 0; i < 4; ++i)
+        b->data[4 + i] = (char)(body_len >> (i * 8));
+
+    return 0;
+}
+
+faillog_t *faillog_init(char const *base_name, int flag)
+{
+    faillog_t *fp = calloc(1, sizeof(faillog_t));
+    if (fp == NULL)
+        return NULL;
+
+    /* never split a day, replay take a file of a day */
+    fp->log = dlog_init((char *)base_name, DLOG_SHIFT_BY_DAY | DLOG_RAW | flag, 0, 0, 0);
+    if (fp->log == NULL)
+    {
+        free(fp);
+
+        return NULL;
+    }
+
+    return fp;
+}
+
+static int write_record(faillog_t *fp, char const *reason, char const *sql, size_t len, int parse)
+{
+    static struct faillog_buf buf;
+
+    NEG_RET_LN(encode(&buf, reason ? reason : "", sql, len, parse));
+
+    /* a record is written in one piece with O_APPEND, records of
+     * processes are not mixed */
+    NEG_RET_LN(dlog_write(fp->log, buf.data, buf.use));
+
+    return 0;
+}
+
+int faillog_write(faillog_t *fp, char const *reason, char const *sql, size_t len)
+{
+    return write_record(fp, reason, sql, len, 1);
+}
+
+int faillog_write_sql(faillog_t *fp, char const *reason, char const *sql, size_t len)
+{
+    return write_record(fp, reason, sql, len, 0);
+}
+
+int faillog_is_binary(void const *data, size_t size)
+{
+    return size >= FAILLOG_HEAD_LEN && memcmp(data, FAILLOG_MAGIC, 4) == 0;
+}
+
+static uint64_t get_u64(uint8_t const *p, size_t n)
+{
+    uint64_t v = 0;
+    size_t i;
+    for (i = 0; i < n; ++i)
+        v |= (uint64_t)p[i] << (i * 8);
+
+    return v;
+}
+
+# define NEED(n) do { if ((size_t)(end - p) < (size_t)(n)) return -__LINE__; } while (0)
+
+static int get_varint(uint8_t const **pp, uint8_t const *end, uint64_t *v)
+{
+    uint8_t const *p = *pp;
+    uint64_t r = 0;
+    int shift;
+    for (shift = 0; shift < 64; shift += 7)
+    {
+        NEED(1);
+        uint8_t c = *p++;
+        r |= (uint64_t)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0)
+        {
+            *pp = p;
+            *v = r;
+
+            return 0;
+        }
+    }
+
+    return -__LINE__;
+}
+
+ssize_t faillog_decode(void const *data, size_t size, struct faillog_record *rec)
+{
+    static char *table;
+    static size_t table_len;
+
+    static char *scratch;
+    static size_t scratch_len;
+
+    static struct sink_value *values;
+    static size_t values_len;
+
+    if (!faillog_is_binary(data, size))
+        return -__LINE__;
+
+    uint8_t const *p = data;
+    uint64_t body_len = get_u64(p + 4, 4);
+    if (size - FAILLOG_HEAD_LEN < body_len)
+        return -__LINE__;
+    p += FAILLOG_HEAD_LEN;
+    uint8_t const *end = p + body_len;
+
+    memset(rec, 0, sizeof(*rec));
+
+    NEED(10);
+    rec->time_ms = get_u64(p, 8);
+    rec->reason_len = get_u64(p + 8, 2);
+    p += 10;
+    NEED(rec->reason_len + 1);
+    rec->reason = (char const *)p;
+    p += rec->reason_len;
+
+    uint8_t kind = *p++;
+    if (kind == FAILLOG_SQL)
+    {
+        NEED(4);
+        rec->sql_len = get_u64(p, 4);
+        p += 4;
+        NEED(rec->sql_len);
+        rec->sql = (char const *)p;
+
+        return FAILLOG_HEAD_LEN + body_len;
+    }
+
+    if (kind != FAILLOG_ROWS)
+        return -__LINE__;
+
+    NEED(2);
+    size_t n = get_u64(p, 2);
+    p += 2;
+    NEED(n + 6);
+    if (auto_realloc((void **)&table, &table_len, n + 1) == NULL)
+        return -__LINE__;
+    memcpy(table, p, n);
+    table[n] = '\0';
+    p += n;
+
+    rec->rows.table = table;
+    rec->rows.row_num = get_u64(p, 4);
+    rec->rows.column_num = (int)get_u64(p + 4, 2);
+    p += 6;
+
+    /* every value take a byte at least, decimal text of a varint take 21 */
+    size_t value_num = rec->rows.row_num * rec->rows.column_num;
+    if (rec->rows.column_num == 0 || value_num > (size_t)(end - p))
+        return -__LINE__;
+    if (value_num > values_len)
+    {
+        struct sink_value *new_values = realloc(values, value_num * sizeof(*values));
+        if (new_values == NULL)
+            return -__LINE__;
+        values = new_values;
+        values_len = value_num;
+    }
+    if (auto_realloc((void **)&scratch, &scratch_len, value_num * 21) == NULL)
+        return -__LINE__;
+    char *s = scratch;
+
+    size_t i;
+    for (i = 0; i < value_num; ++i)
+    {
+        struct sink_value *v = &values[i];
+        uint64_t u;
+
+        NEED(1);
+        uint8_t tag = *p++;
+        switch (tag)
+        {
+        case FAILLOG_NULL:
+            v->type = SINK_VALUE_NULL;
+            v->str  = NULL;
+            v->len  = 0;
+            continue;
+        case FAILLOG_UINT:
+        case FAILLOG_NINT:
+            NEG_RET_LN(get_varint(&p, end, &u));
+            v->type = SINK_VALUE_INT;
+            v->str  = s;
+            v->len  = sprintf(s, "%s%"PRIu64, tag == FAILLOG_NINT ? "-" : "", u);
+            s += v->len;
+            continue;
+        case FAILLOG_INT:
+            v->type = SINK_VALUE_INT;
+            break;
+        case FAILLOG_FLOAT:
+            v->type = SINK_VALUE_FLOAT;
+            break;
+        case FAILLOG_TEXT:
+            v->type = SINK_VALUE_TEXT;
+            break;
+        case FAILLOG_BLOB:
+            v->type = SINK_VALUE_BLOB;
+            break;
+        default:
+            return -__LINE__;
+        }
+
+        NEG_RET_LN(get_varint(&p, end, &u));
+        NEED(u);
+        v->str = (char const *)p;
+        v->len = u;
+        p += u;
+    }
+
+    rec->rows.values = values;
+
+    return FAILLOG_HEAD_LEN + body_len;
+}
@@ -0,0 +1,53 @@
+/*
+ * Description: binary fail log, batches fail to enqueue or insert are
+ *              saved as decoded rows, replay them without parse sql
+ */
+
+# pragma once
+
+# include <stddef.h>
+# include <stdint.h>
+# include <sys/types.h>
+
+# include "sink.h"
+# include "dlog.h"
+
+# define FAILLOG_MAGIC "LDBF"
+
+typedef struct
+{
+    dlog_t              *log;
+} faillog_t;
+
+struct faillog_record
+{
+    uint64_t            time_ms;
+    char const          *reason;
+    size_t              reason_len;
+
+    /* rows of an INSERT statement, or sql if row_num is 0 */
+    struct sink_rows    rows;
+    char const          *sql;
+    size_t              sql_len;
+};
+
+/*
+ * log file is <base_name>_YYYYmmdd.bin, shift by day, written by dlog,
+ * flag is 0 or DLOG_ASYNC | DLOG_NO_DROP
+ */
+faillog_t *faillog_init(char const *base_name, int flag);
+
+/* save a statement, INSERT statement is saved as rows */
+int faillog_write(faillog_t *fp, char const *reason, char const *sql, size_t len);
+
+/* save a statement as it is, without parse, rows are decoded on replay */
+int faillog_write_sql(faillog_t *fp, char const *reason, char const *sql, size_t len);
+
+/* true if data begin with a record */
+int faillog_is_binary(void const *data, size_t size);
+
+/*
+ * decode a record at data, values are valid until next call.
+ * return length of the record, negative if bad format
+ */
+ssize_t faillog_decode(void const *data, size_t size, struct faillog_record *rec);
@@ -16,11 +16,14 @@
 # include <errno.h>
 # include <signal.h>
 # include <inttypes.h>
+# include <pthread.h>
 # include <arpa/inet.h>
 
 # include "utils.h"
 # include "ini.h"
 # include "timer.h"
+# include "route.h"
+# include "cache.h"
 # include "net.h"
 # include "queue.h"
 # include "dlog.h"
@@ -42,16 +45,39 @@ struct settings
     uint64_t            queue_bin_file_max_size;
     queue_t             no_reply_cache_queue;
 
+    /* pkg from receive thread to forward and ack thread */
+    queue_t             forward_queue;
+    queue_t             ack_queue;
+
     bool                is_return_pkg;
 
-    struct sockaddr_in  receiver_addr;
+    /* memory of pkg wait for reply */
+    uint64_t            inflight_mem_max_size;
+
+    /* ip:port [time out], ..., default is local ip and listen port + 1 */
+    char                *receivers;
+    char                *receiver_route;
+    /* in ms, resend pkg not replied by receiver after it */
+    uint32_t            receiver_time_out;
+
+    /* max pkg resend per second, lower when ack latency is above target */
+    uint32_t            replay_rate;
+    uint32_t            replay_ack_latency;
 };
 
 struct settings settings;
 
-int  shut_down_flag;
+volatile int shut_down_flag;
 char config_file_path[PATH_MAX];
-int  receive_reply_flag;
+
+/* replay cache is written by all threads */
+pthread_mutex_t cache_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* replies dropped as ack queue is full */
+int drop_num;
+
+/* wait time of forward and ack thread, the same as timer tick */
+# define TIMER_CHECK_INTERVAL_MS 5
 
 # define PACKAGE_STRING "loginf"
 # define VERSION_STRING "1.3"
@@ -148,17 +174,44 @@ static int read_settings(void)
     if (ini_read_bool(conf, "", "return pkg", &settings.is_return_pkg, false) < 0)
         return -__LINE__;
 
+    if (ini_read_str(conf, "", "receivers", &settings.receivers, NULL) < 0)
+        return -__LINE__;
+
+    if (ini_read_str(conf, "", "receiver route", &settings.receiver_route, "ip") < 0)
+        return -__LINE__;
+
+    if (ini_read_uint32(conf, "", "receiver reply time out", \
+                &settings.receiver_time_out, 5000) < 0)
+        return -__LINE__;
+
+    if (ini_read_uint64(conf, "", "inflight memory max size", \
+                &settings.inflight_mem_max_size, 512 * 1024 * 1024ull) < 0)
+        return -__LINE__;
+
+    if (ini_read_uint32(conf, "", "replay rate", &settings.replay_rate, 1000) < 0)
+        return -__LINE__;
+
+    if (ini_read_uint32(conf, "", "replay ack latency", \
+                &settings.replay_ack_latency, 200) < 0)
+        return -__LINE__;
+
     ini_free(conf);
 
-    bzero(&settings.receiver_addr, sizeof(settings.receiver_addr));
-    settings.receiver_addr.sin_family = AF_INET;
-    settings.receiver_addr.sin_port = htons(settings.listen_port + 1);
+    char receiver[64];
+    char *receivers = settings.receivers;
+    if (receivers == NULL)
+    {
+        snprintf(receiver, sizeof(receiver), "%s:%u", settings.local_ip ? \
+                settings.local_ip : "127.0.0.1", settings.listen_port + 1);
+        receivers = receiver;
+    }
+
+    if (route_init(receivers, settings.receiver_route, settings.receiver_time_out) < 0)
+    {
+        fprintf(stderr, "invalid 'receivers' or 'receiver route'\n");
 
-    const char *receiver_ip = settings.local_ip;
-    if (receiver_ip == NULL)
-        receiver_ip = "127.0.0.1";
-    if (inet_aton(receiver_ip, &settings.receiver_addr.sin_addr) == 0)
         return -__LINE__;
+    }
 
     return 0;
 }
@@ -185,6 +238,11 @@ static int init_queue(void)
     if (ret < 0)
         return -__LINE__;
 
+    NEG_RET_LN(queue_init(&settings.forward_queue, NULL, 0, \
+                settings.queue_mem_cache_size, NULL, 0));
+    NEG_RET_LN(queue_init(&settings.ack_queue, NULL, 0, \
+                settings.queue_mem_cache_size, NULL, 0));
+
     return 0;
 }
 
@@ -199,20 +257,35 @@ static void handle_signal(int signo)
     }
 }
 
-static void handle_time_out(uint32_t sequence, size_t size, void *data)
+static uint64_t get_now_us(void)
 {
-    log_warn("time out, seq: %u", sequence);
+    struct timeval now;
+    gettimeofday(&now, NULL);
 
-    int ret = queue_push(&settings.no_reply_cache_queue, data, (uint32_t)size);
-    if (ret < 0)
+    return now.tv_sec * 1000000ull + now.tv_usec;
+}
+
+/* retry after in ms at the end of reply body, 0 if not exist */
+static uint16_t get_retry_after(struct protocol_head *head, void *p, int left)
+{
+    if (head->command == COMMAND_LOG_BATCH)
     {
-        log_error("queue_push fail: %d\n", ret);
+        uint16_t num = 0;
+        if (get_uint16(&p, &left, &num) < 0 || left < BATCH_BITMAP_LEN(num))
+            return 0;
+
+        p = (char *)p + BATCH_BITMAP_LEN(num);
+        left -= BATCH_BITMAP_LEN(num);
     }
 
-    receive_reply_flag = false;
+    uint16_t retry_after = 0;
+    if (left >= (int)sizeof(retry_after))
+        get_uint16(&p, &left, &retry_after);
+
+    return retry_after;
 }
 
-static int send_to_receiver(struct sockaddr_in *client_addr, \
+static int send_to_receiver(struct receiver *r, struct sockaddr_in *client_addr, \
         uint8_t command, uint32_t sequence, void *body, int body_len)
 {
     struct protocol_head head;
@@ -233,12 +306,13 @@ static int send_to_receiver(struct sockaddr_in *client_addr, \
     NEG_RET_LN(add_head(&head, &p, &left));
     NEG_RET_LN(add_bin(&p, &left, body, body_len));
 
-    NEG_RET_LN(send_udp_pkg(buf, sizeof(buf) - left, &settings.receiver_addr));
+    NEG_RET_LN(send_udp_pkg(buf, sizeof(buf) - left, &r->addr));
 
     return 0;
 }
 
-static int return_to_sender(uint16_t result, void *data, size_t data_len)
+static int return_to_sender(uint16_t result, void *data, size_t data_len, \
+        void *body, int body_len)
 {
     if (settings.is_return_pkg == false)
         return 0;
@@ -258,14 +332,141 @@ static int return_to_sender(uint16_t result, void *data, size_t data_len)
     p = buf;
     left = sizeof(buf);
     NEG_RET_LN(add_head(&head, &p, &left));
+    if (body_len > 0)
+        NEG_RET_LN(add_bin(&p, &left, body, body_len));
 
     NEG_RET_LN(send_udp_pkg(buf, sizeof(buf) - left, addr));
 
     return 0;
 }
 
-static int handle_udp(struct sockaddr_in *client_addr, void *pkg, int len)
+/*
+ * data is client addr and pkg. sin_zero of client addr keep the sequence
+ * in cache, resend later with the same sequence. it keep the index of the
+ * receiver pkg is sent to while waiting for reply.
+ */
+static int push_to_cache(uint32_t sequence, size_t size, void *data)
+{
+    struct sockaddr_in *addr = data;
+    memcpy(addr->sin_zero, &sequence, sizeof(sequence));
+
+    pthread_mutex_lock(&cache_queue_lock);
+    int ret = queue_push(&settings.no_reply_cache_queue, data, (uint32_t)size);
+    pthread_mutex_unlock(&cache_queue_lock);
+
+    return ret;
+}
+
+/* pop a pkg to resend, data is valid until next pop */
+static int pop_from_cache(void **data, uint32_t *size, uint32_t *sequence)
 {
+    pthread_mutex_lock(&cache_queue_lock);
+    int ret = queue_pop(&settings.no_reply_cache_queue, data, size);
+    pthread_mutex_unlock(&cache_queue_lock);
+
+    if (ret < 0)
+        return ret;
+    if (*size < sizeof(struct sockaddr_in))
+        return -__LINE__;
+
+    struct sockaddr_in *addr = *data;
+    memcpy(sequence, addr->sin_zero, sizeof(*sequence));
+    /* keep receiver index, resend to the same receiver */
+    memset(addr->sin_zero, 0, sizeof(*sequence));
+
+    return 0;
+}
+
+/*
+ * replay rate follow ack latency, it is set by ack thread and used by
+ * forward thread. add 1/20 of max every 100ms when latency is below the
+ * target, and halve it when latency is above or pkg time out.
+ */
+static uint32_t replay_rate;
+static uint32_t ack_latency;
+static int      time_out_num;
+
+static void adapt_replay_rate(struct timeval *now)
+{
+    static struct timeval last_adapt;
+    if (timeval_diff(&last_adapt, now) < 100 * 1000)
+        return;
+    last_adapt = *now;
+
+    uint32_t max_rate = settings.replay_rate;
+    uint32_t min_rate = max_rate / 100 ? max_rate / 100 : 1;
+    uint32_t rate = __atomic_load_n(&replay_rate, __ATOMIC_RELAXED);
+
+    if (time_out_num || ack_latency > settings.replay_ack_latency)
+    {
+        rate /= 2;
+        if (rate < min_rate)
+            rate = min_rate;
+    }
+    else
+    {
+        rate += max_rate / 20 ? max_rate / 20 : 1;
+        if (rate > max_rate)
+            rate = max_rate;
+    }
+
+    __atomic_store_n(&replay_rate, rate, __ATOMIC_RELAXED);
+
+    time_out_num = 0;
+}
+
+static int get_receiver_index(void *data)
+{
+    int32_t index;
+    memcpy(&index, ((struct sockaddr_in *)data)->sin_zero + sizeof(uint32_t), sizeof(index));
+
+    return index;
+}
+
+static void set_receiver_index(void *data, int32_t index)
+{
+    memcpy(((struct sockaddr_in *)data)->sin_zero + sizeof(uint32_t), &index, sizeof(index));
+}
+
+static void handle_time_out(uint32_t sequence, size_t size, void *data)
+{
+    struct receiver *r = route_get(get_receiver_index(data));
+    log_warn("time out, seq: %u, receiver: %s", sequence, r ? addrtostr(&r->addr) : "");
+
+    if (r)
+        route_time_out(r);
+
+    /* keep sequence in sin_zero of client addr, resend with the same sequence,
+     * so receiver can find out the duplicate pkg */
+    int ret = push_to_cache(sequence, size, data);
+    if (ret < 0)
+    {
+        log_error("queue_push fail: %d\n", ret);
+    }
+
+    ++time_out_num;
+}
+
+/* pkg without body or from receiver is a reply */
+static bool is_reply(struct sockaddr_in *client_addr, void *pkg, int len)
+{
+    struct protocol_head head;
+    void *p = pkg;
+    int left = len;
+
+    if (get_head(&head, &p, &left) < 0)
+        return false;
+
+    return left == 0 || route_find(client_addr) != NULL;
+}
+
+/* in ack thread, data is client addr and pkg */
+static int handle_reply(void *data, int size)
+{
+    struct sockaddr_in *client_addr = data;
+    void *pkg = (char *)data + sizeof(*client_addr);
+    int len = size - sizeof(*client_addr);
+
     int ret;
     void *p = pkg;
     int left = len;
@@ -273,148 +474,336 @@ static int handle_udp(struct sockaddr_in *client_addr, void *pkg, int len)
 
     NEG_RET_LN(get_head(&head, &p, &left));
 
-    if (left == 0) /* logdb receiver return */
+    /* logdb receiver return, batch reply has a result bitmap body */
+    struct receiver *r = route_find(client_addr);
+    uint16_t retry_after = get_retry_after(&head, p, left);
+    if (retry_after && r)
     {
-        receive_reply_flag = true;
-
-        if (settings.is_return_pkg == true)
-        {
-            void *data = NULL;
-            size_t data_len = 0;
+        route_busy(r, retry_after);
+    }
 
-            ret = timer_get(head.sequence, &data_len, &data);
-            if (ret < 0)
-            {
-                log_error("get timer fail: %d", ret);
+    /* rejected by receiver, resend after busy */
+    if (head.result == RESULT_BUSY && head.sequence)
+    {
+        void *timer_data = NULL;
+        size_t data_len = 0;
 
-                return -__LINE__;
-            }
+        ret = timer_get(head.sequence, &data_len, &timer_data);
+        if (ret < 0)
+            return 0;
 
-            ret = return_to_sender(head.result, data, data_len);
-            if (ret < 0)
-            {
-                log_error("return to sender fail: %d", ret);
-                timer_del(head.sequence);
+        /* del timer before push, forward thread may pop and add it again */
+        void *copy = malloc(data_len);
+        if (copy == NULL)
+        {
+            log_error("malloc fail, seq: %u resend after time out", head.sequence);
 
-                return -__LINE__;
-            }
+            return -__LINE__;
         }
+        memcpy(copy, timer_data, data_len);
 
-        if (head.sequence)
+        if (timer_del(head.sequence, NULL) == 0)
         {
-            ret = timer_del(head.sequence);
+            if (r)
+                route_replied(r);
+
+            ret = push_to_cache(head.sequence, data_len, copy);
             if (ret < 0)
             {
-                log_error("del timer fail: %d, seq: %u", ret, head.sequence);
+                log_error("queue_push fail: %d", ret);
             }
         }
+
+        free(copy);
+
+        return 0;
     }
-    else
+
+    if (settings.is_return_pkg == true)
     {
-        uint32_t sequence  = 0;
-        void *data = NULL;
+        void *timer_data = NULL;
+        size_t data_len = 0;
 
-        ret = timer_add(sizeof(*client_addr) + len, NULL, handle_time_out, &sequence, &data);
+        ret = timer_get(head.sequence, &data_len, &timer_data);
         if (ret < 0)
         {
-            log_error("add timer fail: %d", ret);
+            log_error("get timer fail: %d", ret);
+
+            return -__LINE__;
         }
-        else
+
+        ret = return_to_sender(head.result, timer_data, data_len, p, left);
+        if (ret < 0)
         {
-            memcpy(data, client_addr, sizeof(*client_addr));
-            memcpy(data + sizeof(*client_addr), pkg, len);
+            log_error("return to sender fail: %d", ret);
+            if (timer_del(head.sequence, NULL) == 0 && r)
+                route_replied(r);
+
+            return -__LINE__;
         }
+    }
 
-        ret = send_to_receiver(client_addr, head.command, sequence, p, left);
+    if (head.sequence)
+    {
+        uint32_t age = 0;
+        ret = timer_del(head.sequence, &age);
         if (ret < 0)
         {
-            log_error("send to receiver fail: %d", ret);
+            log_error("del timer fail: %d, seq: %u", ret, head.sequence);
+        }
+        else
+        {
+            uint32_t latency = ack_latency ? (ack_latency * 7 + age) / 8 : age;
+            __atomic_store_n(&ack_latency, latency, __ATOMIC_RELAXED);
+
+            if (r)
+                route_replied(r);
         }
     }
 
     return 0;
 }
 
-static int pkg_pop(struct sockaddr_in *addr, void **pkg, uint32_t *len)
+/* in forward thread, data is client addr and pkg */
+static int forward_pkg(void *data, int size, uint32_t resend_seq)
 {
-    void *buf;
-    uint32_t n;
+    struct sockaddr_in *client_addr = data;
+    void *pkg = (char *)data + sizeof(*client_addr);
+    int len = size - sizeof(*client_addr);
 
-    int ret = queue_pop(&settings.no_reply_cache_queue, &buf, &n);
-    if (ret < 0)
-        return ret;
+    int ret;
+    void *p = pkg;
+    int left = len;
+    struct protocol_head head;
+
+    NEG_RET_LN(get_head(&head, &p, &left));
+
+    /* receiver can't get it after client addr is added, never send */
+    if (left + PROTOCOL_HEAD_LEN + sizeof(struct inner_addr) > PROTOCOL_PKG_MAX_LEN)
+    {
+        log_error("pkg too large to forward: %d bytes, max: %zu, from: %s", \
+                len, PROTOCOL_CLIENT_PKG_MAX_LEN, addrtostr(client_addr));
+        return_to_sender(RESULT_PKG_FMT_ERROR, data, size, NULL, 0);
 
-    memcpy(addr, buf, sizeof(*addr));
+        return 0;
+    }
+
+    /* keep pkg in cache until a receiver is not busy or down */
+    struct receiver *r;
+    if (resend_seq)
+        r = route_pick_resend(client_addr, get_receiver_index(data));
+    else
+        r = route_pick(client_addr);
+    if (r == NULL)
+    {
+        ret = push_to_cache(resend_seq, size, data);
+        if (ret < 0)
+        {
+            log_error("queue_push fail: %d", ret);
+        }
+
+        return 0;
+    }
+
+    uint32_t sequence = resend_seq;
+
+    set_receiver_index(data, r - route_get(0));
+    ret = timer_add(size, data, handle_time_out, r->time_out, &sequence, NULL);
+    if (ret == -2)
+    {
+        /* in flight memory is full, keep it in cache until replies free some */
+        ret = push_to_cache(resend_seq, size, data);
+        if (ret < 0)
+        {
+            log_error("queue_push fail: %d", ret);
+        }
+
+        return 0;
+    }
+    else if (ret < 0)
+    {
+        log_error("add timer fail: %d", ret);
+    }
+    else
+    {
+        route_sent(r);
+    }
 
-    *pkg = buf + sizeof(*addr);
-    *len = n - sizeof(*addr);
+    ret = send_to_receiver(r, client_addr, head.command, sequence, p, left);
+    if (ret < 0)
+    {
+        log_error("send to receiver fail: %d", ret);
+    }
 
     return 0;
 }
 
-static void main_loop(void)
+/* receive stage, pass pkg to forward or ack thread */
+static void *recv_thread(void *arg)
 {
-    while (true)
+    char buf[sizeof(struct sockaddr_in) + UINT16_MAX];
+    struct sockaddr_in *client_addr = (struct sockaddr_in *)buf;
+    void *pkg = buf + sizeof(*client_addr);
+
+    while (!shut_down_flag)
     {
-        if (shut_down_flag)
+        int len = 0;
+        int ret = recv_udp_pkg(client_addr, pkg, UINT16_MAX, &len);
+        if (ret < -1)
         {
-            log_vip("interface, shut down...");
+            if (errno)
+                log_error("recv udp pkg error: %d: %m", ret);
+            else
+                log_error("recv udp pkg error: %d", ret);
+        }
 
-            exit(EXIT_SUCCESS);
+        if (ret < 0)
+            continue;
+
+        uint32_t size = sizeof(*client_addr) + len;
+
+        if (is_reply(client_addr, pkg, len))
+        {
+            /* sender will time out and resend */
+            if (queue_push(&settings.ack_queue, buf, size) < 0)
+                __atomic_add_fetch(&drop_num, 1, __ATOMIC_RELAXED);
+        }
+        else if (queue_push(&settings.forward_queue, buf, size) < 0)
+        {
+            ret = push_to_cache(0, size, buf);
+            if (ret < 0)
+            {
+                log_error("queue_push fail: %d", ret);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* ack stage, handle replies and time out */
+static void *ack_thread(void *arg)
+{
+    while (!shut_down_flag)
+    {
+        queue_wait(&settings.ack_queue, TIMER_CHECK_INTERVAL_MS);
+
+        void *data;
+        uint32_t size;
+        int ret;
+        while ((ret = queue_pop(&settings.ack_queue, &data, &size)) == 0)
+        {
+            ret = handle_reply(data, size);
+            if (ret < 0)
+            {
+                log_error("handle reply fail: %d", ret);
+            }
+        }
+
+        if (ret < -1)
+        {
+            log_fatal("ack queue pop fail: %d", ret);
         }
 
         struct timeval now;
         gettimeofday(&now, NULL);
 
-        dlog_check(NULL, &now);
         timer_check(&now);
+        adapt_replay_rate(&now);
+    }
 
-        int ret;
-        struct sockaddr_in client_addr;
-        void *qpkg = NULL;
-        uint32_t qlen = 0;
-        static uint32_t seq;
+    return NULL;
+}
+
+static void log_stat(struct timeval *now)
+{
+    static time_t last_log_min;
+    time_t curr_min = now->tv_sec / 60;
+    if (curr_min == last_log_min)
+        return;
+
+    static struct cache_stat last;
+    struct cache_stat stat;
+    cache_get_stat(&stat);
 
-        if (receive_reply_flag == true && (seq++ % 3) == 0)
+    if (last_log_min != 0)
+    {
+        log_info("interface: timer: %d, inflight mem: %zu, used: %zu, slab: %zu, " \
+                "alloc: %"PRIu64", fail: %"PRIu64, timer_num(), stat.mem_size, \
+                stat.used_size, stat.slab_num, stat.alloc_num - last.alloc_num, \
+                stat.fail_num - last.fail_num);
+        log_info("interface: replay rate: %u, ack latency: %u ms, ack drop: %d", \
+                __atomic_load_n(&replay_rate, __ATOMIC_RELAXED), \
+                __atomic_load_n(&ack_latency, __ATOMIC_RELAXED), \
+                __atomic_exchange_n(&drop_num, 0, __ATOMIC_RELAXED));
+    }
+
+    last = stat;
+    last_log_min = curr_min;
+}
+
+/* forward stage, send new pkg and replay cached pkg at replay rate */
+static void forward_loop(void)
+{
+    double tokens = 0;
+    uint64_t last_us = get_now_us();
+
+    while (!shut_down_flag)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        dlog_check(NULL, &now);
+        log_stat(&now);
+
+        queue_wait(&settings.forward_queue, TIMER_CHECK_INTERVAL_MS);
+
+        void *data;
+        uint32_t size;
+        int ret;
+        while ((ret = queue_pop(&settings.forward_queue, &data, &size)) == 0)
         {
-            ret = pkg_pop(&client_addr, &qpkg, &qlen);
-            if (ret < -1)
-            {
-                log_fatal("queue pop fail: %d", ret);
-            }
-            else if (ret >= 0)
+            ret = forward_pkg(data, size, 0);
+            if (ret < 0)
             {
-                ret = handle_udp(&client_addr, qpkg, qlen);
-                if (ret < 0)
-                {
-                    log_error("handle queue pkg fail: %d", ret);
-                }
+                log_error("handle udp pkg fail: %d", ret);
             }
         }
 
-        char pkg[UINT16_MAX];
-        int  len = 0;
-
-        ret = recv_udp_pkg(&client_addr, pkg, sizeof(pkg), &len);
         if (ret < -1)
         {
-            if (errno)
-                log_error("recv udp pkg error: %d: %m", ret);
-            else
-                log_error("recv udp pkg error: %d", ret);
+            log_fatal("forward queue pop fail: %d", ret);
         }
 
-        if (ret < 0)
-            continue;
+        /* burst of replay is 100ms */
+        uint64_t now_us = get_now_us();
+        uint32_t rate = __atomic_load_n(&replay_rate, __ATOMIC_RELAXED);
+        tokens += (double)(now_us - last_us) * rate / 1000000;
+        if (tokens > rate / 10.0 + 1)
+            tokens = rate / 10.0 + 1;
+        last_us = now_us;
 
-        ret = handle_udp(&client_addr, pkg, len);
-        if (ret < 0)
+        while (tokens >= 1 && route_is_available())
         {
-            log_error("handle udp pkg fail: %d", ret);
+            uint32_t resend_seq = 0;
+            ret = pop_from_cache(&data, &size, &resend_seq);
+            if (ret < -1)
+            {
+                log_fatal("queue pop fail: %d", ret);
+            }
+
+            if (ret < 0)
+                break;
+
+            ret = forward_pkg(data, size, resend_seq);
+            if (ret < 0)
+            {
+                log_error("handle queue pkg fail: %d", ret);
+            }
+
+            tokens -= 1;
         }
     }
-
-    return;
 }
 
 int main(int argc, char *argv[])
@@ -475,7 +864,7 @@ int main(int argc, char *argv[])
         error(EXIT_FAILURE, errno, "init queue fail: %d", ret);
     }
 
-    ret = timer_init();
+    ret = timer_init(settings.inflight_mem_max_size);
     if (ret < 0)
     {
         error(EXIT_FAILURE, errno, "init timer fail: %d", ret);
@@ -495,10 +884,24 @@ int main(int argc, char *argv[])
         error(EXIT_FAILURE, errno, "create udp socket fail: %d", ret);
     }
 
+    replay_rate = settings.replay_rate;
+
+    pthread_t recv_tid, ack_tid;
+    if (pthread_create(&recv_tid, NULL, recv_thread, NULL) != 0 || \
+            pthread_create(&ack_tid, NULL, ack_thread, NULL) != 0)
+    {
+        error(EXIT_FAILURE, errno, "create thread fail");
+    }
+
     log_vip("interface start[%d]", getpid());
     printf("%s start[%d]\n", basepath(argv[0]), getpid());
 
-    main_loop();
+    forward_loop();
+
+    pthread_join(recv_tid, NULL);
+    pthread_join(ack_tid, NULL);
+
+    log_vip("interface, shut down...");
 
     return 0;
 }
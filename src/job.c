@@ -10,7 +10,11 @@
 # include <inttypes.h>
 # include <errno.h>
 # include <math.h>
+# include <time.h>
 # include <unistd.h>
+# include <signal.h>
+# include <pthread.h>
+# include <sys/eventfd.h>
 # include <netinet/in.h>
 
 # include "serialize.h"
@@ -23,10 +27,19 @@
 # include "sql.h"
 # include "seq.h"
 # include "protocol.h"
+# include "limit.h"
+# include "sink.h"
 
 extern int shut_down_flag;
 
 static int recv_pkg_count;
+static int recv_local_pkg_count;
+static int dedup_pkg_count;
+static int busy_pkg_count;
+
+/* backpressure hint in reply, 0 means worker queues are not busy */
+static uint16_t retry_after_ms;
+static bool     is_over_high_water;
 static int process_pkg_succ_count;
 static int process_pkg_fail_count;
 static int insert_db_succ_count;
@@ -79,16 +92,35 @@ static int push_sql(char *sql, size_t len)
     if (queue_push(&worker->queue, sql, len) < 0)
     {
         log_error("push sql fail, worker_id: %d", worker_id);
-        dlog(settings.fail_enqueue_log, "%s;", sql);
+        if (settings.is_binary_fail_log)
+            faillog_write_sql(settings.fail_enqueue_bin, "push queue fail", sql, len);
+        else
+            dlog(settings.fail_enqueue_log, "%s;", sql);
 
         return -1;
     }
 
-    write(worker->pipefd[1], "", 1);
-
     return 0;
 }
 
+static uint64_t worker_queue_bytes(void)
+{
+    uint64_t bytes = 0;
+    int i;
+    for (i = 1; i <= settings.worker_proc_num; ++i)
+    {
+        uint32_t mem_num = 0;
+        uint32_t mem_size = 0;
+        uint32_t file_num = 0;
+        uint64_t file_size = 0;
+
+        queue_stat(&settings.workers[i].queue, &mem_num, &mem_size, &file_num, &file_size);
+        bytes += mem_size + file_size;
+    }
+
+    return bytes;
+}
+
 static int flush_table(struct table *table)
 {
     if (table->buf_use == 0)
@@ -103,6 +135,181 @@ static int flush_table(struct table *table)
     return 0;
 }
 
+# define BACKPRESSURE_CHECK_MS 100
+
+static void check_backpressure(struct timeval *now)
+{
+    if (settings.backpressure_low_water == 0)
+        return;
+
+    static struct timeval last_check;
+    if ((timeval_diff(&last_check, now) / 1000) < BACKPRESSURE_CHECK_MS)
+        return;
+    last_check = *now;
+
+    uint64_t bytes = worker_queue_bytes();
+    uint64_t low  = settings.backpressure_low_water;
+    uint64_t high = settings.backpressure_high_water;
+    bool was_over = is_over_high_water;
+
+    if (bytes < low)
+    {
+        retry_after_ms = 0;
+        is_over_high_water = false;
+    }
+    else if (bytes < high)
+    {
+        /* grow with queue depth */
+        uint64_t ms = settings.backpressure_retry_after * (bytes - low) / (high - low);
+        retry_after_ms = ms ? (uint16_t)ms : 1;
+        is_over_high_water = false;
+    }
+    else
+    {
+        retry_after_ms = settings.backpressure_retry_after;
+        is_over_high_water = true;
+    }
+
+    if (is_over_high_water != was_over)
+    {
+        log_warn("worker queues: %"PRIu64" bytes, %s high water: %"PRIu64, bytes, \
+                is_over_high_water ? "over" : "below", high);
+    }
+}
+
+# define ADAPT_CHECK_MS 1000
+# define ADAPT_RATE_WEIGHT 0.3
+
+static int clamp_int(int64_t v, int min, int max)
+{
+    if (v < min)
+        return min;
+    if (v > max)
+        return max;
+
+    return (int)v;
+}
+
+/* least squares of insert us = fixed + bytes * per byte, in one interval.
+ * if batches are of about the same size, all cost is taken as per byte */
+static void fit_insert_cost(double n, double sx, double sy, double sxx, double sxy, \
+        double *fixed_us, double *byte_us)
+{
+    double d = n * sxx - sx * sx;
+    double b = d > 1e-9 * n * sxx ? (n * sxy - sx * sy) / d : -1;
+    double a = (sy - b * sx) / n;
+
+    if (b < 0 || a < 0)
+    {
+        a = 0;
+        b = sx > 0 ? sy / sx : 0;
+    }
+
+    *fixed_us = a;
+    *byte_us  = b;
+}
+
+/* Tune flush time and size of each table, make batch as large as possible
+ * while flush time + queue wait + insert latency is within latency slo.
+ * Insert latency of a table grow with its batch, which is its arrive rate
+ * times its flush time, so each table get its own deadline */
+static void adapt_cache(struct timeval *now)
+{
+    if (settings.is_adaptive_cache == false)
+        return;
+
+    static struct timeval last_check;
+    static uint64_t last_num, last_bytes, last_us;
+    static double last_sq, last_bus;
+    static double fixed_ms, byte_ms;    /* smoothed insert cost */
+
+    uint64_t interval_ms = timeval_diff(&last_check, now) / 1000;
+    if (interval_ms < ADAPT_CHECK_MS)
+        return;
+    bool is_first = (last_check.tv_sec == 0);
+    last_check = *now;
+
+    uint64_t num = 0, bytes = 0, us = 0;
+    double sq = 0, bus = 0;
+    int i;
+    for (i = 1; i <= settings.worker_proc_num; ++i)
+    {
+        struct worker_stat *stat = settings.workers[i].stat;
+        num   += stat->insert_num;
+        bytes += stat->insert_bytes;
+        us    += stat->insert_us;
+        sq    += stat->insert_bytes_sq;
+        bus   += stat->insert_bytes_us;
+    }
+
+    uint64_t d_num = num - last_num;
+    uint64_t d_bytes = bytes - last_bytes;
+    uint64_t d_us = us - last_us;
+    double d_sq = sq - last_sq;
+    double d_bus = bus - last_bus;
+    last_num = num;
+    last_bytes = bytes;
+    last_us = us;
+    last_sq = sq;
+    last_bus = bus;
+
+    if (is_first)
+        return;
+
+    if (d_num)
+    {
+        double fixed_us, byte_us;
+        fit_insert_cost(d_num, d_bytes, d_us, d_sq, d_bus, &fixed_us, &byte_us);
+
+        fixed_ms = fixed_ms * (1 - ADAPT_RATE_WEIGHT) + fixed_us / 1000 * ADAPT_RATE_WEIGHT;
+        byte_ms  = byte_ms * (1 - ADAPT_RATE_WEIGHT) + byte_us / 1000 * ADAPT_RATE_WEIGHT;
+    }
+
+    uint64_t queue_bytes = worker_queue_bytes();
+    int64_t wait_ms = 0;
+    if (queue_bytes)
+    {
+        if (d_bytes)
+            wait_ms = queue_bytes * interval_ms / d_bytes;
+        else
+            wait_ms = settings.latency_slo_in_ms;
+    }
+
+    /* workers can't keep up, slo can't be met, batch as large as possible
+     * to save round trips of db */
+    bool is_saturated = wait_ms >= settings.latency_slo_in_ms;
+    double budget = settings.latency_slo_in_ms - wait_ms - fixed_ms;
+
+    for (i = 0; i < settings.hash_table_num; ++i)
+    {
+        struct table *table = &settings.tables[i];
+
+        double rate = (double)table->arrive_bytes / interval_ms;
+        table->arrive_rate = table->arrive_rate * (1 - ADAPT_RATE_WEIGHT) + rate * ADAPT_RATE_WEIGHT;
+        table->arrive_bytes = 0;
+
+        if (is_saturated)
+        {
+            table->flush_time_in_ms = settings.cache_time_in_ms;
+            table->flush_len = settings.cache_len;
+
+            continue;
+        }
+
+        /* flush time t: t + fixed + per byte * rate * t is within budget */
+        table->flush_time_in_ms = clamp_int((int64_t)(budget / (1 + byte_ms * table->arrive_rate)), \
+                settings.cache_time_min_in_ms, settings.cache_time_in_ms);
+
+        /* bytes expect to arrive in flush time, a burst flush early by size */
+        table->flush_len = clamp_int((int64_t)(table->arrive_rate * table->flush_time_in_ms), \
+                settings.cache_len_min, settings.cache_len);
+    }
+
+    log_debug("adaptive cache: insert: %.1f ms + %.3f us per KB, queue wait: %"PRId64" ms, "
+            "table 0 flush time: %d ms, flush size: %zu", fixed_ms, byte_ms * 1000 * 1024, \
+            wait_ms, settings.tables[0].flush_time_in_ms, settings.tables[0].flush_len);
+}
+
 static void receiver_looper(void)
 {
     if (shut_down_flag)
@@ -129,10 +336,14 @@ static void receiver_looper(void)
     {
         if (last_log_min != 0)
         {
-            log_info("receiver: recv pkg: %d, succ: %d, fail: %d", \
-                    recv_pkg_count, process_pkg_succ_count, process_pkg_fail_count);
+            log_info("receiver: recv pkg: %d, local pkg: %d, dedup: %d, busy: %d, succ: %d, fail: %d", \
+                    recv_pkg_count, recv_local_pkg_count, dedup_pkg_count, busy_pkg_count, \
+                    process_pkg_succ_count, process_pkg_fail_count);
 
             recv_pkg_count = 0;
+            recv_local_pkg_count = 0;
+            dedup_pkg_count = 0;
+            busy_pkg_count = 0;
             process_pkg_succ_count = 0;
             process_pkg_fail_count = 0;
         }
@@ -140,14 +351,17 @@ static void receiver_looper(void)
         last_log_min = curr_min;
     }
 
+    check_backpressure(&now);
+    adapt_cache(&now);
+
     static struct timeval last_check;
     if (settings.cache_time_in_ms && ((timeval_diff(&last_check, &now) / 1000) > (uint64_t)settings.check_time_in_ms))
     {
         int i;
         for (i = 0; i < settings.hash_table_num; ++i)
         {
-            if (settings.tables[i].buf_use &&
-                    (timeval_diff(&settings.tables[i].start, &now) / 1000) > (uint64_t)settings.cache_time_in_ms)
+            if (settings.tables[i].buf_use && (timeval_diff(&settings.tables[i].start, &now) / 1000) > \
+                    (uint64_t)settings.tables[i].flush_time_in_ms)
             {
                 flush_table(&settings.tables[i]);
             }
@@ -447,6 +661,27 @@ static int choice_table(uint64_t hash_key)
     return (int)(hash_key % settings.hash_table_num);
 }
 
+/* "INSERT INTO `table` (columns) VALUES" of current period */
+static int get_insert_prefix(int table_id, struct table *table)
+{
+    int period = get_shift_period(time(NULL));
+    if (table->prefix_len && table->prefix_period == period)
+        return 0;
+
+# define FMT_INSERT "INSERT INTO `%s` (%s) VALUES"
+    char *table_name = get_table_name(table_id, 0);
+    if (table_name == NULL)
+        return -__LINE__;
+    size_t len = strlen(FMT_INSERT) + strlen(table_name) + settings.columns_str_len;
+    if (auto_realloc((void **)&table->prefix, &table->prefix_size, len) == NULL)
+        return -__LINE__;
+    table->prefix_len = snprintf(table->prefix, table->prefix_size, FMT_INSERT, table_name, settings.columns_str);
+# undef FMT_INSERT
+    table->prefix_period = period;
+
+    return 0;
+}
+
 static int process_one_record(char *s, uint64_t hash_key)
 {
     int table_id = choice_table(hash_key);
@@ -454,7 +689,8 @@ static int process_one_record(char *s, uint64_t hash_key)
     bool is_first = false;
 
     size_t record_len = strlen(s);
-    if (table->buf_use && ((table->buf_use + record_len + 5) >= (size_t)settings.cache_len))
+    table->arrive_bytes += record_len;
+    if (table->buf_use && ((table->buf_use + record_len + 5) >= table->flush_len))
     {
         flush_table(table);
     }
@@ -463,13 +699,11 @@ static int process_one_record(char *s, uint64_t hash_key)
     {
         is_first = true;
 
-# define FMT_INSERT "INSERT INTO `%s` (%s) VALUES"
-        char *table_name = get_table_name(table_id, 0);
-        size_t base_len = strlen(FMT_INSERT) + strlen(table_name) + settings.columns_str_len;
-        if (auto_realloc((void **)&table->buf, &table->buf_len, base_len) == NULL)
+        NEG_RET_LN(get_insert_prefix(table_id, table));
+        if (auto_realloc((void **)&table->buf, &table->buf_len, table->prefix_len + 1) == NULL)
             return -__LINE__;
-        table->buf_use = snprintf(table->buf, table->buf_len, FMT_INSERT, table_name, settings.columns_str);
-# undef FMT_INSERT
+        memcpy(table->buf, table->prefix, table->prefix_len + 1);
+        table->buf_use = table->prefix_len;
 
         if (settings.cache_time_in_ms)
         {
@@ -500,7 +734,7 @@ static int process_one_record(char *s, uint64_t hash_key)
     }
     else
     {
-        if (table->buf_use >= (size_t)settings.cache_len)
+        if (table->buf_use >= table->flush_len)
         {
             is_push = true;
         }
@@ -509,7 +743,7 @@ static int process_one_record(char *s, uint64_t hash_key)
             struct timeval now;
             gettimeofday(&now, NULL);
 
-            if ((timeval_diff(&table->start, &now) / 1000) > (uint64_t)settings.cache_time_in_ms)
+            if ((timeval_diff(&table->start, &now) / 1000) > (uint64_t)table->flush_time_in_ms)
             {
                 is_push = true;
             }
@@ -524,7 +758,8 @@ static int process_one_record(char *s, uint64_t hash_key)
     return 0;
 }
 
-static int reply(struct protocol_head *head, struct sockaddr_in *addr, uint8_t result)
+static int reply(struct protocol_head *head, struct sockaddr_in *addr, uint8_t result, \
+        void *body, size_t body_len)
 {
     if (result == RESULT_OK)
     {
@@ -538,17 +773,221 @@ static int reply(struct protocol_head *head, struct sockaddr_in *addr, uint8_t r
 
     head->result = result;
 
-    size_t reply_len = (head->echo_len <= UINT16_MAX) ? head->echo_len + 10 : UINT16_MAX;
+    size_t reply_len = head->echo_len + body_len + 10 + sizeof(retry_after_ms);
+    if (reply_len > UINT16_MAX)
+        reply_len = UINT16_MAX;
     char buf[reply_len];
     char *p = buf;
     int left = reply_len;
 
     NEG_RET_LN(add_head(head, (void **)&p, &left));
+    if (body_len)
+        NEG_RET_LN(add_bin((void **)&p, &left, body, body_len));
+    if (retry_after_ms)
+        NEG_RET_LN(add_uint16((void **)&p, &left, retry_after_ms));
     NEG_RET_LN(send_udp_pkg(buf, p - buf, addr));
 
     return 0;
 }
 
+/* return RESULT_* code */
+static int process_log(struct sockaddr_in *client_addr, struct protocol_head *head, char *p, int left)
+{
+    struct sockaddr_in real_client_addr;
+    memcpy(&real_client_addr, client_addr, sizeof(real_client_addr));
+    if (head->echo_len == sizeof(struct inner_addr))
+    {
+        struct inner_addr *addr = (struct inner_addr *)head->echo;
+        bzero(&real_client_addr, sizeof(real_client_addr));
+        real_client_addr.sin_addr.s_addr = addr->ip;
+        real_client_addr.sin_port        = addr->port;
+    }
+
+    global_sequence_has_generated = 0;
+
+    uint64_t hash_key = 0;
+    char *s = pkgtostr(&real_client_addr, p, left, &hash_key);
+    if (s == NULL)
+    {
+        if (global_sequence_has_generated)
+        {
+            sequence_dec();
+        }
+
+        return RESULT_PKG_FMT_ERROR;
+    }
+
+    int ret = process_one_record(s, hash_key);
+    if (ret < 0)
+    {
+        log_error("process one record fail: %d", ret);
+
+        return RESULT_INTERNAL_ERROR;
+    }
+
+    return RESULT_OK;
+}
+
+/*
+ * process every record in batch, set bit in bitmap for success record.
+ * return RESULT_OK if all success, else the result of first fail record.
+ */
+static int process_log_batch(struct sockaddr_in *client_addr, struct protocol_head *head, \
+        char *pkg, int len, uint8_t *bitmap, uint16_t *num)
+{
+    void *p  = pkg;
+    int left = len;
+
+    uint16_t n = 0;
+    if (get_uint16(&p, &left, &n) < 0)
+        return RESULT_PKG_FMT_ERROR;
+
+    memset(bitmap, 0, BATCH_BITMAP_LEN(n));
+    *num = n;
+
+    int result = RESULT_OK;
+    int i;
+    for (i = 0; i < n; ++i)
+    {
+        uint16_t record_len = 0;
+        if (get_uint16(&p, &left, &record_len) < 0 || record_len > left)
+        {
+            log_error("batch pkg format error, record: %d, num: %u", i, n);
+            if (result == RESULT_OK)
+                result = RESULT_PKG_FMT_ERROR;
+
+            break;
+        }
+
+        int ret = process_log(client_addr, head, p, record_len);
+        if (ret == RESULT_OK)
+            bitmap[i / 8] |= (1 << (i % 8));
+        else if (result == RESULT_OK)
+            result = ret;
+
+        p = (char *)p + record_len;
+        left -= record_len;
+    }
+
+    return result;
+}
+
+/* return RESULT_* code */
+static int process_pkg(struct sockaddr_in *client_addr, struct protocol_head *head, char *p, int left)
+{
+    if (head->command == COMMAND_SQL)
+    {
+        int ret = push_sql(p, left);
+        if (ret < 0)
+        {
+            log_error("push to queue fail: %d", ret);
+
+            return RESULT_INTERNAL_ERROR;
+        }
+
+        return RESULT_OK;
+    }
+
+    return process_log(client_addr, head, p, left);
+}
+
+/*
+ * loginf resend pkg with the same sequence when reply time out, pkg which
+ * has been processed in the window is replied without insert again.
+ * pkg with sequence 0 is not checked.
+ */
+struct dedup_unit
+{
+    uint32_t sequence;
+    uint32_t ip;
+    uint16_t port;
+    uint16_t num;       /* record num of batch pkg */
+    uint32_t time;
+};
+
+static int dedup_compare(const void *a, const void *b)
+{
+    const struct dedup_unit *x = a;
+    const struct dedup_unit *y = b;
+
+    if (x->sequence == y->sequence && x->ip == y->ip && x->port == y->port)
+        return 0;
+
+    return 1;
+}
+
+static uint32_t dedup_hashkey(const void *unit)
+{
+    const struct dedup_unit *u = unit;
+
+    return u->sequence ^ (u->ip * 2654435761u) ^ u->port;
+}
+
+static int dedup_eliminate(void *unit, time_t now)
+{
+    /* the oldest first */
+    return (int)(now - ((struct dedup_unit *)unit)->time) + 1;
+}
+
+int init_dedup_window(void)
+{
+    return bhash_init(&settings.dedup, settings.dedup_window_size, sizeof(struct dedup_unit), \
+            16, settings.dedup_shm_key, dedup_compare, dedup_hashkey, dedup_eliminate);
+}
+
+static struct dedup_unit *dedup_get(struct sockaddr_in *client_addr, uint32_t sequence)
+{
+    struct dedup_unit unit;
+    bzero(&unit, sizeof(unit));
+    unit.sequence = sequence;
+    unit.ip       = client_addr->sin_addr.s_addr;
+    unit.port     = client_addr->sin_port;
+
+    struct dedup_unit *u = bhash_get(&settings.dedup, &unit);
+    if (u == NULL || (uint32_t)time(NULL) - u->time > settings.dedup_window_time)
+        return NULL;
+
+    return u;
+}
+
+static void dedup_add(struct sockaddr_in *client_addr, uint32_t sequence, uint16_t num)
+{
+    struct dedup_unit unit;
+    bzero(&unit, sizeof(unit));
+    unit.sequence = sequence;
+    unit.ip       = client_addr->sin_addr.s_addr;
+    unit.port     = client_addr->sin_port;
+
+    struct dedup_unit *u = bhash_add(&settings.dedup, &unit, NULL);
+    if (u == NULL)
+    {
+        log_error("add to dedup window fail, seq: %u", sequence);
+
+        return;
+    }
+
+    u->num  = num;
+    u->time = (uint32_t)time(NULL);
+}
+
+static int reply_busy(struct protocol_head *head, struct sockaddr_in *client_addr, uint16_t num)
+{
+    ++busy_pkg_count;
+
+    if (head->command == COMMAND_LOG_BATCH)
+    {
+        uint8_t body[sizeof(num) + BATCH_BITMAP_LEN(UINT16_MAX)];
+        void *b  = body;
+        int  bl = sizeof(body);
+        add_uint16(&b, &bl, num);
+        memset(body + sizeof(num), 0, BATCH_BITMAP_LEN(num));
+
+        return reply(head, client_addr, RESULT_BUSY, body, sizeof(num) + BATCH_BITMAP_LEN(num));
+    }
+
+    return reply(head, client_addr, RESULT_BUSY, NULL, 0);
+}
+
 static int handle_udp(struct sockaddr_in *client_addr, char *pkg, int len)
 {
     ++recv_pkg_count;
@@ -556,76 +995,273 @@ static int handle_udp(struct sockaddr_in *client_addr, char *pkg, int len)
     log_debug("recv pkg from %s, len: %d\n%s", addrtostr(client_addr), len, \
             hex_dump_str(pkg, len));
 
-    int ret;
-
     char *p = pkg;
     int left = len;
 
     struct protocol_head head;
-    ret = get_head(&head, (void **)&p, &left);
-    if (ret < 0)
+    if (get_head(&head, (void **)&p, &left) < 0)
         return -__LINE__;
 
-    if (head.command == COMMAND_SQL)
+    bool is_dedup = settings.dedup_window_time && head.sequence;
+    struct dedup_unit *dup = NULL;
+    if (is_dedup)
+        dup = dedup_get(client_addr, head.sequence);
+
+    int result;
+    uint16_t num = 0;
+    if (dup)
     {
-        ret = push_sql(p, left);
-        if (ret < 0)
+        ++dedup_pkg_count;
+        log_debug("dup pkg from %s, seq: %u", addrtostr(client_addr), head.sequence);
+
+        if (head.command == COMMAND_LOG_BATCH)
         {
-            log_error("push to queue fail: %d", ret);
-            NEG_RET(reply(&head, client_addr, RESULT_INTERNAL_ERROR));
+            uint8_t body[sizeof(num) + BATCH_BITMAP_LEN(UINT16_MAX)];
+            void *b  = body;
+            int  bl = sizeof(body);
+            add_uint16(&b, &bl, dup->num);
 
-            return -__LINE__;
+            /* only all success pkg in the window */
+            memset(body + sizeof(num), 0xff, BATCH_BITMAP_LEN(dup->num));
+            if (dup->num % 8)
+                body[sizeof(num) + dup->num / 8] = (1 << (dup->num % 8)) - 1;
+
+            NEG_RET(reply(&head, client_addr, RESULT_OK, body, sizeof(num) + BATCH_BITMAP_LEN(dup->num)));
         }
+        else
+        {
+            NEG_RET(reply(&head, client_addr, RESULT_OK, NULL, 0));
+        }
+
+        return 0;
+    }
+
+    /* limit by real client ip, count by log num */
+    uint32_t ip = client_addr->sin_addr.s_addr;
+    if (head.echo_len == sizeof(struct inner_addr))
+        ip = ((struct inner_addr *)head.echo)->ip;
+
+    void *np = p;
+    int  nl = left;
+    if (head.command == COMMAND_LOG_BATCH && get_uint16(&np, &nl, &num) < 0)
+        num = 1;
+
+    /* don't let worker queues spill without bound */
+    if (is_over_high_water || limit_is_busy(ip, head.command == COMMAND_LOG_BATCH ? num : 1))
+    {
+        NEG_RET(reply_busy(&head, client_addr, num));
+
+        return 0;
+    }
+
+    if (head.command == COMMAND_LOG_BATCH)
+    {
+        uint8_t  body[sizeof(num) + BATCH_BITMAP_LEN(UINT16_MAX)];
+        result = process_log_batch(client_addr, &head, p, left, body + sizeof(num), &num);
+
+        void *b  = body;
+        int  bl = sizeof(body);
+        add_uint16(&b, &bl, num);
+        NEG_RET(reply(&head, client_addr, result, body, sizeof(num) + BATCH_BITMAP_LEN(num)));
     }
     else
     {
-        struct sockaddr_in real_client_addr;
-        memcpy(&real_client_addr, client_addr, sizeof(real_client_addr));
-        if (head.echo_len == sizeof(struct inner_addr))
-        {
-            struct inner_addr *addr = (struct inner_addr *)head.echo;
-            bzero(&real_client_addr, sizeof(real_client_addr));
-            real_client_addr.sin_addr.s_addr = addr->ip;
-            real_client_addr.sin_port        = addr->port;
-        }
+        result = process_pkg(client_addr, &head, p, left);
+        NEG_RET(reply(&head, client_addr, result, NULL, 0));
+    }
 
-        global_sequence_has_generated = 0;
+    if (is_dedup && result == RESULT_OK)
+        dedup_add(client_addr, head.sequence, num);
 
-        uint64_t hash_key = 0;
-        char *s = pkgtostr(&real_client_addr, p, left, &hash_key);
-        if (s == NULL)
-        {
-            if (global_sequence_has_generated)
-            {
-                sequence_dec();
-            }
+    if (result != RESULT_OK)
+        return -__LINE__;
 
-            NEG_RET(reply(&head, client_addr, RESULT_PKG_FMT_ERROR));
+    return 0;
+}
 
-            return -__LINE__;
-        }
+/* pkg from local queue or unix socket, no reply, writer get backpressure from queue */
+static int handle_local(struct sockaddr_in *client_addr, char *pkg, int len)
+{
+    ++recv_local_pkg_count;
+
+    log_debug("recv local pkg, len: %d\n%s", len, hex_dump_str(pkg, len));
+
+    char *p = pkg;
+    int left = len;
+
+    struct protocol_head head;
+    if (get_head(&head, (void **)&p, &left) < 0)
+    {
+        ++process_pkg_fail_count;
+
+        return -__LINE__;
+    }
+
+    int result;
+    if (head.command == COMMAND_LOG_BATCH)
+    {
+        uint16_t num = 0;
+        uint8_t  bitmap[BATCH_BITMAP_LEN(UINT16_MAX)];
+        result = process_log_batch(client_addr, &head, p, left, bitmap, &num);
+    }
+    else
+    {
+        result = process_pkg(client_addr, &head, p, left);
+    }
+
+    if (result != RESULT_OK)
+    {
+        ++process_pkg_fail_count;
+
+        return -__LINE__;
+    }
+
+    ++process_pkg_succ_count;
+
+    return 0;
+}
+
+# define LOCAL_QUEUE_BATCH      1000
+
+/*
+ * the local queue is shm written by other processes, its futex can't be
+ * selected with sockets. a thread wait on it, then wake receiver by
+ * local_ready_fd, and wait receiver drain it by local_drained_fd.
+ */
+static int  local_ready_fd = -1;
+static int  local_drained_fd = -1;
+static bool is_local_ready;
+
+static void *local_queue_watcher(void *arg)
+{
+    /* signals are handled by receiver thread */
+    sigset_t set;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
 
-        ret = process_one_record(s, hash_key);
+    uint64_t v = 1;
+    while (true)
+    {
+        int ret = queue_wait(&settings.local_queue, 1000);
+        if (ret == -1)
+            continue;
         if (ret < 0)
         {
-            log_error("process one record fail: %d", ret);
-            NEG_RET(reply(&head, client_addr, RESULT_INTERNAL_ERROR));
+            log_error("queue_wait local queue error: %d", ret);
+            sleep(1);
 
-            return -__LINE__;
+            continue;
         }
+
+        if (write(local_ready_fd, &v, sizeof(v)) < 0)
+            log_error("wake receiver fail: %m");
+        while (read(local_drained_fd, &v, sizeof(v)) < 0 && errno == EINTR)
+            ;
     }
 
-    NEG_RET(reply(&head, client_addr, RESULT_OK));
+    return NULL;
+}
+
+static void on_local_ready(int fd)
+{
+    uint64_t v;
+    if (read(fd, &v, sizeof(v)) == sizeof(v))
+        is_local_ready = true;
+}
+
+static int start_local_queue_watcher(void)
+{
+    local_ready_fd = eventfd(0, 0);
+    local_drained_fd = eventfd(0, 0);
+    if (local_ready_fd < 0 || local_drained_fd < 0)
+        return -__LINE__;
+
+    pthread_t tid;
+    if (pthread_create(&tid, NULL, local_queue_watcher, NULL) != 0)
+        return -__LINE__;
+    pthread_detach(tid);
+
+    set_notify_fd(local_ready_fd, on_local_ready);
 
     return 0;
 }
 
+/* return num of pkg pop from local queue */
+static int handle_local_queue(void)
+{
+    struct sockaddr_in local_addr;
+    bzero(&local_addr, sizeof(local_addr));
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int i;
+    for (i = 0; i < LOCAL_QUEUE_BATCH; ++i)
+    {
+        char     *pkg;
+        uint32_t len;
+
+        int ret = queue_pop(&settings.local_queue, (void **)&pkg, &len);
+        if (ret == -1)
+        {
+            break;
+        }
+        else if (ret < 0)
+        {
+            log_error("queue_pop local queue error: %d", ret);
+
+            break;
+        }
+
+        ret = handle_local(&local_addr, pkg, (int)len);
+        if (ret < 0)
+        {
+            log_error("handle local pkg fail: %d", ret);
+        }
+    }
+
+    return i;
+}
+
 int do_receiver_job(void)
 {
+    if (settings.local_queue_shm_key)
+    {
+        int ret = start_local_queue_watcher();
+        if (ret < 0)
+        {
+            log_error("start local queue watcher fail: %d: %m", ret);
+
+            return -__LINE__;
+        }
+    }
+
     while (true)
     {
         receiver_looper();
 
+        /*
+         * local producers are not rate limited by ip, but over high water
+         * they are not read: the local queue fill and its writers get -1,
+         * the unix socket buffer fill and its writers block
+         */
+        pause_unix_socket(is_over_high_water);
+
+        int timeout_in_ms = 100;
+        if (is_local_ready && !is_over_high_water)
+        {
+            if (handle_local_queue() == LOCAL_QUEUE_BATCH)
+            {
+                timeout_in_ms = 0;
+            }
+            else
+            {
+                uint64_t v = 1;
+                is_local_ready = false;
+                if (write(local_drained_fd, &v, sizeof(v)) < 0)
+                    log_error("wake local queue watcher fail: %m");
+            }
+        }
+
         char pkg[UINT16_MAX];
         int  len = 0;
         struct sockaddr_in client_addr;
@@ -633,7 +1269,7 @@ int do_receiver_job(void)
         errno = 0;
         int ret = 0;
 
-        ret = recv_udp_pkg(&client_addr, pkg, sizeof(pkg), &len);
+        ret = recv_udp_pkg_timeout(&client_addr, pkg, sizeof(pkg), &len, timeout_in_ms);
         if (ret < -1)
         {
             if (errno)
@@ -647,6 +1283,17 @@ int do_receiver_job(void)
             continue;
         }
 
+        if (ret == 1)
+        {
+            ret = handle_local(&client_addr, pkg, len);
+            if (ret < 0)
+            {
+                log_error("handle local pkg fail: %d", ret);
+            }
+
+            continue;
+        }
+
         ret = handle_udp(&client_addr, pkg, len);
         if (ret < 0)
         {
@@ -657,6 +1304,12 @@ int do_receiver_job(void)
     return 0;
 }
 
+static bool has_merge_table(void)
+{
+    return sink == &mysql_sink && settings.hash_table_num > 1 && \
+        strcasecmp(settings.db_engine, "myisam") == 0;
+}
+
 static int create_new_tables(void)
 {
     int i;
@@ -666,22 +1319,16 @@ static int create_new_tables(void)
         if (table_name == NULL)
             return -__LINE__;
 
-        char *create_sql = create_table_sql(table_name);
-        if (create_sql == NULL)
-            return -__LINE__;
-
-        log_info("worker: %d, sql: %s", settings.worker_id, create_sql);
-
-        int ret = db_query(create_sql, 0);
+        int ret = sink->create_table(table_name);
         if (ret < 0)
         {
-            log_error("exec sql fail: %s, sql: %s", db_error(), create_sql);
+            log_error("create table %s fail: %s", table_name, sink->error());
 
             return -__LINE__;
         }
     }
 
-    if (settings.hash_table_num > 1 && strcasecmp(settings.db_engine, "myisam") == 0)
+    if (has_merge_table())
     {
         char *merge_sql = create_merge_table_sql(0);
         if (merge_sql == NULL)
@@ -703,21 +1350,10 @@ static int create_new_tables(void)
 
 static int drop_table(char *table_name)
 {
-    static char *sql = NULL;
-    static size_t sql_buf_len = 0;
-
-# define FMT_DROP "DROP TABLE IF EXISTS `%s`"
-    if ((sql = auto_realloc((void **)&sql, &sql_buf_len, strlen(FMT_DROP) + strlen(table_name))) == NULL)
-        return -__LINE__;
-    snprintf(sql, sql_buf_len, FMT_DROP, table_name);
-# undef FMT_DROP
-
-    log_debug("worker: %d, sql: %s", settings.worker_id, sql);
-
-    int ret = db_query(sql, 0);
+    int ret = sink->drop_table(table_name);
     if (ret < 0)
     {
-        log_error("exec sql fail: %s, sql: %s", db_error(), sql);
+        log_error("drop table %s fail: %s", table_name, sink->error());
 
         return -__LINE__;
     }
@@ -740,7 +1376,7 @@ static int drop_expire_tables(void)
         NEG_RET(drop_table(table_name));
     }
 
-    if (settings.hash_table_num > 1 && strcasecmp(settings.db_engine, "myisam") == 0)
+    if (has_merge_table())
     {
         char *merge_table = get_table_name(-1, -settings.data_keep_time);
         if (merge_table == NULL)
@@ -754,7 +1390,6 @@ static int drop_expire_tables(void)
 
 static void check_shift(time_t tv_sec)
 {
-    int curr = 0;
     static int last_create = -1;
     static int last_drop   = -1;
 
@@ -769,25 +1404,7 @@ static void check_shift(time_t tv_sec)
      * 修复：last_create 和 last_drop 初始化为 -1.
      */
 
-    struct tm *tm = localtime(&tv_sec);
-    switch (settings.shift_table_type)
-    {
-    case TABLE_SHIFT_BY_HOUR:
-        curr = tm->tm_hour;
-        break;
-    case TABLE_SHIFT_BY_DAY:
-        curr = tm->tm_mday;
-        break;
-    case TABLE_SHIFT_BY_MON:
-        curr = tm->tm_mon;
-        break;
-    case TABLE_SHIFT_BY_YEAR:
-        curr = tm->tm_year;
-        break;
-    default:
-        log_fatal("unknown shift type: %d", settings.shift_table_type);
-        break;
-    }
+    int curr = get_shift_period(tv_sec);
 
     if (curr != last_create)
     {
@@ -860,18 +1477,10 @@ static void worker_looper(void)
 
 static void wait_for_notify(struct worker *worker)
 {
-    fd_set r_set;
-    FD_ZERO(&r_set);
-    FD_SET(worker->pipefd[0], &r_set);
-
-    struct timeval timeout = { 0, 100 * 1000 };
-    int ret = 0;
-
-    ret = select(worker->pipefd[0] + 1, &r_set, NULL, NULL, &timeout);
-    if (ret > 0 && FD_ISSET(worker->pipefd[0], &r_set))
+    int ret = queue_wait(&worker->queue, 100);
+    if (ret < -1)
     {
-        char c;
-        read(worker->pipefd[0], &c, 1);
+        log_error("queue_wait error: %d", ret);
     }
 
     return;
@@ -936,21 +1545,28 @@ int do_worker_job(void)
         if (strncmp(sql, "INSERT", 6) != 0)
             is_insert = false;
 
-        ret = db_safe_query(sql, length - 1);
+        struct timeval start;
+        gettimeofday(&start, NULL);
+
+        int rows = 0;
+        if (is_insert)
+            ret = rows = sink_insert(sql, length - 1);
+        else
+            ret = sink_exec(sql, length - 1);
 
         if (ret < 0)
         {
             if (is_insert)
             {
                 log_error("worker: %d, insert fail: %s", \
-                        settings.worker_id, db_error());
+                        settings.worker_id, sink->error());
 
                 ++insert_db_fail_count;
             }
             else
             {
                 log_error("worker: %d, exec sql: %s fail: %s", \
-                        settings.worker_id, sql, db_error());
+                        settings.worker_id, sql, sink->error());
 
                 ++exec_sql_fail_count;
             }
@@ -958,7 +1574,11 @@ int do_worker_job(void)
             if (ret < -1 || (ret == -1 && \
                         queue_push(&settings.cache_queue, sql, length) < 0))
             {
-                if (is_insert)
+                if (is_insert && settings.is_binary_fail_log)
+                {
+                    faillog_write(settings.fail_insert_bin, sink->error(), sql, length);
+                }
+                else if (is_insert)
                 {
                     dlog(settings.fail_insert_log, "%s;", sql);
                 }
@@ -973,8 +1593,19 @@ int do_worker_job(void)
         {
             if (is_insert)
             {
-                int rows = db_affected_rows();
                 insert_db_succ_count += rows;
+
+                struct timeval end;
+                gettimeofday(&end, NULL);
+
+                struct worker_stat *stat = worker->stat;
+                uint64_t us = timeval_diff(&start, &end);
+                stat->insert_us += us;
+                stat->insert_bytes += length;
+                stat->insert_bytes_sq += (double)length * length;
+                stat->insert_bytes_us += (double)length * us;
+                __sync_synchronize();
+                stat->insert_num += 1;
             }
             else
             {
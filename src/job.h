@@ -5,6 +5,8 @@
 
 # pragma once
 
+int init_dedup_window(void);
+
 int do_receiver_job(void);
 
 int do_worker_job(void);
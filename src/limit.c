@@ -0,0 +1,250 @@
+/*
+ * Description: token bucket rate limit of sender ip at receiver
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <strings.h>
+# include <sys/time.h>
+# include <arpa/inet.h>
+
+# include "conf.h"
+# include "utils.h"
+# include "bhash.h"
+# include "limit.h"
+
+# define LIMIT_BUCKET_NUM 100000
+
+struct limit_rule
+{
+    uint32_t    net;        /* host byte order */
+    uint32_t    mask;
+    uint32_t    rate;       /* logs per second, 0 means no limit */
+    uint32_t    burst;
+};
+
+struct bucket
+{
+    uint32_t    ip;         /* first 4 bytes as hash key */
+    uint32_t    rate;
+    uint32_t    burst;
+    uint32_t    last_sec;
+    uint64_t    last_us;
+    double      tokens;
+};
+
+static bool                 limit_flag;
+static struct limit_rule    *rules;
+static int                  rule_num;
+static bhash_t              buckets;
+static struct bucket        global_bucket;
+
+static uint64_t now_us(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec * 1000000ull + now.tv_usec;
+}
+
+/* idle bucket first */
+static int bucket_eliminate(void *unit, time_t now)
+{
+    return (int)(now - ((struct bucket *)unit)->last_sec) + 1;
+}
+
+static int rule_compare(const void *a, const void *b)
+{
+    const struct limit_rule *x = a;
+    const struct limit_rule *y = b;
+
+    /* longer prefix first */
+    if (x->mask == y->mask)
+        return 0;
+
+    return x->mask > y->mask ? -1 : 1;
+}
+
+/* format: ip/prefix rate [burst], separate by comma */
+static int parse_rules(char *str)
+{
+    int num = 1;
+    char *c;
+    for (c = str; *c; ++c)
+    {
+        if (*c == ',')
+            ++num;
+    }
+
+    rules = calloc(num, sizeof(struct limit_rule));
+    if (rules == NULL)
+        return -__LINE__;
+
+    char *save = NULL;
+    char *item = strtok_r(str, ",", &save);
+    while (item)
+    {
+        char cidr[64] = { 0 };
+        unsigned rate = 0;
+        unsigned burst = 0;
+
+        int n = sscanf(item, "%63s %u %u", cidr, &rate, &burst);
+        if (n < 2)
+        {
+            fprintf(stderr, "invalid rate limit: %s\n", item);
+
+            return -__LINE__;
+        }
+
+        unsigned prefix = 32;
+        char *slash = strchr(cidr, '/');
+        if (slash)
+        {
+            *slash = 0;
+            prefix = (unsigned)atoi(slash + 1);
+        }
+
+        struct in_addr addr;
+        if (inet_aton(cidr, &addr) == 0 || prefix > 32)
+        {
+            fprintf(stderr, "invalid rate limit ip: %s\n", item);
+
+            return -__LINE__;
+        }
+
+        struct limit_rule *rule = &rules[rule_num++];
+        rule->mask  = prefix ? (uint32_t)(0xffffffffull << (32 - prefix)) : 0;
+        rule->net   = ntohl(addr.s_addr) & rule->mask;
+        rule->rate  = rate;
+        rule->burst = burst ? burst : rate;
+
+        item = strtok_r(NULL, ",", &save);
+    }
+
+    qsort(rules, rule_num, sizeof(struct limit_rule), rule_compare);
+
+    return 0;
+}
+
+int limit_init(void)
+{
+    if (settings.rate_limit)
+    {
+        char *str = strdup(settings.rate_limit);
+        if (str == NULL)
+            return -__LINE__;
+
+        int ret = parse_rules(str);
+        free(str);
+        NEG_RET(ret);
+
+        NEG_RET_LN(bhash_init(&buckets, LIMIT_BUCKET_NUM, sizeof(struct bucket), \
+                    16, 0, NULL, NULL, bucket_eliminate));
+
+        limit_flag = true;
+    }
+
+    if (settings.global_rate_limit)
+    {
+        global_bucket.rate   = settings.global_rate_limit;
+        global_bucket.burst  = settings.global_rate_limit;
+        global_bucket.tokens = settings.global_rate_limit;
+        global_bucket.last_us = now_us();
+
+        limit_flag = true;
+    }
+
+    return 0;
+}
+
+static struct limit_rule *find_rule(uint32_t ip)
+{
+    uint32_t host = ntohl(ip);
+
+    int i;
+    for (i = 0; i < rule_num; ++i)
+    {
+        if ((host & rules[i].mask) == rules[i].net)
+            return &rules[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * tokens may be less than 0 after take, a batch larger than burst can pass
+ * when bucket is not empty, and the debt is paid by later refill
+ */
+static bool bucket_take(struct bucket *b, uint32_t n, uint64_t now)
+{
+    if (now > b->last_us)
+    {
+        b->tokens += (double)(now - b->last_us) * b->rate / 1000000;
+        if (b->tokens > b->burst)
+            b->tokens = b->burst;
+    }
+
+    b->last_us  = now;
+    b->last_sec = (uint32_t)(now / 1000000);
+
+    if (b->tokens <= 0)
+        return false;
+
+    b->tokens -= n;
+
+    return true;
+}
+
+bool limit_is_busy(uint32_t ip, uint32_t n)
+{
+    if (limit_flag == false)
+        return false;
+
+    uint64_t now = now_us();
+    struct bucket *b = NULL;
+
+    if (rule_num)
+    {
+        struct bucket unit;
+        bzero(&unit, sizeof(unit));
+        unit.ip = ip;
+
+        b = bhash_get(&buckets, &unit);
+        if (b == NULL)
+        {
+            /* ip match no rule is kept with rate 0, not scan rules again */
+            struct limit_rule *rule = find_rule(ip);
+            if (rule && rule->rate)
+            {
+                unit.rate    = rule->rate;
+                unit.burst   = rule->burst;
+                unit.tokens  = rule->burst;
+            }
+            unit.last_us  = now;
+            unit.last_sec = (uint32_t)(now / 1000000);
+
+            b = bhash_put(&buckets, &unit);
+        }
+
+        if (b && b->rate == 0)
+        {
+            b->last_sec = (uint32_t)(now / 1000000);
+            b = NULL;
+        }
+
+        if (b && bucket_take(b, n, now) == false)
+            return true;
+    }
+
+    if (global_bucket.rate && bucket_take(&global_bucket, n, now) == false)
+    {
+        /* not received, give tokens of ip back */
+        if (b)
+            b->tokens += n;
+
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,20 @@
+/*
+ * Description: token bucket rate limit of sender ip at receiver
+ */
+
+# pragma once
+
+# include <stdint.h>
+# include <stdbool.h>
+
+/*
+ * parse 'rate limit' and 'global rate limit' in settings
+ * rate limit is disabled if both are not set
+ */
+int limit_init(void);
+
+/*
+ * take n tokens of ip (network byte order) and the global bucket
+ * return true if ip or global is over limit, the pkg should be dropped
+ */
+bool limit_is_busy(uint32_t ip, uint32_t n);
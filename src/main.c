@@ -15,6 +15,7 @@
 # include <errno.h>
 # include <signal.h>
 # include <inttypes.h>
+# include <sys/mman.h>
 
 # include "queue.h"
 # include "conf.h"
@@ -22,9 +23,12 @@
 # include "db.h"
 # include "net.h"
 # include "job.h"
+# include "limit.h"
+# include "sink.h"
 # include "sql.h"
 # include "seq.h"
 # include "api.h"
+# include "replay.h"
 
 int shut_down_flag;
 static char config_file_path[PATH_MAX];
@@ -48,6 +52,13 @@ static void show_usage(void)
             "  -q  --queue-stat print queue status\n"
             "  -r  --rm-queue   rm all queue shm by call ipcrm\n"
             "\n"
+            "  -R  --replay=S   replay fail log or queue spill file, resume from S.ckpt\n"
+            "  -T  --replay-type=S\n"
+            "                   text, spill or binary, default by the first record\n"
+            "  -j  --jobs=N     parallel replay jobs, default 4, resume need the same N\n"
+            "  -L  --rate=N     replay statements per second, default no limit\n"
+            "  -D  --render=S   print statements in fail log as sql\n"
+            "\n"
             "Report bugs to <damonyang@tencent.com>\n");
 }
 
@@ -59,6 +70,12 @@ static int queue_status_flag  = false;
 static int rm_queue_shm_flag  = false;
 static int create_merge_flag  = false;
 
+static char replay_file_path[PATH_MAX];
+static int  replay_jobs = 4;
+static int  replay_file_type = REPLAY_AUTO;
+static char render_file_path[PATH_MAX];
+static unsigned replay_rate;
+
 static void get_options(int argc, char *argv[])
 {
     if (argc == 1)
@@ -78,6 +95,11 @@ static void get_options(int argc, char *argv[])
         { "api",                no_argument,        NULL,   'a' },
         { "queue-stat",         no_argument,        NULL,   'q' },
         { "rm-queue",           no_argument,        NULL,   'r' },
+        { "replay",             required_argument,  NULL,   'R' },
+        { "replay-type",        required_argument,  NULL,   'T' },
+        { "jobs",               required_argument,  NULL,   'j' },
+        { "rate",               required_argument,  NULL,   'L' },
+        { "render",             required_argument,  NULL,   'D' },
         { NULL,                 0,                  NULL,    0  },
     };
 
@@ -90,6 +112,11 @@ static void get_options(int argc, char *argv[])
         "a"
         "q"
         "r"
+        "R:"
+        "T:"
+        "j:"
+        "L:"
+        "D:"
         ;
 
     int c;
@@ -124,6 +151,32 @@ static void get_options(int argc, char *argv[])
             break;
         case 'r':
             rm_queue_shm_flag = true;
+            break;
+        case 'R':
+            /* work dir change to bin later */
+            if (realpath(optarg, replay_file_path) == NULL)
+                error(EXIT_FAILURE, errno, "realpath fail for %s", optarg);
+
+            break;
+        case 'T':
+            replay_file_type = replay_type(optarg);
+            if (replay_file_type < 0)
+                error(EXIT_FAILURE, 0, "unknown replay type: %s", optarg);
+
+            break;
+        case 'j':
+            replay_jobs = atoi(optarg);
+            if (replay_jobs <= 0)
+                error(EXIT_FAILURE, 0, "jobs should be a positive value");
+
+            break;
+        case 'L':
+            replay_rate = (unsigned)strtoul(optarg, NULL, 0);
+            break;
+        case 'D':
+            if (realpath(optarg, render_file_path) == NULL)
+                error(EXIT_FAILURE, errno, "realpath fail for %s", optarg);
+
             break;
         case '?':
             exit(EXIT_FAILURE);
@@ -495,6 +548,39 @@ static int init_cache_queue(int i)
     return 0;
 }
 
+static int init_local_queue(void)
+{
+    if (settings.local_queue_shm_key == 0)
+        return 0;
+
+    int ret = queue_init_mp(&settings.local_queue, settings.server_name, \
+            settings.local_queue_shm_key, settings.local_queue_mem_size, NULL, 0);
+    if (ret < 0)
+    {
+        fprintf(stderr, "init local queue fail: %d, shm key may have been used!\n", ret);
+
+        return -__LINE__;
+    }
+
+    return 0;
+}
+
+static int init_dedup(void)
+{
+    if (settings.dedup_window_time == 0)
+        return 0;
+
+    int ret = init_dedup_window();
+    if (ret < 0)
+    {
+        fprintf(stderr, "init dedup window fail: %d\n", ret);
+
+        return -__LINE__;
+    }
+
+    return 0;
+}
+
 static void print_queue_stat(void)
 {
     settings.workers = calloc(settings.worker_proc_num + 1, sizeof(struct worker));
@@ -524,6 +610,22 @@ static void print_queue_stat(void)
                 i, mem_unit, mem_size, file_unit, file_size);
     }
 
+    if (settings.local_queue_shm_key)
+    {
+        if (init_local_queue() < 0)
+            exit(EXIT_FAILURE);
+
+        uint32_t mem_unit = 0;
+        uint32_t mem_size = 0;
+        uint32_t file_unit = 0;
+        uint64_t file_size = 0;
+
+        queue_stat(&settings.local_queue, &mem_unit, &mem_size, &file_unit, &file_size);
+
+        printf("%-4s %-10u %-10u %-10u %"PRIu64"\n", \
+                "L", mem_unit, mem_size, file_unit, file_size);
+    }
+
     return;
 }
 
@@ -539,11 +641,32 @@ static void rm_all_queue_shm(void)
         system(cmd);
     }
 
+    if (settings.local_queue_shm_key)
+    {
+        char cmd[100];
+        snprintf(cmd, sizeof(cmd), "ipcrm -M %d", settings.local_queue_shm_key);
+
+        puts(cmd);
+        system(cmd);
+    }
+
+    if (settings.dedup_shm_key)
+    {
+        char cmd[100];
+        snprintf(cmd, sizeof(cmd), "ipcrm -M %d", settings.dedup_shm_key);
+
+        puts(cmd);
+        system(cmd);
+    }
+
     return;
 }
 
 static void handle_options(void)
 {
+    if ((sync_database_flag || create_merge_flag) && sink != &mysql_sink)
+        error(EXIT_FAILURE, 0, "only mysql sink support sync and merge table");
+
     if (sync_database_flag)
     {
         sync_db();
@@ -588,6 +711,27 @@ static void handle_options(void)
 
         exit(EXIT_SUCCESS);
     }
+
+    if (replay_file_path[0])
+    {
+        int ret = replay(replay_file_path, replay_file_type, replay_jobs, replay_rate);
+        if (ret < 0)
+            error(EXIT_FAILURE, errno, "replay %s fail: %d", replay_file_path, ret);
+
+        if (ret == 0)
+            printf("replay %s success!\n", replay_file_path);
+
+        exit(EXIT_SUCCESS);
+    }
+
+    if (render_file_path[0])
+    {
+        int ret = render(render_file_path, replay_file_type);
+        if (ret < 0)
+            error(EXIT_FAILURE, errno, "render %s fail: %d", render_file_path, ret);
+
+        exit(EXIT_SUCCESS);
+    }
 }
 
 static int create_worker_proc(void)
@@ -596,12 +740,21 @@ static int create_worker_proc(void)
     if (settings.workers == NULL)
         return -__LINE__;
 
+    /* insert stats report to receiver, share by all child process */
+    size_t stat_size = sizeof(struct worker_stat) * (settings.worker_proc_num + 1);
+    struct worker_stat *stats = mmap(NULL, stat_size, PROT_READ | PROT_WRITE, \
+            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (stats == MAP_FAILED)
+        return -__LINE__;
+
     int i;
-    for (i = 1; i <= settings.worker_proc_num; ++i)
+    for (i = 0; i <= settings.worker_proc_num; ++i)
     {
-        if (pipe(settings.workers[i].pipefd) != 0)
-            return -__LINE__;
+        settings.workers[i].stat = &stats[i];
+    }
 
+    for (i = 1; i <= settings.worker_proc_num; ++i)
+    {
         pid_t pid = fork();
         if (pid < 0)
             return -__LINE__;
@@ -610,18 +763,9 @@ static int create_worker_proc(void)
         {
             settings.worker_id = i;
 
-            int j;
-            for (j = 1; j <= i; ++j)
-            {
-                close(settings.workers[j].pipefd[1]);
-                settings.workers[j].pipefd[1] = 0;
-            }
-
             break;
         }
 
-        close(settings.workers[i].pipefd[0]);
-        settings.workers[i].pipefd[0] = 0;
         settings.workers[i].pid = pid;
     }
 
@@ -633,6 +777,10 @@ static int create_worker_proc(void)
         {
             NEG_RET_LN(init_worker_queue(i));
         }
+
+        NEG_RET_LN(init_local_queue());
+        NEG_RET_LN(init_dedup());
+        NEG_RET_LN(limit_init());
     }
     else
     {
@@ -645,23 +793,40 @@ static int create_worker_proc(void)
 
 static int init_logs(void)
 {
+    int async = settings.is_async_log ? DLOG_ASYNC : 0;
+
     default_dlog = dlog_init(settings.default_log_path, \
-            DLOG_SHIFT_BY_DAY | DLOG_USE_FORK, 1024 * 1024 * 1024, 10, 30);
+            DLOG_SHIFT_BY_DAY | DLOG_USE_FORK | async, 1024 * 1024 * 1024, 10, 30);
     if (default_dlog == NULL)
         return -__LINE__;
 
     default_dlog_flag = dlog_read_flag(settings.default_log_flag);
 
+    /* fail logs are the only copy of rows not stored, never drop them,
+     * wait the writer when its buffer is full */
+    int no_drop = async ? DLOG_ASYNC | DLOG_NO_DROP : 0;
+
     settings.fail_enqueue_log = dlog_init(settings.fail_enqueue_log_path, \
-            DLOG_SHIFT_BY_DAY | DLOG_USE_FORK, 1024 * 1024 * 1024, 0, 0);
+            DLOG_SHIFT_BY_DAY | DLOG_USE_FORK | no_drop, 1024 * 1024 * 1024, 0, 0);
     if (settings.fail_enqueue_log == NULL)
         return -__LINE__;
 
     settings.fail_insert_log = dlog_init(settings.fail_insert_log_path, \
-            DLOG_SHIFT_BY_DAY, 1024 * 1024 * 1024, 0, 0);
+            DLOG_SHIFT_BY_DAY | no_drop, 1024 * 1024 * 1024, 0, 0);
     if (settings.fail_insert_log == NULL)
         return -__LINE__;
 
+    if (settings.is_binary_fail_log)
+    {
+        settings.fail_enqueue_bin = faillog_init(settings.fail_enqueue_log_path, no_drop);
+        if (settings.fail_enqueue_bin == NULL)
+            return -__LINE__;
+
+        settings.fail_insert_bin = faillog_init(settings.fail_insert_log_path, no_drop);
+        if (settings.fail_insert_bin == NULL)
+            return -__LINE__;
+    }
+
     return 0;
 }
 
@@ -688,11 +853,15 @@ static void handle_signal(int signo)
 
 int main(int argc, char *argv[])
 {
-    printf("%s-%s, compile in: %s %s, now: %s\n", \
-            PACKAGE_STRING, VERSION_STRING, __DATE__, __TIME__, get_curr_date_time());
-
     get_options(argc, argv);
 
+    /* output of render is sql only */
+    if (render_file_path[0] == 0)
+    {
+        printf("%s-%s, compile in: %s %s, now: %s\n", \
+                PACKAGE_STRING, VERSION_STRING, __DATE__, __TIME__, get_curr_date_time());
+    }
+
     if (config_file_path[0] == 0)
     {
         fprintf(stderr, "please use '-c' to assign config file\n");
@@ -734,12 +903,12 @@ int main(int argc, char *argv[])
     }
 
     /* test db */
-    ret = db_connect();
+    ret = sink->open();
     if (ret < 0)
     {
-        error(EXIT_FAILURE, errno, "connect db fail: %s", db_error());
+        error(EXIT_FAILURE, errno, "open %s sink fail: %s", sink->name, sink->error());
     }
-    db_close();
+    sink->close();
 
     /* test net */
     ret = create_udp_socket(settings.local_ip, settings.listen_port);
@@ -771,10 +940,10 @@ int main(int argc, char *argv[])
     signal(SIGQUIT, handle_signal);
     signal(SIGCHLD, SIG_IGN);
 
-    ret = db_connect();
+    ret = sink->open();
     if (ret < 0)
     {
-        error(EXIT_FAILURE, 0, "connect db fail: %s", db_error());
+        error(EXIT_FAILURE, 0, "open %s sink fail: %s", sink->name, sink->error());
     }
 
     if (settings.worker_id == 0)
@@ -784,6 +953,15 @@ int main(int argc, char *argv[])
         {
             error(EXIT_FAILURE, errno, "create udp socket fail: %d", ret);
         }
+
+        if (settings.local_socket_path)
+        {
+            ret = create_unix_socket(settings.local_socket_path);
+            if (ret < 0)
+            {
+                error(EXIT_FAILURE, errno, "create unix socket fail: %d", ret);
+            }
+        }
     }
 
     if (settings.worker_id == 0)
@@ -791,7 +969,8 @@ int main(int argc, char *argv[])
         printf("%s start[%d]\n", basepath(argv[0]), getpid());
         log_vip("receiver start[%d]", getpid());
 
-        do_receiver_job();
+        if (do_receiver_job() < 0)
+            return EXIT_FAILURE;
     }
     else
     {
@@ -8,11 +8,17 @@
 # include <netinet/in.h>
 # include <arpa/inet.h>
 # include <sys/socket.h>
+# include <sys/un.h>
 # include <sys/select.h>
 # include <sys/time.h>
 # include <unistd.h>
 
 static int udp_socket_fd;
+static int unix_socket_fd = -1;
+static int unix_socket_paused;
+
+static int notify_fd = -1;
+static void (*notify_cb)(int fd);
 
 int create_udp_socket(const char *local_ip, uint16_t listen_port)
 {
@@ -48,7 +54,41 @@ int close_udp_socket(void)
     return close(udp_socket_fd);
 }
 
-int recv_udp_pkg(struct sockaddr_in *client_addr, void *pkg, size_t nbytes, int *pkg_len)
+int create_unix_socket(const char *path)
+{
+    struct sockaddr_un addr;
+    bzero(&addr, sizeof(addr));
+
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -__LINE__;
+    strcpy(addr.sun_path, path);
+
+    unix_socket_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (unix_socket_fd < 0)
+        return -__LINE__;
+
+    unlink(path);
+
+    if (bind(unix_socket_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+void pause_unix_socket(int paused)
+{
+    unix_socket_paused = paused;
+}
+
+void set_notify_fd(int fd, void (*on_ready)(int fd))
+{
+    notify_fd = fd;
+    notify_cb = on_ready;
+}
+
+int recv_udp_pkg_timeout(struct sockaddr_in *client_addr, void *pkg, size_t nbytes, \
+        int *pkg_len, int timeout_in_ms)
 {
     fd_set rset;
     struct timeval timeout;
@@ -56,11 +96,25 @@ int recv_udp_pkg(struct sockaddr_in *client_addr, void *pkg, size_t nbytes, int
     FD_ZERO(&rset);
     FD_SET(udp_socket_fd, &rset);
 
-    timeout.tv_sec = 0;
-    timeout.tv_usec = 100 * 1000;
+    int max_fd = udp_socket_fd;
+    if (unix_socket_fd >= 0 && !unix_socket_paused)
+    {
+        FD_SET(unix_socket_fd, &rset);
+        if (unix_socket_fd > max_fd)
+            max_fd = unix_socket_fd;
+    }
+    if (notify_fd >= 0)
+    {
+        FD_SET(notify_fd, &rset);
+        if (notify_fd > max_fd)
+            max_fd = notify_fd;
+    }
+
+    timeout.tv_sec = timeout_in_ms / 1000;
+    timeout.tv_usec = (timeout_in_ms % 1000) * 1000;
 
     int ret;
-    ret = select(udp_socket_fd + 1, &rset, NULL, NULL, &timeout);
+    ret = select(max_fd + 1, &rset, NULL, NULL, &timeout);
     if (ret < 0)
     {
         if (errno == EINTR) /* Interrupted by a signal */
@@ -72,7 +126,16 @@ int recv_udp_pkg(struct sockaddr_in *client_addr, void *pkg, size_t nbytes, int
     {
         return -1; /* time out */
     }
-    else
+
+    /* call it whatever else is ready, a busy socket never starve it */
+    if (notify_fd >= 0 && FD_ISSET(notify_fd, &rset))
+    {
+        notify_cb(notify_fd);
+        if (--ret == 0)
+            return -1;
+    }
+
+    if (FD_ISSET(udp_socket_fd, &rset))
     {
         socklen_t addr_len = sizeof(*client_addr);
         *pkg_len = recvfrom(udp_socket_fd, pkg, nbytes, 0, \
@@ -80,10 +143,27 @@ int recv_udp_pkg(struct sockaddr_in *client_addr, void *pkg, size_t nbytes, int
         if (*pkg_len < 0)
             return -__LINE__;
     }
+    else
+    {
+        *pkg_len = recv(unix_socket_fd, pkg, nbytes, 0);
+        if (*pkg_len < 0)
+            return -__LINE__;
+
+        bzero(client_addr, sizeof(*client_addr));
+        client_addr->sin_family = AF_INET;
+        client_addr->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        return 1;
+    }
 
     return 0;
 }
 
+int recv_udp_pkg(struct sockaddr_in *client_addr, void *pkg, size_t nbytes, int *pkg_len)
+{
+    return recv_udp_pkg_timeout(client_addr, pkg, nbytes, pkg_len, 100);
+}
+
 int send_udp_pkg(void *pkg, size_t len, struct sockaddr_in *addr)
 {
     return sendto(udp_socket_fd, pkg, len, 0, (struct sockaddr *)addr, sizeof(*addr));
@@ -10,7 +10,20 @@
 int create_udp_socket(const char *local_ip, uint16_t listen_port);
 int close_udp_socket(void);
 
+/* local client can send pkg to a unix datagram socket, which is also
+ * read by recv_udp_pkg, and return 1 for pkg from it */
+int create_unix_socket(const char *path);
+
+/* stop read unix socket while paused, its writers then block or get EAGAIN */
+void pause_unix_socket(int paused);
+
+/* fd is selected with the sockets, on_ready is called when it is readable,
+ * recv_udp_pkg return -1 if no pkg is ready at the same time */
+void set_notify_fd(int fd, void (*on_ready)(int fd));
+
 int recv_udp_pkg(struct sockaddr_in *client_addr, void *pkg, size_t nbytes, int *pkg_len);
+int recv_udp_pkg_timeout(struct sockaddr_in *client_addr, void *pkg, size_t nbytes, \
+        int *pkg_len, int timeout_in_ms);
 
 int send_udp_pkg(void *pkg, size_t len, struct sockaddr_in *addr);
 
@@ -13,14 +13,28 @@ enum
     RESULT_OK,
     RESULT_PKG_FMT_ERROR,
     RESULT_INTERNAL_ERROR,
+    RESULT_BUSY,            /* over rate limit, client should back off */
 };
 
 enum
 {
     COMMAND_LOG,
     COMMAND_SQL,
+    COMMAND_LOG_BATCH,
 };
 
+/*
+ * COMMAND_LOG_BATCH body: uint16 record num, then every record is a
+ * uint16 length and a packed log. The reply body is uint16 record num
+ * and a bitmap, bit i (byte i / 8, bit i % 8) set means record i success,
+ * head result is RESULT_OK only if all records success.
+ *
+ * When worker queues are busy, receiver append a uint16 retry after in ms
+ * to the end of reply body: after the bitmap for batch, or as the whole
+ * body for others. Over the high water the pkg is rejected with RESULT_BUSY.
+ */
+# define BATCH_BITMAP_LEN(n) (((n) + 7) / 8)
+
 struct protocol_head
 {
     uint8_t  result;
@@ -42,3 +56,8 @@ struct inner_addr
 };
 # pragma pack()
 
+/* loginf add client addr as echo when forward a pkg, so a client pkg must
+ * leave room for it under the max udp payload */
+# define PROTOCOL_HEAD_LEN              8       /* without echo */
+# define PROTOCOL_PKG_MAX_LEN           65507
+# define PROTOCOL_CLIENT_PKG_MAX_LEN    (PROTOCOL_PKG_MAX_LEN - sizeof(struct inner_addr))
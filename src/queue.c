@@ -2,6 +2,8 @@
  * Description: A variable length circular queue, support single process or
  *              thread write and single process or thread read.
  *              Support use file as storage.
+ *              Multi writer variant reserve space by atomic op, and
+ *              every record has a commit flag.
  *     History: damonyang@tencent.com, 2013/06/08, create
  */
 
@@ -18,13 +20,27 @@
 # include <limits.h>
 # include <errno.h>
 # include <sys/types.h>
+# include <unistd.h>
 # include <sys/ipc.h>
 # include <sys/shm.h>
+# include <sys/time.h>
+# include <sys/syscall.h>
+# include <linux/futex.h>
 
 # include "queue.h"
 
 # define MAGIC_NUM 20130610
 
+/* max and min spin times of reader before sleep in queue_wait */
+# define QUEUE_SPIN_MAX 4096
+# define QUEUE_SPIN_MIN 16
+
+# if defined(__i386__) || defined(__x86_64__)
+# define cpu_relax() __asm__ __volatile__ ("pause")
+# else
+# define cpu_relax() __sync_synchronize()
+# endif
+
 # pragma pack(1)
 
 struct queue_head
@@ -44,10 +60,40 @@ struct queue_head
     uint64_t file_start;
     uint64_t file_end;
     uint32_t file_num;
+
+    /*
+     * reader set waiting before sleep on futex notify, writer only
+     * wake up reader when waiting is set, so most push need no syscall.
+     * notify must be 4 bytes aligned for futex, offset is 704.
+     */
+    uint32_t waiting;
+    uint32_t notify;
+
+    /*
+     * for multi writer queue, mp_reserve and mp_read is the total bytes
+     * reserved by writers and consumed by reader, offset is 720 and 728,
+     * so memory after head is 8 bytes aligned.
+     */
+    uint32_t flags;
+    uint32_t file_lock;
+    uint32_t pad;
+    uint64_t mp_reserve;
+    uint64_t mp_read;
+};
+
+/* every record in multi writer queue start with a mp_record, 8 bytes aligned */
+struct mp_record
+{
+    uint32_t size;
+    uint32_t commit;
 };
 
 # pragma pack()
 
+# define QUEUE_MULTI_WRITER 0x1
+
+# define MP_ALIGN(x) (((x) + 7) & ~((uint64_t)7))
+
 static void *__get_shm(key_t key, size_t size, int flag)
 {
     int shm_id = shmget(key, size, flag);
@@ -72,12 +118,19 @@ static int get_shm(key_t key, size_t size, void **addr)
     return -1;
 }
 
-int queue_init(queue_t *queue, char *name, key_t shm_key,
-        uint32_t mem_size, char *reserve_file, uint64_t file_max_size)
+static int __queue_init(queue_t *queue, char *name, key_t shm_key,
+        uint32_t mem_size, char *reserve_file, uint64_t file_max_size, uint32_t flags)
 {
     if (!queue || !mem_size)
         return -2;
 
+    if (flags & QUEUE_MULTI_WRITER)
+    {
+        mem_size &= ~((uint32_t)7);
+        if (mem_size < sizeof(struct mp_record))
+            return -2;
+    }
+
     size_t __mem_size = sizeof(struct queue_head) + mem_size;
     void *memory = NULL;
     bool old_shm = false;
@@ -112,6 +165,7 @@ int queue_init(queue_t *queue, char *name, key_t shm_key,
 
         head->shm_key  = shm_key;
         head->mem_size = mem_size;
+        head->flags    = flags;
 
         if (reserve_file)
         {
@@ -129,14 +183,116 @@ int queue_init(queue_t *queue, char *name, key_t shm_key,
     {
         if (name && strcmp((char *)head->name, name) != 0)
             return -5;
+
+        if (head->flags != flags)
+            return -6;
     }
 
     memset(queue, 0, sizeof(*queue));
     queue->memory = memory;
+    queue->spin   = QUEUE_SPIN_MIN;
 
     return 0;
 }
 
+int queue_init(queue_t *queue, char *name, key_t shm_key,
+        uint32_t mem_size, char *reserve_file, uint64_t file_max_size)
+{
+    return __queue_init(queue, name, shm_key, mem_size, reserve_file, file_max_size, 0);
+}
+
+int queue_init_mp(queue_t *queue, char *name, key_t shm_key,
+        uint32_t mem_size, char *reserve_file, uint64_t file_max_size)
+{
+    return __queue_init(queue, name, shm_key, mem_size, reserve_file, \
+            file_max_size, QUEUE_MULTI_WRITER);
+}
+
+int queue_attach(queue_t *queue, char *name, key_t shm_key)
+{
+    if (!queue || !shm_key)
+        return -2;
+
+    void *memory = __get_shm(shm_key, 0, 0666);
+    if (memory == NULL)
+        return -1;
+
+    volatile struct queue_head *head = memory;
+    if (head->magic != MAGIC_NUM || (name && strcmp((char *)head->name, name) != 0))
+    {
+        shmdt(memory);
+
+        return -3;
+    }
+
+    memset(queue, 0, sizeof(*queue));
+    queue->memory = memory;
+    queue->spin   = QUEUE_SPIN_MIN;
+
+    return 0;
+}
+
+static void file_lock(queue_t *queue)
+{
+    volatile struct queue_head *head = queue->memory;
+
+    if (!(head->flags & QUEUE_MULTI_WRITER))
+        return;
+
+    while (__sync_lock_test_and_set(&head->file_lock, 1))
+    {
+        while (head->file_lock)
+            cpu_relax();
+    }
+}
+
+static void file_unlock(queue_t *queue)
+{
+    volatile struct queue_head *head = queue->memory;
+
+    if (!(head->flags & QUEUE_MULTI_WRITER))
+        return;
+
+    __sync_lock_release(&head->file_lock);
+}
+
+/* return true if there is data can be pop */
+static bool is_readable(queue_t *queue)
+{
+    volatile struct queue_head *head = queue->memory;
+
+    if (head->file_num)
+        return true;
+
+    if (head->flags & QUEUE_MULTI_WRITER)
+    {
+        if (head->mp_reserve == head->mp_read)
+            return false;
+
+        volatile struct mp_record *rec = queue->memory + \
+            sizeof(struct queue_head) + head->mp_read % head->mem_size;
+
+        return rec->commit != 0;
+    }
+
+    return head->mem_num != 0;
+}
+
+static void wake_reader(queue_t *queue)
+{
+    volatile struct queue_head *head = queue->memory;
+
+    /*
+     * mem_num and file_num is update by atomic op, which is a full barrier,
+     * multi writer queue call __sync_synchronize after set commit flag.
+     */
+    if (head->waiting)
+    {
+        __sync_fetch_and_add(&head->notify, 1);
+        syscall(SYS_futex, (uint32_t *)&head->notify, FUTEX_WAKE, 1, NULL, NULL, 0);
+    }
+}
+
 static int write_file(queue_t *queue, void *data, uint32_t size)
 {
     volatile struct queue_head *head = queue->memory;
@@ -203,32 +359,117 @@ static void putmem(queue_t *queue, uint32_t *p_tail, void *data, uint32_t size)
     }
 }
 
-int queue_push(queue_t *queue, void *data, uint32_t size)
+static int push_file(queue_t *queue, void *data, uint32_t size)
 {
-    if (!queue || !data)
-        return -2;
+    volatile struct queue_head *head = queue->memory;
+
+    if (head->file[0] == 0)
+        return -1;
+
+    file_lock(queue);
+    int ret = write_file(queue, data, size);
+    file_unlock(queue);
+
+    if (ret == 0)
+        wake_reader(queue);
+
+    return ret;
+}
 
+static void clear_file(queue_t *queue)
+{
     volatile struct queue_head *head = queue->memory;
-    assert(head->magic == MAGIC_NUM);
 
-    if ((head->mem_size - head->mem_use) < (sizeof(size) + size))
+    if (head->file[0] && head->file_end && head->file_num == 0)
     {
-        if (head->file[0])
+        file_lock(queue);
+
+        if (head->file_end && head->file_num == 0)
         {
-            return write_file(queue, data, size);
+            remove((char *)head->file);
+
+            head->file_start = 0;
+            head->file_end   = 0;
         }
 
-        return -1;
+        file_unlock(queue);
     }
+}
 
-    if (head->file[0] && head->file_end && head->file_num == 0)
+static void zeromem(queue_t *queue, uint32_t p_head, uint32_t size)
+{
+    volatile struct queue_head *head = queue->memory;
+    void *buf = queue->memory + sizeof(struct queue_head);
+
+    uint32_t tail_left = head->mem_size - p_head;
+
+    if (tail_left < size)
     {
-        remove((char *)head->file);
+        memset(buf + p_head, 0, tail_left);
+        memset(buf, 0, size - tail_left);
+    }
+    else
+    {
+        memset(buf + p_head, 0, size);
+    }
+}
 
-        head->file_start = 0;
-        head->file_end   = 0;
+static int mp_push(queue_t *queue, void *data, uint32_t size)
+{
+    volatile struct queue_head *head = queue->memory;
+    uint64_t need = MP_ALIGN(sizeof(struct mp_record) + (uint64_t)size);
+    uint64_t pos;
+
+    while (true)
+    {
+        pos = head->mp_reserve;
+        if (pos + need - head->mp_read > head->mem_size)
+            return push_file(queue, data, size);
+
+        if (__sync_bool_compare_and_swap(&head->mp_reserve, pos, pos + need))
+            break;
     }
 
+    clear_file(queue);
+
+    __sync_fetch_and_add(&head->mem_use, (uint32_t)need);
+    __sync_fetch_and_add(&head->mem_num, 1);
+
+    /* pos is 8 bytes aligned, and mem_size is times of 8, record head never wrap */
+    uint32_t p_tail = pos % head->mem_size;
+    volatile struct mp_record *rec = queue->memory + sizeof(struct queue_head) + p_tail;
+
+    rec->size = size;
+    p_tail += sizeof(struct mp_record);
+    if (p_tail == head->mem_size)
+        p_tail = 0;
+    putmem(queue, &p_tail, data, size);
+
+    __sync_synchronize();
+    rec->commit = 1;
+    __sync_synchronize();
+
+    wake_reader(queue);
+
+    return 0;
+}
+
+int queue_push(queue_t *queue, void *data, uint32_t size)
+{
+    if (!queue || !data)
+        return -2;
+
+    volatile struct queue_head *head = queue->memory;
+    assert(head->magic == MAGIC_NUM);
+
+    if (head->flags & QUEUE_MULTI_WRITER)
+        return mp_push(queue, data, size);
+
+    if ((head->mem_size - head->mem_use) < (sizeof(size) + size))
+        return push_file(queue, data, size);
+
+    clear_file(queue);
+
     uint32_t p_tail = head->p_tail;
 
     putmem(queue, &p_tail, &size, sizeof(size));
@@ -239,6 +480,8 @@ int queue_push(queue_t *queue, void *data, uint32_t size)
     __sync_fetch_and_add(&head->mem_use, sizeof(size) + size);
     __sync_fetch_and_add(&head->mem_num, 1);
 
+    wake_reader(queue);
+
     return 0;
 }
 
@@ -360,6 +603,65 @@ static int check_mem(queue_t *queue, size_t size)
     return 0;
 }
 
+static int pop_file(queue_t *queue, void **data, uint32_t *size)
+{
+    volatile struct queue_head *head = queue->memory;
+
+    if (head->file[0] && head->file_num)
+    {
+        int ret = read_file(queue, data, size);
+        if (ret < 0)
+            return -5 + ret;
+        else
+            return 0;
+    }
+
+    return -1;
+}
+
+static int mp_pop(queue_t *queue, void **data, uint32_t *size)
+{
+    volatile struct queue_head *head = queue->memory;
+
+    uint64_t pos = head->mp_read;
+    if (pos == head->mp_reserve)
+        return pop_file(queue, data, size);
+
+    uint32_t p_head = pos % head->mem_size;
+    volatile struct mp_record *rec = queue->memory + sizeof(struct queue_head) + p_head;
+
+    /* writer has reserved but not commit yet */
+    if (rec->commit == 0)
+        return pop_file(queue, data, size);
+    __sync_synchronize();
+
+    uint32_t __size = rec->size;
+    uint64_t need = MP_ALIGN(sizeof(struct mp_record) + (uint64_t)__size);
+    if (need > head->mem_size)
+        return -4;
+
+    *data = alloc_read_buf(queue, __size);
+    if (*data == NULL)
+        return -3;
+    *size = __size;
+
+    uint32_t p_data = p_head + sizeof(struct mp_record);
+    if (p_data == head->mem_size)
+        p_data = 0;
+    getmem(queue, &p_data, *data, __size);
+
+    /* clear the whole record, so writer can find the new commit flag */
+    zeromem(queue, p_head, (uint32_t)need);
+    __sync_synchronize();
+
+    head->mp_read = pos + need;
+
+    __sync_fetch_and_sub(&head->mem_use, (uint32_t)need);
+    __sync_fetch_and_sub(&head->mem_num, 1);
+
+    return 0;
+}
+
 int queue_pop(queue_t *queue, void **data, uint32_t *size)
 {
     if (!queue || !data || !size)
@@ -368,19 +670,11 @@ int queue_pop(queue_t *queue, void **data, uint32_t *size)
     volatile struct queue_head *head = queue->memory;
     assert(head->magic == MAGIC_NUM);
 
-    if (head->mem_num == 0)
-    {
-        if (head->file[0] && head->file_num)
-        {
-            int ret = read_file(queue, data, size);
-            if (ret < 0)
-                return -5 + ret;
-            else
-                return 0;
-        }
+    if (head->flags & QUEUE_MULTI_WRITER)
+        return mp_pop(queue, data, size);
 
-        return -1;
-    }
+    if (head->mem_num == 0)
+        return pop_file(queue, data, size);
 
     uint32_t __size = 0;
     uint32_t p_head = head->p_head;
@@ -428,6 +722,57 @@ uint64_t queue_num(queue_t *queue)
     return head->mem_num + head->file_num;
 }
 
+int queue_wait(queue_t *queue, int timeout_in_ms)
+{
+    if (!queue)
+        return -2;
+
+    volatile struct queue_head *head = queue->memory;
+    assert(head->magic == MAGIC_NUM);
+
+    /* spin a while first, adjust spin times by whether last spin success */
+    int i;
+    for (i = 0; i < queue->spin; ++i)
+    {
+        if (is_readable(queue))
+        {
+            if (queue->spin < QUEUE_SPIN_MAX)
+                queue->spin *= 2;
+
+            return 0;
+        }
+
+        cpu_relax();
+    }
+
+    if (queue->spin > QUEUE_SPIN_MIN)
+        queue->spin /= 2;
+
+    uint32_t notify = head->notify;
+    head->waiting = 1;
+    __sync_synchronize();
+
+    if (is_readable(queue))
+    {
+        head->waiting = 0;
+
+        return 0;
+    }
+
+    struct timespec timeout;
+    timeout.tv_sec  = timeout_in_ms / 1000;
+    timeout.tv_nsec = (timeout_in_ms % 1000) * 1000 * 1000;
+
+    syscall(SYS_futex, (uint32_t *)&head->notify, FUTEX_WAIT, notify, &timeout, NULL, 0);
+
+    head->waiting = 0;
+
+    if (is_readable(queue))
+        return 0;
+
+    return -1;
+}
+
 int queue_stat(queue_t *queue, \
         uint32_t *mem_num, uint32_t *mem_size, uint32_t *file_num, uint64_t *file_size)
 {
@@ -2,6 +2,7 @@
  * Description: A variable length circular queue, support single process or
  *              thread write and single process or thread read.
  *              Support use file as storage.
+ *              Use queue_init_mp to support multi process or thread write.
  *     History: damonyang@tencent.com, 2013/06/08, create
  */
 
@@ -15,6 +16,7 @@ typedef struct
     void   *memory;
     void   *read_buf;
     size_t read_buf_size;
+    int    spin;
 } queue_t;
 
 /*
@@ -31,6 +33,27 @@ typedef struct
 int queue_init(queue_t *queue, char *name, key_t shm_key,
         uint32_t mem_size, char *reserve_file, uint64_t file_max_size);
 
+/*
+ * same as queue_init, but the queue support multi process or thread
+ * write and single process or thread read. writer reserve memory space
+ * by atomic op, and set a commit flag for every record after copy data.
+ * mem_size is round down to times of 8.
+ *
+ * NOTE: if a writer died between reserve and commit, reader will stop
+ *       at that record, remove the share memory to recover.
+ */
+int queue_init_mp(queue_t *queue, char *name, key_t shm_key,
+        uint32_t mem_size, char *reserve_file, uint64_t file_max_size);
+
+/*
+ * attach a exist share memory queue, don't create it.
+ * return:
+ *      <  -1: error
+ *      == -1: queue not exist
+ *      ==  0: success
+ */
+int queue_attach(queue_t *queue, char *name, key_t shm_key);
+
 /*
  * return:
  *      <  -1: error
@@ -47,6 +70,16 @@ int queue_push(queue_t *queue, void *data, uint32_t size);
  */
 int queue_pop(queue_t *queue, void **data, uint32_t *size);
 
+/*
+ * reader wait until queue is not empty, push only make a syscall to
+ * wake up reader when reader is sleeping in queue_wait.
+ * return:
+ *      <  -1: error
+ *      == -1: time out
+ *      ==  0: queue is not empty
+ */
+int queue_wait(queue_t *queue, int timeout_in_ms);
+
 /* return queue len in byte */
 uint64_t queue_len(queue_t *queue);
 
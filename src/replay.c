@@ -0,0 +1,681 @@
+/*
+ * Description: replay fail logs and queue spill files to the sink
+ *
+ * Input is one of:
+ *     fail insert log or fail enqueue log, lines of "[time] sql;",
+ *         a line not begin with '[' is part of the last statement
+ *     queue spill file, records of native u32 size and sql end with '\0'
+ *     binary fail log, see faillog.c
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <stddef.h>
+# include <inttypes.h>
+# include <errno.h>
+# include <signal.h>
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+# include <sys/wait.h>
+
+# include "conf.h"
+# include "utils.h"
+# include "sink.h"
+# include "faillog.h"
+# include "segment.h"
+# include "replay.h"
+
+extern int shut_down_flag;
+
+# define REPLAY_CKPT_MAGIC      "LDBRPCK"
+# define REPLAY_CKPT_INTERVAL   1000    /* ms */
+# define REPLAY_RETRY_MAX       60
+
+struct replay_ckpt
+{
+    char        magic[8];
+    uint32_t    jobs;
+    uint32_t    reserve;
+    uint64_t    offsets[];  /* next offset of each job */
+};
+
+static char const *data;
+static uint64_t   data_size;
+static int        data_type;
+
+static char       *sql;
+static size_t     sql_len;
+
+/* rows of binary fail log, instead of sql */
+static struct faillog_record rec;
+static bool       is_rows;
+
+/* return 1 at the end, 0 with sql or rows set, negative if bad format */
+static int next_stmt(uint64_t offset, size_t *len, uint64_t *next)
+{
+    if (offset >= data_size)
+        return 1;
+
+    char const *p   = data + offset;
+    char const *end = data + data_size;
+
+    is_rows = false;
+    if (data_type == REPLAY_BINARY)
+    {
+        ssize_t n = faillog_decode(p, end - p, &rec);
+        if (n < 0)
+            return -__LINE__;
+        *next = offset + n;
+
+        if (rec.rows.row_num)
+        {
+            is_rows = true;
+            *len = rec.rows.row_num;
+
+            return 0;
+        }
+
+        if (auto_realloc((void **)&sql, &sql_len, rec.sql_len + 1) == NULL)
+            return -__LINE__;
+        memcpy(sql, rec.sql, rec.sql_len);
+        sql[rec.sql_len] = '\0';
+        *len = rec.sql_len;
+
+        return 0;
+    }
+
+    if (data_type == REPLAY_SPILL)
+    {
+        uint32_t size;
+        if ((uint64_t)(end - p) < sizeof(size))
+            return -__LINE__;
+        memcpy(&size, p, sizeof(size));
+        p += sizeof(size);
+        if ((uint64_t)(end - p) < size)
+            return -__LINE__;
+
+        if (auto_realloc((void **)&sql, &sql_len, size + 1) == NULL)
+            return -__LINE__;
+        memcpy(sql, p, size);
+        sql[size] = '\0';
+        *len = strlen(sql);
+        *next = offset + sizeof(size) + size;
+
+        return 0;
+    }
+
+    /* skip "[time] " */
+    char const *s = NULL;
+    if (*p == '[')
+        s = memchr(p, ']', end - p);
+    if (s == NULL || end - s < 2 || s[1] != ' ')
+        return -__LINE__;
+    s += 2;
+
+    /* a statement end before the next line begin with '[' */
+    char const *e = s;
+    while (true)
+    {
+        e = memchr(e, '\n', end - e);
+        if (e == NULL)
+        {
+            e = end;
+            *next = data_size;
+            break;
+        }
+        if (e + 1 == end || e[1] == '[')
+        {
+            *next = (e + 1) - data;
+            break;
+        }
+        ++e;
+    }
+
+    while (e > s && (e[-1] == '\n' || e[-1] == '\r' || e[-1] == ' ' || e[-1] == ';'))
+        --e;
+
+    size_t n = e - s;
+    if (auto_realloc((void **)&sql, &sql_len, n + 1) == NULL)
+        return -__LINE__;
+    memcpy(sql, s, n);
+    sql[n] = '\0';
+    *len = n;
+
+    return 0;
+}
+
+/*
+ * statements of a table are always replayed by the same job, in order.
+ * table is the first quoted name, as in INSERT INTO `t` or CREATE TABLE `t`
+ */
+static int table_job(char const *name, char const *name_end, int jobs)
+{
+    uint32_t h = 2166136261u;
+    while (name < name_end)
+    {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+
+    return (int)(h % jobs);
+}
+
+static int stmt_job(size_t len, int jobs)
+{
+    if (is_rows)
+        return table_job(rec.rows.table, rec.rows.table + strlen(rec.rows.table), jobs);
+
+    char const *name = memchr(sql, '`', len);
+    if (name == NULL)
+        return 0;
+    ++name;
+
+    char const *name_end = memchr(name, '`', len - (name - sql));
+    if (name_end == NULL)
+        return 0;
+
+    return table_job(name, name_end, jobs);
+}
+
+static uint64_t now_ms(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec * 1000ull + now.tv_usec / 1000;
+}
+
+/* save in the format of input, replay it again after fix */
+static int save_fail(int fd, size_t len, uint64_t offset, uint64_t next)
+{
+    if (data_type == REPLAY_BINARY)
+    {
+        size_t n = next - offset;
+
+        return write(fd, data + offset, n) == (ssize_t)n ? 0 : -__LINE__;
+    }
+
+    char *time_str = get_curr_date_time();
+    size_t n = strlen(time_str) + len + 8;
+    char *line = malloc(n);
+    if (line == NULL)
+        return -__LINE__;
+
+    n = snprintf(line, n, "[%s] %s;\n", time_str, sql);
+    ssize_t ret = write(fd, line, n);
+    free(line);
+
+    return ret == (ssize_t)n ? 0 : -__LINE__;
+}
+
+static int exec_stmt(size_t len, int *rows)
+{
+    int i;
+    for (i = 0; i < REPLAY_RETRY_MAX && !shut_down_flag; ++i)
+    {
+        int ret;
+        if (is_rows)
+            ret = sink_insert_rows(&rec.rows);
+        else if (strncasecmp(sql, "INSERT", 6) == 0)
+            ret = sink_insert(sql, len);
+        else
+            ret = sink_exec(sql, len);
+
+        if (ret >= 0)
+        {
+            *rows = ret;
+
+            return 0;
+        }
+
+        if (ret != -1)
+            return -__LINE__;
+
+        /* connection lost or sink busy */
+        sleep(1);
+        sink->close();
+        sink->open();
+    }
+
+    return -1;
+}
+
+static int do_replay_job(int id, int jobs, unsigned rate, int ckpt_fd, int fail_fd, uint64_t offset)
+{
+    if (sink->open() < 0)
+    {
+        fprintf(stderr, "job %d: open %s sink fail: %s\n", id, sink->name, sink->error());
+
+        return -__LINE__;
+    }
+
+    /* token bucket of this job */
+    double tokens = 0;
+    double job_rate = rate ? (double)rate / jobs : 0;
+    double burst = job_rate > 1 ? job_rate : 1;
+    uint64_t last_fill = now_ms();
+    uint64_t last_ckpt = last_fill;
+
+    uint64_t succ = 0, fail = 0, rows_sum = 0;
+    off_t slot = offsetof(struct replay_ckpt, offsets) + id * sizeof(uint64_t);
+    int ret = 0;
+
+    while (!shut_down_flag)
+    {
+        size_t len = 0;
+        uint64_t next = 0;
+        ret = next_stmt(offset, &len, &next);
+        if (ret < 0)
+            fprintf(stderr, "job %d: bad format at offset: %"PRIu64"\n", id, offset);
+        if (ret)
+            break;
+
+        if (len && stmt_job(len, jobs) == id)
+        {
+            if (job_rate)
+            {
+                while (tokens < 1 && !shut_down_flag)
+                {
+                    uint64_t now = now_ms();
+                    tokens += (now - last_fill) * job_rate / 1000;
+                    last_fill = now;
+                    if (tokens > burst)
+                        tokens = burst;
+                    if (tokens < 1)
+                        usleep(1000);
+                }
+                tokens -= 1;
+            }
+
+            int rows = 0;
+            int r = exec_stmt(len, &rows);
+            if (r == -1 && shut_down_flag)
+                break;
+
+            if (r == -1)
+            {
+                /* stop at the statement, resume from it next time */
+                fprintf(stderr, "job %d: sink not available: %s\n", id, sink->error());
+                ret = -__LINE__;
+
+                break;
+            }
+
+            if (r < 0)
+            {
+                ++fail;
+                if (save_fail(fail_fd, len, offset, next) < 0)
+                {
+                    ret = -__LINE__;
+
+                    break;
+                }
+            }
+            else
+            {
+                ++succ;
+                rows_sum += rows;
+            }
+        }
+
+        offset = next;
+
+        uint64_t now = now_ms();
+        if (now - last_ckpt >= REPLAY_CKPT_INTERVAL)
+        {
+            pwrite(ckpt_fd, &offset, sizeof(offset), slot);
+            last_ckpt = now;
+        }
+    }
+
+    pwrite(ckpt_fd, &offset, sizeof(offset), slot);
+    sink->close();
+
+    printf("job %d: succ: %"PRIu64", rows: %"PRIu64", fail: %"PRIu64", offset: %"PRIu64"/%"PRIu64"\n", \
+            id, succ, rows_sum, fail, offset, data_size);
+
+    return ret < 0 ? ret : 0;
+}
+
+/* return start offset of each job */
+static int load_ckpt(int fd, char const *path, int jobs, uint64_t *offsets)
+{
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return -__LINE__;
+
+    size_t size = sizeof(struct replay_ckpt) + jobs * sizeof(uint64_t);
+    memset(offsets, 0, jobs * sizeof(uint64_t));
+
+    if (st.st_size >= (off_t)sizeof(struct replay_ckpt))
+    {
+        struct replay_ckpt head;
+        if (pread(fd, &head, sizeof(head), 0) != sizeof(head) || \
+                memcmp(head.magic, REPLAY_CKPT_MAGIC, sizeof(head.magic)) != 0)
+        {
+            fprintf(stderr, "bad checkpoint file: %s\n", path);
+
+            return -__LINE__;
+        }
+
+        uint64_t old[head.jobs];
+        if (pread(fd, old, sizeof(old), sizeof(head)) != (ssize_t)sizeof(old))
+        {
+            fprintf(stderr, "bad checkpoint file: %s\n", path);
+
+            return -__LINE__;
+        }
+
+        /* each job skip statements of other jobs, with other jobs a
+         * statement may be behind or after the offset of its new job */
+        uint64_t done = 0;
+        uint32_t i;
+        for (i = 0; i < head.jobs; ++i)
+            done |= old[i];
+
+        if ((uint32_t)jobs != head.jobs && done)
+        {
+            fprintf(stderr, "%s is saved by %u jobs, resume with -j %u, "
+                    "or remove it to replay from the start\n", path, head.jobs, head.jobs);
+
+            return -__LINE__;
+        }
+
+        if ((uint32_t)jobs == head.jobs)
+            memcpy(offsets, old, sizeof(old));
+    }
+
+    char buf[size];
+    struct replay_ckpt *ckpt = (struct replay_ckpt *)buf;
+    memset(buf, 0, size);
+    memcpy(ckpt->magic, REPLAY_CKPT_MAGIC, sizeof(ckpt->magic));
+    ckpt->jobs = jobs;
+    memcpy(ckpt->offsets, offsets, jobs * sizeof(uint64_t));
+
+    if (ftruncate(fd, 0) < 0 || pwrite(fd, buf, size, 0) != (ssize_t)size)
+        return -__LINE__;
+
+    return 0;
+}
+
+static void handle_signal(int signo)
+{
+    shut_down_flag = true;
+}
+
+static char const *type_names[] =
+{
+    [REPLAY_TEXT]   = "text",
+    [REPLAY_SPILL]  = "spill",
+    [REPLAY_BINARY] = "binary",
+};
+
+int replay_type(char const *name)
+{
+    int i;
+    for (i = REPLAY_TEXT; i <= REPLAY_BINARY; ++i)
+    {
+        if (strcmp(name, type_names[i]) == 0)
+            return i;
+    }
+
+    return -__LINE__;
+}
+
+/* the first record is valid in type */
+static bool is_type(int type)
+{
+    data_type = type;
+
+    size_t len;
+    uint64_t next;
+    if (next_stmt(0, &len, &next) != 0)
+        return false;
+
+    if (type == REPLAY_TEXT)
+    {
+        /* "[YYYY-mm-dd HH:MM:SS.uuuuuu] " */
+        return memchr(data, ']', data_size < 32 ? data_size : 32) != NULL;
+    }
+
+    if (type == REPLAY_SPILL)
+    {
+        /* sql end with '\0' */
+        uint32_t size;
+        memcpy(&size, data, sizeof(size));
+
+        return size && data[sizeof(size) + size - 1] == '\0';
+    }
+
+    return true;
+}
+
+static int load_file(char const *path, int type)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -__LINE__;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+        return -__LINE__;
+
+    data_size = st.st_size;
+    if (data_size == 0)
+    {
+        close(fd);
+
+        return 1;
+    }
+
+    data = mmap(NULL, data_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -__LINE__;
+    madvise((void *)data, data_size, MADV_SEQUENTIAL);
+
+    if (type != REPLAY_AUTO)
+    {
+        if (is_type(type))
+            return 0;
+
+        fprintf(stderr, "%s is not a %s file, bad first record\n", path, type_names[type]);
+        munmap((void *)data, data_size);
+
+        return -__LINE__;
+    }
+
+    /* a spill file may begin with '[' too, never guess */
+    int found = 0;
+    int i;
+    for (i = REPLAY_TEXT; i <= REPLAY_BINARY; ++i)
+    {
+        if (is_type(i))
+        {
+            if (found)
+            {
+                fprintf(stderr, "%s may be %s or %s, give it by --replay-type\n", \
+                        path, type_names[found], type_names[i]);
+                munmap((void *)data, data_size);
+
+                return -__LINE__;
+            }
+            found = i;
+        }
+    }
+
+    if (found == 0)
+    {
+        fprintf(stderr, "%s is none of text, spill and binary\n", path);
+        munmap((void *)data, data_size);
+
+        return -__LINE__;
+    }
+    data_type = found;
+
+    return 0;
+}
+
+static char const *type_name(void)
+{
+    switch (data_type)
+    {
+    case REPLAY_TEXT:
+        return "fail log";
+    case REPLAY_BINARY:
+        return "binary fail log";
+    default:
+        return "queue spill file";
+    }
+}
+
+int replay(char const *path, int type, int jobs, unsigned rate)
+{
+    if (jobs <= 0)
+        return -__LINE__;
+
+    int ret = load_file(path, type);
+    if (ret != 0)
+        return ret < 0 ? ret : 0;
+
+    char ckpt_path[PATH_MAX];
+    char fail_path[PATH_MAX];
+    snprintf(ckpt_path, sizeof(ckpt_path), "%s.ckpt", path);
+    snprintf(fail_path, sizeof(fail_path), "%s.fail", path);
+
+    int ckpt_fd = open(ckpt_path, O_RDWR | O_CREAT, 0664);
+    if (ckpt_fd < 0)
+        return -__LINE__;
+
+    int fail_fd = open(fail_path, O_WRONLY | O_APPEND | O_CREAT, 0664);
+    if (fail_fd < 0)
+        return -__LINE__;
+
+    uint64_t offsets[jobs];
+    if (load_ckpt(ckpt_fd, ckpt_path, jobs, offsets) < 0)
+        return -__LINE__;
+
+    printf("replay %s, size: %"PRIu64", %s, jobs: %d, rate: %u/s\n", path, data_size, \
+            type_name(), jobs, rate);
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGQUIT, handle_signal);
+
+    fflush(stdout);
+
+    pid_t pids[jobs];
+    int i;
+    for (i = 0; i < jobs; ++i)
+    {
+        pids[i] = fork();
+        if (pids[i] < 0)
+            return -__LINE__;
+
+        if (pids[i] == 0)
+            exit(do_replay_job(i, jobs, rate, ckpt_fd, fail_fd, offsets[i]) < 0 ? EXIT_FAILURE : 0);
+    }
+
+    for (i = 0; i < jobs; ++i)
+    {
+        int status = 0;
+        while (waitpid(pids[i], &status, 0) < 0 && errno == EINTR)
+            ;
+
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ret = -__LINE__;
+    }
+
+    close(ckpt_fd);
+    close(fail_fd);
+    munmap((void *)data, data_size);
+
+    if (ret == 0 && shut_down_flag)
+    {
+        printf("replay %s interrupted, run again to resume\n", path);
+
+        return 1;
+    }
+
+    return ret;
+}
+
+static bool is_segment(char const *path)
+{
+    char head[16];
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return false;
+
+    size_t n = fread(head, 1, sizeof(head), fp);
+    fclose(fp);
+
+    return segment_is_file(head, n);
+}
+
+/* a segment is printed as one INSERT statement */
+static int render_segment(char const *path)
+{
+    struct sink_rows rows;
+    int ret = segment_load(path, &rows);
+    if (ret < 0)
+    {
+        fprintf(stderr, "bad segment: %s\n", path);
+
+        return ret;
+    }
+
+    if (rows.column_num != sink_column_num())
+    {
+        fprintf(stderr, "segment has %d columns, config has %d\n", rows.column_num, sink_column_num());
+
+        return -__LINE__;
+    }
+
+    if (rows.row_num == 0)
+        return 0;
+
+    char *s;
+    NEG_RET_LN(sink_render_insert(&rows, &s));
+    printf("%s;\n", s);
+
+    return 0;
+}
+
+int render(char const *path, int type)
+{
+    if (type == REPLAY_AUTO && is_segment(path))
+        return render_segment(path);
+
+    int ret = load_file(path, type);
+    if (ret != 0)
+        return ret < 0 ? ret : 0;
+
+    uint64_t offset = 0;
+    while (true)
+    {
+        size_t len = 0;
+        uint64_t next = 0;
+        ret = next_stmt(offset, &len, &next);
+        if (ret < 0)
+            fprintf(stderr, "bad format at offset: %"PRIu64"\n", offset);
+        if (ret)
+            break;
+
+        char *s = sql;
+        if (is_rows && (ret = sink_render_insert(&rec.rows, &s)) < 0)
+            break;
+        if (len)
+            printf("%s;\n", s);
+
+        offset = next;
+    }
+
+    munmap((void *)data, data_size);
+
+    return ret < 0 ? ret : 0;
+}
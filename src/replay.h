@@ -0,0 +1,35 @@
+/*
+ * Description: replay fail logs and queue spill files to the sink
+ */
+
+# pragma once
+
+/*
+ * replay statements in file by jobs processes, statements of the same
+ * table go to the same process. rate is statements per second of all
+ * processes, 0 means no limit. progress is saved in <file>.ckpt, replay
+ * again resume from it with the same jobs. statements fail are write to
+ * <file>.fail. return 1 if interrupted by signal
+ */
+enum
+{
+    REPLAY_AUTO,
+    REPLAY_TEXT,
+    REPLAY_SPILL,
+    REPLAY_BINARY,
+};
+
+/* type of name: text, spill or binary, negative if unknown */
+int replay_type(char const *name);
+
+/*
+ * type is REPLAY_AUTO or the type of file, the first record must be valid
+ * in it. REPLAY_AUTO take the only type the first record is valid in.
+ */
+int replay(char const *path, int type, int jobs, unsigned rate);
+
+/*
+ * print statements in file as sql, one per line end with ';'.
+ * a segment file of segment sink is printed as one INSERT statement
+ */
+int render(char const *path, int type);
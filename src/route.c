@@ -0,0 +1,345 @@
+/*
+ * Description: receivers of loginf, pick one for each pkg by consistent
+ *              hash of client, or by least outstanding pkg, and skip the
+ *              ones which are busy or stop replying
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <stdbool.h>
+# include <string.h>
+# include <strings.h>
+# include <arpa/inet.h>
+# include <sys/time.h>
+
+# include "utils.h"
+# include "dlog.h"
+# include "route.h"
+
+/* points of a receiver on the hash ring */
+# define ROUTE_VNODE_NUM    160
+/* time out in a row to mark a receiver down */
+# define ROUTE_FAIL_MAX     3
+/* a down receiver get pkg again after it, in us */
+# define ROUTE_DOWN_TIME    (1000 * 1000)
+
+struct vnode
+{
+    uint32_t            hash;
+    int                 receiver;
+};
+
+static struct receiver  *receivers;
+static int              receiver_num;
+static struct vnode     *ring;
+static int              ring_num;
+static int              route_by;
+
+static uint64_t get_now_us(void)
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return now.tv_sec * 1000000ull + now.tv_usec;
+}
+
+static uint32_t fnv_hash(void const *data, size_t len)
+{
+    uint32_t h = 2166136261u;
+    unsigned char const *p = data;
+
+    size_t i;
+    for (i = 0; i < len; ++i)
+    {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+
+    /* fnv spread the last bytes poorly, mix them */
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+
+    return h;
+}
+
+static int parse_receivers(char *str, uint32_t time_out)
+{
+    int num = 1;
+    char *c;
+    for (c = str; *c; ++c)
+    {
+        if (*c == ',')
+            ++num;
+    }
+
+    receivers = calloc(num, sizeof(struct receiver));
+    if (receivers == NULL)
+        return -__LINE__;
+
+    char *save = NULL;
+    char *item = strtok_r(str, ",", &save);
+    while (item)
+    {
+        char endpoint[64] = { 0 };
+        unsigned item_time_out = time_out;
+
+        int n = sscanf(item, "%63s %u", endpoint, &item_time_out);
+        if (n < 1)
+        {
+            fprintf(stderr, "invalid receiver: %s\n", item);
+
+            return -__LINE__;
+        }
+
+        char *colon = strchr(endpoint, ':');
+        if (colon == NULL)
+        {
+            fprintf(stderr, "invalid receiver, port is required: %s\n", item);
+
+            return -__LINE__;
+        }
+        *colon = 0;
+
+        struct receiver *r = &receivers[receiver_num];
+        r->addr.sin_family = AF_INET;
+        r->addr.sin_port = htons((uint16_t)atoi(colon + 1));
+        if (inet_aton(endpoint, &r->addr.sin_addr) == 0 || r->addr.sin_port == 0)
+        {
+            fprintf(stderr, "invalid receiver: %s\n", item);
+
+            return -__LINE__;
+        }
+
+        r->time_out = item_time_out;
+        ++receiver_num;
+
+        item = strtok_r(NULL, ",", &save);
+    }
+
+    if (receiver_num == 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+static int vnode_cmp(const void *a, const void *b)
+{
+    uint32_t x = ((struct vnode *)a)->hash;
+    uint32_t y = ((struct vnode *)b)->hash;
+
+    return x < y ? -1 : x > y;
+}
+
+static int build_ring(void)
+{
+    ring = calloc(receiver_num * ROUTE_VNODE_NUM, sizeof(struct vnode));
+    if (ring == NULL)
+        return -__LINE__;
+
+    int i, j;
+    for (i = 0; i < receiver_num; ++i)
+    {
+        for (j = 0; j < ROUTE_VNODE_NUM; ++j)
+        {
+            struct
+            {
+                uint32_t ip;
+                uint16_t port;
+                uint16_t index;
+            } key = { receivers[i].addr.sin_addr.s_addr, receivers[i].addr.sin_port, j };
+
+            ring[ring_num].hash = fnv_hash(&key, sizeof(key));
+            ring[ring_num].receiver = i;
+            ++ring_num;
+        }
+    }
+
+    qsort(ring, ring_num, sizeof(struct vnode), vnode_cmp);
+
+    return 0;
+}
+
+int route_init(char *str, char const *route, uint32_t time_out)
+{
+    if (route == NULL || strcasecmp(route, "ip") == 0)
+        route_by = ROUTE_BY_IP;
+    else if (strcasecmp(route, "addr") == 0)
+        route_by = ROUTE_BY_ADDR;
+    else if (strcasecmp(route, "outstanding") == 0)
+        route_by = ROUTE_BY_OUTSTANDING;
+    else
+        return -__LINE__;
+
+    NEG_RET_LN(parse_receivers(str, time_out));
+    NEG_RET_LN(build_ring());
+
+    return 0;
+}
+
+int route_num(void)
+{
+    return receiver_num;
+}
+
+struct receiver *route_get(int i)
+{
+    if (i < 0 || i >= receiver_num)
+        return NULL;
+
+    return &receivers[i];
+}
+
+struct receiver *route_find(struct sockaddr_in *addr)
+{
+    int i;
+    for (i = 0; i < receiver_num; ++i)
+    {
+        if (receivers[i].addr.sin_port == addr->sin_port && \
+                receivers[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr)
+            return &receivers[i];
+    }
+
+    return NULL;
+}
+
+static bool is_available(struct receiver *r, uint64_t now)
+{
+    return now >= __atomic_load_n(&r->busy_until, __ATOMIC_RELAXED) && \
+        now >= __atomic_load_n(&r->down_until, __ATOMIC_RELAXED);
+}
+
+bool route_is_available(void)
+{
+    uint64_t now = get_now_us();
+
+    int i;
+    for (i = 0; i < receiver_num; ++i)
+    {
+        if (is_available(&receivers[i], now))
+            return true;
+    }
+
+    return false;
+}
+
+static struct receiver *pick_least_outstanding(uint64_t now)
+{
+    /* start from a different one each time, spread ties */
+    static int start;
+    start = (start + 1) % receiver_num;
+
+    struct receiver *best = NULL;
+    int i;
+    for (i = 0; i < receiver_num; ++i)
+    {
+        struct receiver *r = &receivers[(start + i) % receiver_num];
+        if (!is_available(r, now))
+            continue;
+
+        if (best == NULL || __atomic_load_n(&r->outstanding, __ATOMIC_RELAXED) < \
+                __atomic_load_n(&best->outstanding, __ATOMIC_RELAXED))
+            best = r;
+    }
+
+    return best;
+}
+
+/* the first point not less than hash, then the next available one */
+static struct receiver *pick_by_hash(uint32_t hash, uint64_t now)
+{
+    int low = 0, high = ring_num;
+    while (low < high)
+    {
+        int mid = (low + high) / 2;
+        if (ring[mid].hash < hash)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    int i;
+    for (i = 0; i < ring_num; ++i)
+    {
+        struct receiver *r = &receivers[ring[(low + i) % ring_num].receiver];
+        if (is_available(r, now))
+            return r;
+    }
+
+    return NULL;
+}
+
+struct receiver *route_pick(struct sockaddr_in *client_addr)
+{
+    uint64_t now = get_now_us();
+
+    if (receiver_num == 1)
+        return is_available(&receivers[0], now) ? &receivers[0] : NULL;
+
+    switch (route_by)
+    {
+    case ROUTE_BY_ADDR:
+    {
+        struct
+        {
+            uint32_t ip;
+            uint32_t port;
+        } key = { client_addr->sin_addr.s_addr, client_addr->sin_port };
+
+        return pick_by_hash(fnv_hash(&key, sizeof(key)), now);
+    }
+    case ROUTE_BY_OUTSTANDING:
+        return pick_least_outstanding(now);
+    default:
+        return pick_by_hash(fnv_hash(&client_addr->sin_addr.s_addr, \
+                    sizeof(client_addr->sin_addr.s_addr)), now);
+    }
+}
+
+struct receiver *route_pick_resend(struct sockaddr_in *client_addr, int last)
+{
+    struct receiver *r = route_get(last);
+    if (r && is_available(r, get_now_us()))
+        return r;
+
+    return route_pick(client_addr);
+}
+
+void route_sent(struct receiver *r)
+{
+    __atomic_add_fetch(&r->outstanding, 1, __ATOMIC_RELAXED);
+}
+
+void route_replied(struct receiver *r)
+{
+    __atomic_sub_fetch(&r->outstanding, 1, __ATOMIC_RELAXED);
+
+    if (__atomic_exchange_n(&r->fail, 0, __ATOMIC_RELAXED) >= ROUTE_FAIL_MAX)
+    {
+        log_info("receiver %s is up", addrtostr(&r->addr));
+    }
+
+    __atomic_store_n(&r->down_until, 0, __ATOMIC_RELAXED);
+}
+
+void route_time_out(struct receiver *r)
+{
+    __atomic_sub_fetch(&r->outstanding, 1, __ATOMIC_RELAXED);
+
+    int fail = __atomic_add_fetch(&r->fail, 1, __ATOMIC_RELAXED);
+    if (fail < ROUTE_FAIL_MAX)
+        return;
+
+    if (fail == ROUTE_FAIL_MAX)
+    {
+        log_warn("receiver %s is down", addrtostr(&r->addr));
+    }
+
+    __atomic_store_n(&r->down_until, get_now_us() + ROUTE_DOWN_TIME, __ATOMIC_RELAXED);
+}
+
+void route_busy(struct receiver *r, uint32_t ms)
+{
+    __atomic_store_n(&r->busy_until, get_now_us() + ms * 1000ull, __ATOMIC_RELAXED);
+}
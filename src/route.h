@@ -0,0 +1,65 @@
+/*
+ * Description: receivers of loginf, pick one for each pkg by consistent
+ *              hash of client, or by least outstanding pkg, and skip the
+ *              ones which are busy or stop replying
+ */
+
+# pragma once
+
+# include <stdint.h>
+# include <stdbool.h>
+# include <netinet/in.h>
+
+struct receiver
+{
+    struct sockaddr_in  addr;
+    uint32_t            time_out;       /* in ms */
+
+    /* updated by forward and ack thread */
+    int                 outstanding;    /* pkg wait for reply */
+    int                 fail;           /* time out in a row */
+    uint64_t            down_until;     /* in us */
+    uint64_t            busy_until;     /* in us */
+};
+
+enum
+{
+    ROUTE_BY_IP,            /* consistent hash of client ip */
+    ROUTE_BY_ADDR,          /* consistent hash of client ip and port */
+    ROUTE_BY_OUTSTANDING,   /* least outstanding pkg */
+};
+
+/*
+ * receivers: "ip:port [time out in ms], ...", time_out is the default.
+ * route: ip, addr or outstanding
+ */
+int route_init(char *receivers, char const *route, uint32_t time_out);
+
+int route_num(void);
+
+struct receiver *route_get(int i);
+
+/* the receiver has addr, NULL if none */
+struct receiver *route_find(struct sockaddr_in *addr);
+
+/* receiver for pkg from client, NULL if all are busy or down */
+struct receiver *route_pick(struct sockaddr_in *client_addr);
+
+/* receiver last is the one pkg was sent to, keep it while it is available,
+ * so it find the duplicate by sequence, else as route_pick */
+struct receiver *route_pick_resend(struct sockaddr_in *client_addr, int last);
+
+/* true if any receiver can take pkg now */
+bool route_is_available(void);
+
+void route_sent(struct receiver *r);
+
+/* pkg is replied, or rejected as busy */
+void route_replied(struct receiver *r);
+
+/* pkg time out, a receiver fail ROUTE_FAIL_MAX times in a row is down for a while */
+void route_time_out(struct receiver *r);
+
+/* don't send to it in ms */
+void route_busy(struct receiver *r, uint32_t ms);
+
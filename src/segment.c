@@ -0,0 +1,980 @@
+/*
+ * Description: columnar segment store sink
+ *
+ * Every batch is written to a segment file under <segment path>/<table>/,
+ * table name carry the time partition as mysql tables do. Segment layout,
+ * integers in little endian:
+ *
+ *     "LDBSEG1\0" u32 row_num u16 column_num
+ *     column blocks
+ *     footer: for each column
+ *         u8 name_len, name, u8 kind, u8 encoding, u64 offset, u32 length,
+ *         min, max (8 bytes for int and float, u8 len + prefix for string)
+ *     u32 footer_len "LDBSEGF\0"
+ *
+ * Encoding of column block:
+ *     SEG_ENC_DELTA:  zigzag varint of first value, then of each delta
+ *     SEG_ENC_PLAIN:  8 bytes double, or varint length + bytes
+ *     SEG_ENC_DICT:   varint dict num, entries as plain, varint index per row
+ *
+ * Null values (auto increment) are written as 0 or empty.
+ *
+ * segment_load read a segment back to rows, logdb --render print it.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <inttypes.h>
+# include <errno.h>
+# include <unistd.h>
+# include <dirent.h>
+# include <sys/stat.h>
+# include <sys/time.h>
+
+# include "conf.h"
+# include "utils.h"
+# include "sink.h"
+# include "segment.h"
+
+# define SEG_MAGIC          "LDBSEG1"
+# define SEG_FOOTER_MAGIC   "LDBSEGF"
+# define SEG_STR_PREFIX     32
+
+/* use dictionary if distinct values are no more than rows / SEG_DICT_RATIO */
+# define SEG_DICT_RATIO     4
+# define SEG_DICT_MAX       65536
+
+enum
+{
+    SEG_KIND_INT = 1,
+    SEG_KIND_UINT,
+    SEG_KIND_FLOAT,
+    SEG_KIND_STR,
+    SEG_KIND_BIN,
+};
+
+enum
+{
+    SEG_ENC_DELTA = 1,
+    SEG_ENC_PLAIN,
+    SEG_ENC_DICT,
+};
+
+struct seg_buf
+{
+    char                *data;
+    size_t              len;
+    size_t              use;
+};
+
+struct seg_column
+{
+    struct column       *column;
+    int                 kind;
+    int                 encoding;
+    uint64_t            offset;
+    uint32_t            length;
+
+    union { int64_t i; uint64_t u; double f; } min, max;
+    struct sink_value   min_str, max_str;
+};
+
+static struct seg_column    *columns;
+static int                  column_num;
+
+static char                 *curr_table;
+static struct sink_value const **rows;
+static size_t               rows_len;
+static size_t               row_num;
+
+static struct seg_buf       out;
+static int                  last_errno;
+static char                 error_str[256];
+
+static int set_error(int err, char const *what)
+{
+    last_errno = err;
+    snprintf(error_str, sizeof(error_str), "%s: %s", what, strerror(err));
+
+    return -1;
+}
+
+static int buf_put(struct seg_buf *b, void const *p, size_t n)
+{
+    if (auto_realloc((void **)&b->data, &b->len, b->use + n) == NULL)
+        return set_error(ENOMEM, "segment buffer");
+
+    memcpy(b->data + b->use, p, n);
+    b->use += n;
+
+    return 0;
+}
+
+static int buf_put_u64(struct seg_buf *b, uint64_t v, size_t n)
+{
+    uint8_t p[8];
+    size_t i;
+    for (i = 0; i < n; ++i)
+        p[i] = (uint8_t)(v >> (i * 8));
+
+    return buf_put(b, p, n);
+}
+
+static int buf_put_varint(struct seg_buf *b, uint64_t v)
+{
+    uint8_t p[10];
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+
+    return buf_put(b, p, n);
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int seg_kind(struct column *curr)
+{
+    switch (curr->type)
+    {
+    case COLUMN_TYPE_TINY_INT:
+    case COLUMN_TYPE_SMALL_INT:
+    case COLUMN_TYPE_INT:
+    case COLUMN_TYPE_BIG_INT:
+        return curr->is_unsigned ? SEG_KIND_UINT : SEG_KIND_INT;
+    case COLUMN_TYPE_FLOAT:
+    case COLUMN_TYPE_DOUBLE:
+        return SEG_KIND_FLOAT;
+    case COLUMN_TYPE_BINARY:
+    case COLUMN_TYPE_VARBINARY:
+    case COLUMN_TYPE_TINY_BLOB:
+    case COLUMN_TYPE_BLOB:
+        return SEG_KIND_BIN;
+    default:
+        return SEG_KIND_STR;
+    }
+}
+
+static int segment_open(void)
+{
+    if (columns)
+        return 0;
+
+    if (mkdir(settings.segment_path, 0755) < 0 && errno != EEXIST)
+        return set_error(errno, settings.segment_path);
+
+    struct column *curr;
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (curr->is_storage)
+            ++column_num;
+    }
+
+    columns = calloc(column_num, sizeof(*columns));
+    if (columns == NULL)
+        return set_error(ENOMEM, "segment columns");
+
+    int i = 0;
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (curr->is_storage == false)
+            continue;
+
+        columns[i].column = curr;
+        columns[i].kind = seg_kind(curr);
+        ++i;
+    }
+
+    return 0;
+}
+
+static void segment_close(void)
+{
+    free(columns);
+    columns = NULL;
+    column_num = 0;
+}
+
+static char *table_path(char const *table)
+{
+    static char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", settings.segment_path, table);
+
+    return path;
+}
+
+static int segment_create_table(char const *table)
+{
+    char *path = table_path(table);
+    if (mkdir(path, 0755) < 0 && errno != EEXIST)
+        return set_error(errno, path);
+
+    return 0;
+}
+
+/* delete all segments of an expired time partition */
+static int segment_drop_table(char const *table)
+{
+    if (curr_table && strcmp(curr_table, table) == 0)
+    {
+        free(curr_table);
+        curr_table = NULL;
+    }
+
+    char *path = table_path(table);
+    DIR *dir = opendir(path);
+    if (dir == NULL)
+    {
+        if (errno == ENOENT)
+            return 0;
+
+        return set_error(errno, path);
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        char file[PATH_MAX];
+        snprintf(file, sizeof(file), "%s/%s", path, entry->d_name);
+        unlink(file);
+    }
+    closedir(dir);
+
+    if (rmdir(path) < 0)
+        return set_error(errno, path);
+
+    log_info("worker: %d, drop segments: %s", settings.worker_id, path);
+
+    return 0;
+}
+
+static int segment_exec(char const *sql, size_t len)
+{
+    last_errno = EINVAL;
+    snprintf(error_str, sizeof(error_str), "segment sink don't support sql");
+
+    return -__LINE__;
+}
+
+static int segment_begin_batch(char const *table)
+{
+    /* error class is of this batch only */
+    last_errno = 0;
+    error_str[0] = '\0';
+
+    if (curr_table == NULL || strcmp(curr_table, table) != 0)
+    {
+        /* create the partition when the first batch come */
+        NEG_RET_LN(segment_create_table(table));
+
+        free(curr_table);
+        if ((curr_table = strdup(table)) == NULL)
+            return set_error(ENOMEM, table);
+    }
+
+    row_num = 0;
+
+    return 0;
+}
+
+static int segment_append_row(struct sink_value const *values, int num)
+{
+    if (num != column_num)
+        return set_error(EINVAL, "segment row");
+
+    if (row_num == rows_len)
+    {
+        size_t n = rows_len ? rows_len * 2 : 1024;
+        struct sink_value const **new_rows = realloc(rows, n * sizeof(*rows));
+        if (new_rows == NULL)
+            return set_error(ENOMEM, "segment rows");
+        rows = new_rows;
+        rows_len = n;
+    }
+
+    rows[row_num++] = values;
+
+    return 0;
+}
+
+static char const *value_str(struct sink_value const *v, char *buf, size_t n)
+{
+    size_t len = v->len < n ? v->len : n - 1;
+    memcpy(buf, v->str, len);
+    buf[len] = '\0';
+
+    return buf;
+}
+
+static int sink_value_cmp(struct sink_value const *a, struct sink_value const *b)
+{
+    size_t n = a->len < b->len ? a->len : b->len;
+    int ret = memcmp(a->str, b->str, n);
+    if (ret)
+        return ret;
+
+    return (a->len > b->len) - (a->len < b->len);
+}
+
+static int write_int_column(struct seg_column *c, int col)
+{
+    c->encoding = SEG_ENC_DELTA;
+
+    int64_t last = 0;
+    size_t i;
+    for (i = 0; i < row_num; ++i)
+    {
+        struct sink_value const *v = &rows[i][col];
+        char str[32];
+        int64_t x = 0;
+        if (v->type != SINK_VALUE_NULL)
+        {
+            if (c->kind == SEG_KIND_UINT)
+                x = (int64_t)strtoull(value_str(v, str, sizeof(str)), NULL, 10);
+            else
+                x = strtoll(value_str(v, str, sizeof(str)), NULL, 10);
+        }
+
+        if (c->kind == SEG_KIND_UINT)
+        {
+            if (i == 0 || (uint64_t)x < c->min.u)
+                c->min.u = (uint64_t)x;
+            if (i == 0 || (uint64_t)x > c->max.u)
+                c->max.u = (uint64_t)x;
+        }
+        else
+        {
+            if (i == 0 || x < c->min.i)
+                c->min.i = x;
+            if (i == 0 || x > c->max.i)
+                c->max.i = x;
+        }
+
+        NEG_RET_LN(buf_put_varint(&out, zigzag((int64_t)((uint64_t)x - (uint64_t)last))));
+        last = x;
+    }
+
+    return 0;
+}
+
+static int write_float_column(struct seg_column *c, int col)
+{
+    c->encoding = SEG_ENC_PLAIN;
+
+    size_t i;
+    for (i = 0; i < row_num; ++i)
+    {
+        struct sink_value const *v = &rows[i][col];
+        char str[64];
+        double x = 0;
+        if (v->type != SINK_VALUE_NULL)
+            x = strtod(value_str(v, str, sizeof(str)), NULL);
+
+        if (i == 0 || x < c->min.f)
+            c->min.f = x;
+        if (i == 0 || x > c->max.f)
+            c->max.f = x;
+
+        uint64_t bits;
+        memcpy(&bits, &x, sizeof(bits));
+        NEG_RET_LN(buf_put_u64(&out, bits, sizeof(bits)));
+    }
+
+    return 0;
+}
+
+static uint32_t fnv1a(struct sink_value const *v)
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+    for (i = 0; i < v->len; ++i)
+    {
+        h ^= (uint8_t)v->str[i];
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * dictionary index of each row, open addressing table of first row + 1
+ * return dict num, 0 if distinct values are more than dict_max
+ */
+static size_t build_dict(int col, size_t dict_max, uint32_t *index)
+{
+    static uint32_t *slots;
+    static uint32_t *slot_index;
+    static size_t   slot_num;
+
+    size_t n = 1;
+    while (n < dict_max * 2)
+        n <<= 1;
+    if (n > slot_num)
+    {
+        free(slots);
+        free(slot_index);
+        slots = malloc(n * sizeof(*slots));
+        slot_index = malloc(n * sizeof(*slot_index));
+        if (slots == NULL || slot_index == NULL)
+        {
+            free(slots);
+            free(slot_index);
+            slots = slot_index = NULL;
+            slot_num = 0;
+
+            return 0;
+        }
+        slot_num = n;
+    }
+    memset(slots, 0, n * sizeof(*slots));
+
+    size_t dict_num = 0;
+    size_t i;
+    for (i = 0; i < row_num; ++i)
+    {
+        struct sink_value const *v = &rows[i][col];
+        size_t pos = fnv1a(v) & (n - 1);
+        while (slots[pos] && sink_value_cmp(&rows[slots[pos] - 1][col], v) != 0)
+            pos = (pos + 1) & (n - 1);
+
+        if (slots[pos] == 0)
+        {
+            if (dict_num == dict_max)
+                return 0;
+
+            slots[pos] = (uint32_t)i + 1;
+            slot_index[pos] = (uint32_t)dict_num++;
+        }
+
+        index[i] = slot_index[pos];
+    }
+
+    return dict_num;
+}
+
+static int write_dict(int col, uint32_t const *index, size_t dict_num)
+{
+    NEG_RET_LN(buf_put_varint(&out, dict_num));
+
+    /* entries in order of index, the first row of each */
+    uint32_t next = 0;
+    size_t i;
+    for (i = 0; i < row_num; ++i)
+    {
+        if (index[i] != next)
+            continue;
+
+        struct sink_value const *v = &rows[i][col];
+        NEG_RET_LN(buf_put_varint(&out, v->len));
+        NEG_RET_LN(buf_put(&out, v->str, v->len));
+        ++next;
+    }
+
+    for (i = 0; i < row_num; ++i)
+        NEG_RET_LN(buf_put_varint(&out, index[i]));
+
+    return 0;
+}
+
+static int write_plain(int col)
+{
+    size_t i;
+    for (i = 0; i < row_num; ++i)
+    {
+        struct sink_value const *v = &rows[i][col];
+        NEG_RET_LN(buf_put_varint(&out, v->len));
+        NEG_RET_LN(buf_put(&out, v->str, v->len));
+    }
+
+    return 0;
+}
+
+static int write_str_column(struct seg_column *c, int col)
+{
+    size_t i;
+    for (i = 0; i < row_num; ++i)
+    {
+        struct sink_value const *v = &rows[i][col];
+        if (i == 0 || sink_value_cmp(v, &c->min_str) < 0)
+            c->min_str = *v;
+        if (i == 0 || sink_value_cmp(v, &c->max_str) > 0)
+            c->max_str = *v;
+    }
+
+    uint32_t *index = NULL;
+    size_t dict_num = 0;
+    if (c->kind == SEG_KIND_STR && row_num >= SEG_DICT_RATIO)
+    {
+        size_t dict_max = row_num / SEG_DICT_RATIO;
+        if (dict_max > SEG_DICT_MAX)
+            dict_max = SEG_DICT_MAX;
+
+        index = malloc(row_num * sizeof(*index));
+        if (index == NULL)
+            return set_error(ENOMEM, "segment dict");
+
+        dict_num = build_dict(col, dict_max, index);
+    }
+
+    int ret;
+    if (dict_num)
+    {
+        c->encoding = SEG_ENC_DICT;
+        ret = write_dict(col, index, dict_num);
+    }
+    else
+    {
+        c->encoding = SEG_ENC_PLAIN;
+        ret = write_plain(col);
+    }
+
+    free(index);
+
+    return ret;
+}
+
+static int put_str_prefix(struct sink_value const *v)
+{
+    uint8_t n = v->len < SEG_STR_PREFIX ? (uint8_t)v->len : SEG_STR_PREFIX;
+    NEG_RET_LN(buf_put(&out, &n, 1));
+
+    return buf_put(&out, v->str, n);
+}
+
+static int write_footer(void)
+{
+    size_t start = out.use;
+
+    int i;
+    for (i = 0; i < column_num; ++i)
+    {
+        struct seg_column *c = &columns[i];
+        uint8_t name_len = (uint8_t)strlen(c->column->name);
+        uint8_t kind = (uint8_t)c->kind;
+        uint8_t encoding = (uint8_t)c->encoding;
+
+        NEG_RET_LN(buf_put(&out, &name_len, 1));
+        NEG_RET_LN(buf_put(&out, c->column->name, name_len));
+        NEG_RET_LN(buf_put(&out, &kind, 1));
+        NEG_RET_LN(buf_put(&out, &encoding, 1));
+        NEG_RET_LN(buf_put_u64(&out, c->offset, 8));
+        NEG_RET_LN(buf_put_u64(&out, c->length, 4));
+
+        switch (c->kind)
+        {
+        case SEG_KIND_INT:
+        case SEG_KIND_UINT:
+        case SEG_KIND_FLOAT:
+            NEG_RET_LN(buf_put_u64(&out, c->min.u, 8));
+            NEG_RET_LN(buf_put_u64(&out, c->max.u, 8));
+            break;
+        default:
+            NEG_RET_LN(put_str_prefix(&c->min_str));
+            NEG_RET_LN(put_str_prefix(&c->max_str));
+            break;
+        }
+    }
+
+    NEG_RET_LN(buf_put_u64(&out, out.use - start, 4));
+    NEG_RET_LN(buf_put(&out, SEG_FOOTER_MAGIC, sizeof(SEG_FOOTER_MAGIC)));
+
+    return 0;
+}
+
+static int write_segment(void)
+{
+    static uint32_t seq;
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    char path[PATH_MAX];
+    char tmp[PATH_MAX + sizeof(".tmp")];
+    snprintf(path, sizeof(path), "%s/%"PRIu64"-%d-%u.seg", table_path(curr_table), \
+            (uint64_t)now.tv_sec * 1000 + now.tv_usec / 1000, settings.worker_id, seq++);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *fp = fopen(tmp, "w");
+    if (fp == NULL)
+        return set_error(errno, tmp);
+
+    if (fwrite(out.data, 1, out.use, fp) != out.use)
+    {
+        set_error(errno, tmp);
+        fclose(fp);
+        unlink(tmp);
+
+        return -1;
+    }
+
+    if (fclose(fp) != 0)
+    {
+        set_error(errno, tmp);
+        unlink(tmp);
+
+        return -1;
+    }
+
+    /* readers never see a partial segment */
+    if (rename(tmp, path) < 0)
+    {
+        set_error(errno, path);
+        unlink(tmp);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+static int segment_commit(void)
+{
+    if (row_num == 0)
+        return 0;
+
+    out.use = 0;
+    NEG_RET_LN(buf_put(&out, SEG_MAGIC, sizeof(SEG_MAGIC)));
+    NEG_RET_LN(buf_put_u64(&out, row_num, 4));
+    NEG_RET_LN(buf_put_u64(&out, column_num, 2));
+
+    int i;
+    for (i = 0; i < column_num; ++i)
+    {
+        struct seg_column *c = &columns[i];
+        c->offset = out.use;
+
+        switch (c->kind)
+        {
+        case SEG_KIND_INT:
+        case SEG_KIND_UINT:
+            NEG_RET_LN(write_int_column(c, i));
+            break;
+        case SEG_KIND_FLOAT:
+            NEG_RET_LN(write_float_column(c, i));
+            break;
+        default:
+            NEG_RET_LN(write_str_column(c, i));
+            break;
+        }
+
+        c->length = (uint32_t)(out.use - c->offset);
+    }
+
+    NEG_RET_LN(write_footer());
+    NEG_RET_LN(write_segment());
+
+    return (int)row_num;
+}
+
+static int segment_error_class(void)
+{
+    switch (last_errno)
+    {
+    case ENOSPC:
+    case EIO:
+    case EMFILE:
+    case ENFILE:
+    case EDQUOT:
+        return SINK_ERR_RETRY;
+    }
+
+    return SINK_ERR_FATAL;
+}
+
+static char const *segment_error(void)
+{
+    return error_str;
+}
+
+struct sink const segment_sink =
+{
+    .name           = "segment",
+    .open           = segment_open,
+    .close          = segment_close,
+    .create_table   = segment_create_table,
+    .drop_table     = segment_drop_table,
+    .exec           = segment_exec,
+    .begin_batch    = segment_begin_batch,
+    .append_row     = segment_append_row,
+    .commit         = segment_commit,
+    .error_class    = segment_error_class,
+    .error          = segment_error,
+};
+
+struct seg_reader
+{
+    uint8_t const       *p;
+    uint8_t const       *end;
+};
+
+static int get_u64(struct seg_reader *r, size_t n, uint64_t *v)
+{
+    if ((size_t)(r->end - r->p) < n)
+        return -__LINE__;
+
+    *v = 0;
+    size_t i;
+    for (i = 0; i < n; ++i)
+        *v |= (uint64_t)r->p[i] << (i * 8);
+    r->p += n;
+
+    return 0;
+}
+
+static int get_varint(struct seg_reader *r, uint64_t *v)
+{
+    *v = 0;
+    int shift;
+    for (shift = 0; shift < 64 && r->p < r->end; shift += 7)
+    {
+        uint8_t b = *r->p++;
+        *v |= (uint64_t)(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            return 0;
+    }
+
+    return -__LINE__;
+}
+
+static int get_bytes(struct seg_reader *r, size_t n, char const **str)
+{
+    if ((size_t)(r->end - r->p) < n)
+        return -__LINE__;
+
+    *str = (char const *)r->p;
+    r->p += n;
+
+    return 0;
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static int get_str(struct seg_reader *r, int kind, struct sink_value *v)
+{
+    uint64_t len;
+    NEG_RET_LN(get_varint(r, &len));
+    NEG_RET_LN(get_bytes(r, len, &v->str));
+    v->len = len;
+    v->type = kind == SEG_KIND_BIN ? SINK_VALUE_BLOB : SINK_VALUE_TEXT;
+
+    return 0;
+}
+
+/* numbers are formatted to 32 bytes slot of each value */
+# define SEG_NUM_LEN    32
+
+static int read_column(struct seg_reader *r, int kind, int encoding, \
+        struct sink_value *values, size_t num, int stride, char *nums)
+{
+    static struct sink_value *dict;
+    static size_t dict_len;
+
+    uint64_t dict_num = 0;
+    if (encoding == SEG_ENC_DICT)
+    {
+        if (kind != SEG_KIND_STR)
+            return -__LINE__;
+
+        NEG_RET_LN(get_varint(r, &dict_num));
+        if (dict_num > SEG_DICT_MAX || dict_num > num)
+            return -__LINE__;
+        if (auto_realloc((void **)&dict, &dict_len, dict_num * sizeof(*dict)) == NULL)
+            return -__LINE__;
+
+        size_t i;
+        for (i = 0; i < dict_num; ++i)
+            NEG_RET_LN(get_str(r, kind, &dict[i]));
+    }
+
+    uint64_t last = 0;
+    size_t i;
+    for (i = 0; i < num; ++i)
+    {
+        struct sink_value *v = &values[i * stride];
+        char *str = nums + i * stride * SEG_NUM_LEN;
+        uint64_t x;
+
+        switch (encoding)
+        {
+        case SEG_ENC_DELTA:
+            if (kind != SEG_KIND_INT && kind != SEG_KIND_UINT)
+                return -__LINE__;
+
+            NEG_RET_LN(get_varint(r, &x));
+            last += (uint64_t)unzigzag(x);
+            if (kind == SEG_KIND_UINT)
+                v->len = snprintf(str, SEG_NUM_LEN, "%"PRIu64, last);
+            else
+                v->len = snprintf(str, SEG_NUM_LEN, "%"PRId64, (int64_t)last);
+            v->str = str;
+            v->type = SINK_VALUE_INT;
+            break;
+        case SEG_ENC_PLAIN:
+            if (kind == SEG_KIND_FLOAT)
+            {
+                double f;
+                NEG_RET_LN(get_u64(r, sizeof(f), &x));
+                memcpy(&f, &x, sizeof(f));
+                v->len = snprintf(str, SEG_NUM_LEN, "%.17g", f);
+                v->str = str;
+                v->type = SINK_VALUE_FLOAT;
+            }
+            else if (kind == SEG_KIND_STR || kind == SEG_KIND_BIN)
+            {
+                NEG_RET_LN(get_str(r, kind, v));
+            }
+            else
+            {
+                return -__LINE__;
+            }
+            break;
+        case SEG_ENC_DICT:
+            NEG_RET_LN(get_varint(r, &x));
+            if (x >= dict_num)
+                return -__LINE__;
+            *v = dict[x];
+            break;
+        default:
+            return -__LINE__;
+        }
+    }
+
+    if (r->p != r->end)
+        return -__LINE__;
+
+    return 0;
+}
+
+int segment_is_file(void const *data, size_t size)
+{
+    return size >= sizeof(SEG_MAGIC) && memcmp(data, SEG_MAGIC, sizeof(SEG_MAGIC)) == 0;
+}
+
+static int read_file(char const *path, char **data, size_t *len, size_t *size)
+{
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL)
+        return -__LINE__;
+
+    struct stat st;
+    if (fstat(fileno(fp), &st) < 0 || auto_realloc((void **)data, len, st.st_size + 1) == NULL)
+    {
+        fclose(fp);
+
+        return -__LINE__;
+    }
+
+    *size = fread(*data, 1, st.st_size, fp);
+    fclose(fp);
+    if (*size != (size_t)st.st_size)
+        return -__LINE__;
+
+    return 0;
+}
+
+int segment_load(char const *path, struct sink_rows *seg)
+{
+    static char *file;
+    static size_t file_len;
+    static struct sink_value *values;
+    static size_t values_len;
+    static char *nums;
+    static size_t nums_len;
+    static char table[PATH_MAX];
+
+    size_t size;
+    NEG_RET_LN(read_file(path, &file, &file_len, &size));
+    if (!segment_is_file(file, size))
+        return -__LINE__;
+
+    uint8_t const *data = (uint8_t const *)file;
+    size_t header_len = sizeof(SEG_MAGIC) + 4 + 2;
+    size_t tail_len = 4 + sizeof(SEG_FOOTER_MAGIC);
+    if (size < header_len + tail_len)
+        return -__LINE__;
+    if (memcmp(data + size - sizeof(SEG_FOOTER_MAGIC), SEG_FOOTER_MAGIC, sizeof(SEG_FOOTER_MAGIC)) != 0)
+        return -__LINE__;
+
+    struct seg_reader r = { data + sizeof(SEG_MAGIC), data + header_len };
+    uint64_t seg_row_num, seg_column_num, footer_len;
+    NEG_RET_LN(get_u64(&r, 4, &seg_row_num));
+    NEG_RET_LN(get_u64(&r, 2, &seg_column_num));
+
+    r.p = data + size - tail_len;
+    r.end = r.p + 4;
+    NEG_RET_LN(get_u64(&r, 4, &footer_len));
+    if (footer_len > size - header_len - tail_len)
+        return -__LINE__;
+
+    size_t n = seg_row_num * seg_column_num;
+    if (auto_realloc((void **)&values, &values_len, (n ? n : 1) * sizeof(*values)) == NULL)
+        return -__LINE__;
+    if (auto_realloc((void **)&nums, &nums_len, (n ? n : 1) * SEG_NUM_LEN) == NULL)
+        return -__LINE__;
+
+    struct seg_reader footer = { data + size - tail_len - footer_len, data + size - tail_len };
+    uint64_t i;
+    for (i = 0; i < seg_column_num; ++i)
+    {
+        uint64_t name_len, kind, encoding, offset, length;
+        char const *name;
+        NEG_RET_LN(get_u64(&footer, 1, &name_len));
+        NEG_RET_LN(get_bytes(&footer, name_len, &name));
+        NEG_RET_LN(get_u64(&footer, 1, &kind));
+        NEG_RET_LN(get_u64(&footer, 1, &encoding));
+        NEG_RET_LN(get_u64(&footer, 8, &offset));
+        NEG_RET_LN(get_u64(&footer, 4, &length));
+
+        /* skip min and max */
+        if (kind == SEG_KIND_INT || kind == SEG_KIND_UINT || kind == SEG_KIND_FLOAT)
+        {
+            NEG_RET_LN(get_bytes(&footer, 16, &name));
+        }
+        else
+        {
+            uint64_t prefix_len;
+            NEG_RET_LN(get_u64(&footer, 1, &prefix_len));
+            NEG_RET_LN(get_bytes(&footer, prefix_len, &name));
+            NEG_RET_LN(get_u64(&footer, 1, &prefix_len));
+            NEG_RET_LN(get_bytes(&footer, prefix_len, &name));
+        }
+
+        if (offset < header_len || offset > size - tail_len - footer_len || \
+                length > size - tail_len - footer_len - offset)
+            return -__LINE__;
+
+        struct seg_reader block = { data + offset, data + offset + length };
+        NEG_RET_LN(read_column(&block, (int)kind, (int)encoding, values + i, \
+                    seg_row_num, (int)seg_column_num, nums + i * SEG_NUM_LEN));
+    }
+
+    if (footer.p != footer.end)
+        return -__LINE__;
+
+    /* table is the name of directory */
+    char const *end = strrchr(path, '/');
+    char const *start = end;
+    while (start && start > path && start[-1] != '/')
+        --start;
+    snprintf(table, sizeof(table), "%.*s", end ? (int)(end - start) : 0, start ? start : "");
+
+    seg->table = table;
+    seg->values = values;
+    seg->row_num = seg_row_num;
+    seg->column_num = (int)seg_column_num;
+
+    return 0;
+}
@@ -0,0 +1,17 @@
+/*
+ * Description: read segment files written by segment sink
+ */
+
+# pragma once
+
+# include "sink.h"
+
+/* true if data begin with segment magic */
+int segment_is_file(void const *data, size_t size);
+
+/*
+ * decode the segment file at path, table is the name of its directory.
+ * null values come back as 0 or empty, as they are written.
+ * rows are valid until next call, return negative if bad format
+ */
+int segment_load(char const *path, struct sink_rows *rows);
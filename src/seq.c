@@ -1,31 +1,73 @@
 /*
- * Description: 
+ * Description:
  *     History: damonyang@tencent.com, 2013/02/24, create
+ *
+ * The file keeps a high water mark, ids not above it may have been used.
+ * A process lease a block of ids by raising the mark under a record lock
+ * and sync it to disk, then hand out ids of the block from memory. The
+ * rest of a block is skipped after restart or crash, never reused. Record
+ * locks are per process, so other processes and instances sharing the
+ * file always get different blocks.
+ *
+ * In snowflake type ids are made in memory from time, node and counter,
+ * see seq.h. Ids are made by the receiver only, so node is the instance
+ * id. When the clock go back, or counter run out in a ms, the last ms is
+ * used and moved on, so ids keep growing, and catch up with the clock.
  */
 
 # include <stdint.h>
+# include <inttypes.h>
 # include <unistd.h>
 # include <fcntl.h>
+# include <pthread.h>
+# include <time.h>
 # include <sys/stat.h>
-# include <sys/mman.h>
 
 # include "conf.h"
 # include "utils.h"
+# include "seq.h"
 
-static uint64_t *global_sequence;
+static int sequence_fd = -1;
+
+/* ids in (next, end] are leased, start is where the block begin */
+static uint64_t sequence_start;
+static uint64_t sequence_next;
+static uint64_t sequence_end;
+
+/* snowflake, time in ms since SEQUENCE_EPOCH */
+static uint64_t last_time;
+static uint64_t last_counter;
+static bool     clock_back_flag;
+
+static void sequence_reset(void)
+{
+    sequence_start = sequence_next = sequence_end = 0;
+    last_time = last_counter = 0;
+}
 
 void sequence_fini(void)
 {
-    munmap((void *)global_sequence, sizeof(uint64_t));
+    if (sequence_fd >= 0)
+    {
+        close(sequence_fd);
+        sequence_fd = -1;
+    }
+
+    sequence_reset();
 }
 
 int sequence_init(void)
 {
-    if (global_sequence)
+    static bool atfork_flag = false;
+
+    if (sequence_fd >= 0)
     {
         sequence_fini();
     }
 
+    if (settings.global_sequence_type == SEQUENCE_BY_TIME)
+        return 0;
+
     int fd = open(settings.global_sequence_file, O_RDWR | O_CREAT, 0777);
     if (fd < 0)
         return -__LINE__;
@@ -40,37 +82,129 @@ int sequence_init(void)
     if (st.st_size == 0)
     {
         uint64_t v = 0;
-        write_in_full(fd, &v, sizeof(v));
+        if (write_in_full(fd, &v, sizeof(v)) != sizeof(v))
+        {
+            close(fd);
+            return -__LINE__;
+        }
     }
 
-    void *addr = mmap(NULL, sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (addr == MAP_FAILED)
+    /* a forked worker must not hand out the block of its parent */
+    if (atfork_flag == false)
     {
-        close(fd);
+        if (pthread_atfork(NULL, NULL, sequence_reset) != 0)
+        {
+            close(fd);
+            return -__LINE__;
+        }
+
+        atfork_flag = true;
+    }
+
+    sequence_fd = fd;
+
+    return 0;
+}
+
+static int sequence_lease(void)
+{
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_len = sizeof(uint64_t) };
+    if (fcntl(sequence_fd, F_SETLKW, &lock) < 0)
         return -__LINE__;
+
+    int ret = 0;
+    uint64_t mark = 0;
+    uint64_t new_mark = 0;
+
+    if (pread(sequence_fd, &mark, sizeof(mark), 0) != sizeof(mark))
+        ret = -__LINE__;
+
+    if (ret == 0)
+    {
+        new_mark = mark + (settings.global_sequence_lease_size ? \
+                settings.global_sequence_lease_size : 1);
+
+        if (pwrite(sequence_fd, &new_mark, sizeof(new_mark), 0) != sizeof(new_mark))
+            ret = -__LINE__;
+        else if (fdatasync(sequence_fd) < 0)
+            ret = -__LINE__;
     }
 
-    close(fd);
+    lock.l_type = F_UNLCK;
+    fcntl(sequence_fd, F_SETLK, &lock);
+
+    if (ret < 0)
+        return ret;
 
-    global_sequence = (uint64_t *)addr;
+    sequence_start = sequence_next = mark;
+    sequence_end = new_mark;
 
     return 0;
 }
 
+static uint64_t snowflake_get(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    uint64_t now = ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+    now = now > SEQUENCE_EPOCH ? now - SEQUENCE_EPOCH : 0;
+
+    if (now > last_time)
+    {
+        if (clock_back_flag)
+        {
+            log_warn("clock catch up with global sequence");
+            clock_back_flag = false;
+        }
+
+        last_time = now;
+        last_counter = 0;
+    }
+    else
+    {
+        if (now < last_time && clock_back_flag == false)
+        {
+            log_warn("clock go back %"PRIu64" ms, global sequence keep growing", \
+                    last_time - now);
+            clock_back_flag = true;
+        }
+
+        if (++last_counter >> SEQUENCE_COUNTER_BITS)
+        {
+            ++last_time;
+            last_counter = 0;
+        }
+    }
+
+    return (last_time << (SEQUENCE_NODE_BITS + SEQUENCE_COUNTER_BITS)) | \
+        ((uint64_t)settings.global_sequence_instance_id << SEQUENCE_COUNTER_BITS) | last_counter;
+}
+
 uint64_t sequence_get(void)
 {
-    uint64_t v = __sync_add_and_fetch(global_sequence, 1);
-    msync((void *)global_sequence, sizeof(uint64_t), MS_ASYNC);
+    if (settings.global_sequence_type == SEQUENCE_BY_TIME)
+        return snowflake_get();
 
-    return v;
+    if (sequence_next == sequence_end)
+    {
+        int ret = sequence_lease();
+        if (ret < 0)
+        {
+            log_error("lease global sequence fail: %d: %m", ret);
+
+            return 0;
+        }
+    }
+
+    return ++sequence_next;
 }
 
 void sequence_dec(void)
 {
-    if (*global_sequence)
+    /* the last id is not used, give it back */
+    if (sequence_next > sequence_start)
     {
-        __sync_sub_and_fetch(global_sequence, 1);
-        msync((void *)global_sequence, sizeof(uint64_t), MS_ASYNC);
+        --sequence_next;
     }
 }
-
@@ -7,6 +7,14 @@
 
 # include <stdint.h>
 
+/*
+ * snowflake id: ms since SEQUENCE_EPOCH in 41 bits, node in 10 bits,
+ * counter in 12 bits. node is the instance id.
+ */
+# define SEQUENCE_EPOCH         1704067200000ull    /* 2024-01-01 UTC, in ms */
+# define SEQUENCE_NODE_BITS     10
+# define SEQUENCE_COUNTER_BITS  12
+
 int sequence_init(void);
 
 uint64_t sequence_get(void);
@@ -0,0 +1,383 @@
+/*
+ * Description: open addressing hash table in heap, swiss table style.
+ *
+ * Each slot has a control byte: empty, deleted, or the low 7 bits of the
+ * hash when full. Slots are probed by group of 16 control bytes, matched
+ * with one SSE2 compare, so compare function is called only on a tag hit.
+ * Lookup stop at a group which has an empty slot.
+ *
+ * When the table is above 7/8 full, counting deleted slots, a new table
+ * is allocated, double size if half of the slots are used, else the same
+ * size to drop deleted slots. Each put and del then move a few groups
+ * from the old table, get look up both until the old one is empty.
+ */
+
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+
+# ifdef __SSE2__
+# include <emmintrin.h>
+# endif
+
+# include "shash.h"
+
+# define GROUP_SIZE     16
+# define CTRL_EMPTY     ((int8_t)-128)
+# define CTRL_DELETED   ((int8_t)-2)
+/* groups moved from the old table on each put and del */
+# define MOVE_GROUPS    2
+
+static int default_compare_fun(const void *a, const void *b)
+{
+    return *((uint32_t *)a) != *((uint32_t *)b);
+}
+
+static uint32_t default_hashkey_fun(const void *unit)
+{
+    return *((uint32_t *)unit);
+}
+
+/* spread all bits of key, tag is the low 7 bits, group from the rest */
+static uint64_t get_hash(shash_t *hash, const void *unit)
+{
+    uint64_t h = hash->hashkey(unit);
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+
+    return h;
+}
+
+static inline int8_t hash_tag(uint64_t h)
+{
+    return (int8_t)(h & 0x7f);
+}
+
+/* bit i set if ctrl[i] equal to tag */
+static inline uint32_t group_match(const int8_t *ctrl, int8_t tag)
+{
+# ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(tag)));
+# else
+    uint32_t mask = 0;
+    int i;
+    for (i = 0; i < GROUP_SIZE; ++i)
+    {
+        if (ctrl[i] == tag)
+            mask |= 1u << i;
+    }
+
+    return mask;
+# endif
+}
+
+/* bit i set if ctrl[i] is empty or deleted */
+static inline uint32_t group_match_free(const int8_t *ctrl)
+{
+# ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(group);
+# else
+    uint32_t mask = 0;
+    int i;
+    for (i = 0; i < GROUP_SIZE; ++i)
+    {
+        if (ctrl[i] < 0)
+            mask |= 1u << i;
+    }
+
+    return mask;
+# endif
+}
+
+static inline void *slot_at(shash_t *hash, struct shash_table *t, size_t i)
+{
+    return (char *)t->slots + i * hash->unit_size;
+}
+
+static int table_alloc(shash_t *hash, struct shash_table *t, size_t capacity)
+{
+    memset(t, 0, sizeof(*t));
+
+    t->ctrl = malloc(capacity);
+    t->slots = malloc(capacity * hash->unit_size);
+    if (t->ctrl == NULL || t->slots == NULL)
+    {
+        free(t->ctrl);
+        free(t->slots);
+        t->ctrl = NULL;
+        t->slots = NULL;
+
+        return -__LINE__;
+    }
+
+    memset(t->ctrl, CTRL_EMPTY, capacity);
+    t->capacity = capacity;
+
+    return 0;
+}
+
+static void table_free(struct shash_table *t)
+{
+    free(t->ctrl);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+/* slot index of unit, -1 if not found */
+static ssize_t table_find(shash_t *hash, struct shash_table *t, \
+        const void *unit, uint64_t h)
+{
+    if (t->used == 0)
+        return -1;
+
+    size_t group_mask = t->capacity / GROUP_SIZE - 1;
+    size_t group = (h >> 7) & group_mask;
+    int8_t tag = hash_tag(h);
+
+    size_t i;
+    for (i = 0; i <= group_mask; ++i)
+    {
+        const int8_t *ctrl = t->ctrl + group * GROUP_SIZE;
+
+        uint32_t match = group_match(ctrl, tag);
+        while (match)
+        {
+            size_t idx = group * GROUP_SIZE + __builtin_ctz(match);
+            if (hash->compare(slot_at(hash, t, idx), unit) == 0)
+                return idx;
+
+            match &= match - 1;
+        }
+
+        if (group_match(ctrl, CTRL_EMPTY))
+            return -1;
+
+        group = (group + i + 1) & group_mask;
+    }
+
+    return -1;
+}
+
+/* table is never full, there is always a free slot */
+static void *table_insert(shash_t *hash, struct shash_table *t, \
+        const void *unit, uint64_t h)
+{
+    size_t group_mask = t->capacity / GROUP_SIZE - 1;
+    size_t group = (h >> 7) & group_mask;
+
+    size_t i;
+    for (i = 0; i <= group_mask; ++i)
+    {
+        uint32_t match = group_match_free(t->ctrl + group * GROUP_SIZE);
+        if (match)
+        {
+            size_t idx = group * GROUP_SIZE + __builtin_ctz(match);
+            if (t->ctrl[idx] == CTRL_DELETED)
+                --t->deleted;
+
+            t->ctrl[idx] = hash_tag(h);
+            ++t->used;
+
+            void *slot = slot_at(hash, t, idx);
+            memcpy(slot, unit, hash->unit_size);
+
+            return slot;
+        }
+
+        group = (group + i + 1) & group_mask;
+    }
+
+    return NULL;
+}
+
+static void table_erase(struct shash_table *t, size_t idx)
+{
+    /* no probe pass a group with empty slot, so it can be empty again */
+    if (group_match(t->ctrl + idx / GROUP_SIZE * GROUP_SIZE, CTRL_EMPTY))
+    {
+        t->ctrl[idx] = CTRL_EMPTY;
+    }
+    else
+    {
+        t->ctrl[idx] = CTRL_DELETED;
+        ++t->deleted;
+    }
+
+    --t->used;
+}
+
+static void move_groups(shash_t *hash, size_t groups)
+{
+    struct shash_table *old = &hash->old;
+    if (old->capacity == 0)
+        return;
+
+    size_t end = old->capacity;
+    if (groups < (old->capacity - hash->move_pos) / GROUP_SIZE)
+        end = hash->move_pos + groups * GROUP_SIZE;
+
+    for (; hash->move_pos < end && old->used; ++hash->move_pos)
+    {
+        if (old->ctrl[hash->move_pos] < 0)
+            continue;
+
+        void *unit = slot_at(hash, old, hash->move_pos);
+        table_insert(hash, &hash->cur, unit, get_hash(hash, unit));
+
+        old->ctrl[hash->move_pos] = CTRL_DELETED;
+        --old->used;
+    }
+
+    if (hash->move_pos == old->capacity || old->used == 0)
+        table_free(old);
+}
+
+static int reserve(shash_t *hash)
+{
+    struct shash_table *cur = &hash->cur;
+    if ((cur->used + cur->deleted + 1) * 8 <= cur->capacity * 7)
+        return 0;
+
+    /* one resize at a time */
+    move_groups(hash, SIZE_MAX);
+
+    size_t capacity = cur->capacity;
+    if (cur->used * 2 >= capacity)
+        capacity *= 2;
+
+    struct shash_table t;
+    if (table_alloc(hash, &t, capacity) < 0)
+        return -__LINE__;
+
+    hash->old = *cur;
+    hash->cur = t;
+    hash->move_pos = 0;
+
+    if (hash->old.used == 0)
+        table_free(&hash->old);
+
+    return 0;
+}
+
+int shash_init(shash_t *hash, size_t unit_num, size_t unit_size,
+        compare_fun_t *compare, hashkey_fun_t *hashkey)
+{
+    if (!hash || !unit_size)
+        return -__LINE__;
+
+    memset(hash, 0, sizeof(*hash));
+    hash->unit_size = unit_size;
+    hash->compare = compare ? compare : default_compare_fun;
+    hash->hashkey = hashkey ? hashkey : default_hashkey_fun;
+
+    size_t capacity = GROUP_SIZE;
+    while (capacity * 7 / 8 < unit_num)
+        capacity *= 2;
+
+    return table_alloc(hash, &hash->cur, capacity);
+}
+
+void shash_fini(shash_t *hash)
+{
+    table_free(&hash->cur);
+    table_free(&hash->old);
+    hash->num = 0;
+}
+
+void *shash_get(shash_t *hash, const void *unit)
+{
+    uint64_t h = get_hash(hash, unit);
+
+    ssize_t idx = table_find(hash, &hash->cur, unit, h);
+    if (idx >= 0)
+        return slot_at(hash, &hash->cur, idx);
+
+    if (hash->old.capacity)
+    {
+        idx = table_find(hash, &hash->old, unit, h);
+        if (idx >= 0)
+            return slot_at(hash, &hash->old, idx);
+    }
+
+    return NULL;
+}
+
+void *shash_put(shash_t *hash, const void *unit)
+{
+    move_groups(hash, MOVE_GROUPS);
+
+    if (reserve(hash) < 0)
+        return NULL;
+
+    void *slot = table_insert(hash, &hash->cur, unit, get_hash(hash, unit));
+    if (slot)
+        ++hash->num;
+
+    return slot;
+}
+
+void *shash_add(shash_t *hash, const void *unit, int *exist)
+{
+    void *slot = shash_get(hash, unit);
+    if (exist)
+        *exist = slot != NULL;
+    if (slot)
+        return slot;
+
+    return shash_put(hash, unit);
+}
+
+int shash_del(shash_t *hash, const void *unit)
+{
+    move_groups(hash, MOVE_GROUPS);
+
+    uint64_t h = get_hash(hash, unit);
+
+    ssize_t idx = table_find(hash, &hash->cur, unit, h);
+    if (idx >= 0)
+    {
+        table_erase(&hash->cur, idx);
+    }
+    else
+    {
+        if (hash->old.capacity == 0)
+            return -__LINE__;
+
+        idx = table_find(hash, &hash->old, unit, h);
+        if (idx < 0)
+            return -__LINE__;
+
+        table_erase(&hash->old, idx);
+        if (hash->old.used == 0)
+            table_free(&hash->old);
+    }
+
+    --hash->num;
+
+    return 0;
+}
+
+size_t shash_traverse(shash_t *hash, shash_traverse_fun_t *traverse, void *arg)
+{
+    struct shash_table *tables[] = { &hash->old, &hash->cur };
+    size_t count = 0;
+
+    size_t i, j;
+    for (i = 0; i < sizeof(tables) / sizeof(tables[0]); ++i)
+    {
+        struct shash_table *t = tables[i];
+        for (j = 0; j < t->capacity; ++j)
+        {
+            if (t->ctrl[j] >= 0 && traverse(hash, slot_at(hash, t, j), arg) == 0)
+                ++count;
+        }
+    }
+
+    return count;
+}
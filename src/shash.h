@@ -0,0 +1,72 @@
+/*
+ * Description: open addressing hash table in heap, swiss table style.
+ *              a tag byte per slot, probe 16 slots a time, grow by moving
+ *              a few groups to the new table on each put and del.
+ */
+
+# pragma once
+
+# include <stdint.h>
+# include <stddef.h>
+
+# include "bhash.h"
+
+struct shash_table
+{
+    int8_t              *ctrl;
+    void                *slots;
+    size_t              capacity;   /* slot num, power of 2, 0 if no table */
+    size_t              used;
+    size_t              deleted;
+};
+
+typedef struct
+{
+    size_t              unit_size;
+    size_t              num;
+
+    /* units are put to cur, old is moving to cur while resizing */
+    struct shash_table  cur;
+    struct shash_table  old;
+    size_t              move_pos;
+
+    compare_fun_t       *compare;
+    hashkey_fun_t       *hashkey;
+} shash_t;
+
+/*
+ * unit_num is the initial capacity, the table grow as needed.
+ * compare and hashkey are the same as bhash, NULL use the first 4 bytes
+ * of unit as key. return 0 on success
+ */
+int shash_init(shash_t *hash, size_t unit_num, size_t unit_size,
+        compare_fun_t *compare, hashkey_fun_t *hashkey);
+
+void shash_fini(shash_t *hash);
+
+/*
+ * return pointer of the unit equal to unit, or NULL.
+ * units move while resizing, pointers are valid until next put or del
+ */
+void *shash_get(shash_t *hash, const void *unit);
+
+/* copy unit into the table, don't check if exist. NULL if out of memory */
+void *shash_put(shash_t *hash, const void *unit);
+
+/* get, put if not exist. exist is set to 1 if found, 0 if put */
+void *shash_add(shash_t *hash, const void *unit, int *exist);
+
+/* return 0 if deleted, negative if not found */
+int shash_del(shash_t *hash, const void *unit);
+
+/* traverse must not put or del, return count traverse return 0 */
+typedef int shash_traverse_fun_t(shash_t *hash, void *unit, void *arg);
+
+size_t shash_traverse(shash_t *hash, shash_traverse_fun_t *traverse, void *arg);
+
+/* number of units */
+static inline size_t shash_use(shash_t *hash)
+{
+    return hash->num;
+}
+
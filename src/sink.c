@@ -0,0 +1,411 @@
+/*
+ * Description: select storage sink, and split INSERT statement to rows
+ *              for sinks which take rows
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <ctype.h>
+
+# include "conf.h"
+# include "utils.h"
+# include "sink.h"
+# include "db.h"
+
+struct sink const *sink = &mysql_sink;
+
+static struct sink const *sinks[] =
+{
+    &mysql_sink,
+    &sqlite_sink,
+    &segment_sink,
+};
+
+int sink_init(void)
+{
+    size_t i;
+    for (i = 0; i < sizeof(sinks) / sizeof(sinks[0]); ++i)
+    {
+        if (strcasecmp(sinks[i]->name, settings.sink_name) == 0)
+        {
+            sink = sinks[i];
+
+            return 0;
+        }
+    }
+
+    return -__LINE__;
+}
+
+static char const *skip_space(char const *p, char const *end)
+{
+    while (p < end && isspace((unsigned char)*p))
+        ++p;
+
+    return p;
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+/* quoted string escaped by mysql_real_escape_string, return end of it */
+static char const *parse_quoted(char const *p, char const *end, char *out, size_t *out_len)
+{
+    size_t n = 0;
+
+    ++p;
+    while (p < end)
+    {
+        char c = *p++;
+        if (c == '\'')
+        {
+            if (p < end && *p == '\'')
+            {
+                out[n++] = '\'';
+                ++p;
+
+                continue;
+            }
+
+            *out_len = n;
+
+            return p;
+        }
+
+        if (c == '\\' && p < end)
+        {
+            c = *p++;
+            switch (c)
+            {
+            case '0':
+                c = '\0';
+                break;
+            case 'n':
+                c = '\n';
+                break;
+            case 'r':
+                c = '\r';
+                break;
+            case 't':
+                c = '\t';
+                break;
+            case 'b':
+                c = '\b';
+                break;
+            case 'Z':
+                c = '\032';
+                break;
+            }
+        }
+
+        out[n++] = c;
+    }
+
+    return NULL;
+}
+
+static char const *parse_value(char const *p, char const *end, char **scratch, struct sink_value *v)
+{
+    p = skip_space(p, end);
+    if (p >= end)
+        return NULL;
+
+    if (*p == '\'')
+    {
+        v->type = SINK_VALUE_TEXT;
+        v->str  = *scratch;
+        if ((p = parse_quoted(p, end, *scratch, &v->len)) == NULL)
+            return NULL;
+        *scratch += v->len;
+
+        return p;
+    }
+
+# define UNHEX "unhex('"
+    if (strncasecmp(p, UNHEX, strlen(UNHEX)) == 0)
+    {
+        p += strlen(UNHEX);
+
+        char *out = *scratch;
+        size_t n = 0;
+        while (p + 1 < end && *p != '\'')
+        {
+            int h = hex_value(p[0]);
+            int l = hex_value(p[1]);
+            if (h < 0 || l < 0)
+                return NULL;
+
+            out[n++] = (char)(h << 4 | l);
+            p += 2;
+        }
+
+        if (end - p < 2 || p[0] != '\'' || p[1] != ')')
+            return NULL;
+
+        v->type = SINK_VALUE_BLOB;
+        v->str  = out;
+        v->len  = n;
+        *scratch += n;
+
+        return p + 2;
+    }
+# undef UNHEX
+
+    char const *s = p;
+    while (p < end && *p != ',' && *p != ')' && !isspace((unsigned char)*p))
+        ++p;
+    if (p == s)
+        return NULL;
+
+    v->str = s;
+    v->len = p - s;
+
+    if (v->len == 4 && strncasecmp(s, "NULL", 4) == 0)
+        v->type = SINK_VALUE_NULL;
+    else if (memchr(s, '.', v->len) || memchr(s, 'e', v->len) || memchr(s, 'E', v->len) || \
+            memchr(s, 'n', v->len) || memchr(s, 'N', v->len))
+        v->type = SINK_VALUE_FLOAT;
+    else
+        v->type = SINK_VALUE_INT;
+
+    return p;
+}
+
+int sink_column_num(void)
+{
+    int num = 0;
+    struct column *curr;
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (curr->is_storage)
+            ++num;
+    }
+
+    return num;
+}
+
+/* -1 if the error is retryable, like db_query */
+static int sink_fail(void)
+{
+    if (sink->error_class() == SINK_ERR_RETRY)
+        return -1;
+
+    return -2;
+}
+
+/* parse "INSERT INTO `table` (columns) VALUES (...), (...)" */
+int sink_parse_insert(char const *sql, size_t len, struct sink_rows *rows)
+{
+    static char *table;
+    static size_t table_len;
+
+    static char *scratch;
+    static size_t scratch_len;
+
+    static struct sink_value *values;
+    static size_t values_len;
+
+    char const *p = sql;
+    char const *end = sql + len;
+    while (end > p && (end[-1] == '\0' || end[-1] == ';' || isspace((unsigned char)end[-1])))
+        --end;
+
+# define PREFIX "INSERT INTO `"
+    if ((size_t)(end - p) < strlen(PREFIX) || strncasecmp(p, PREFIX, strlen(PREFIX)) != 0)
+        return -__LINE__;
+    p += strlen(PREFIX);
+# undef PREFIX
+
+    char const *name_end = memchr(p, '`', end - p);
+    if (name_end == NULL)
+        return -__LINE__;
+    if (auto_realloc((void **)&table, &table_len, name_end - p + 1) == NULL)
+        return -__LINE__;
+    memcpy(table, p, name_end - p);
+    table[name_end - p] = '\0';
+
+    /* columns are the storage columns in settings */
+    p = memchr(name_end, ')', end - name_end);
+    if (p == NULL)
+        return -__LINE__;
+    p = skip_space(p + 1, end);
+    if ((size_t)(end - p) < 6 || strncasecmp(p, "VALUES", 6) != 0)
+        return -__LINE__;
+    p += 6;
+
+    int num = sink_column_num();
+
+    /* unescaped values are never longer than the sql */
+    if (auto_realloc((void **)&scratch, &scratch_len, len + 1) == NULL)
+        return -__LINE__;
+    char *s = scratch;
+
+    size_t row_num = 0;
+    size_t value_num = 0;
+    while (true)
+    {
+        p = skip_space(p, end);
+        if (p >= end)
+            break;
+        if (row_num && *p++ != ',')
+            return -__LINE__;
+
+        p = skip_space(p, end);
+        if (p >= end || *p++ != '(')
+            return -__LINE__;
+
+        int i;
+        for (i = 0; i < num; ++i)
+        {
+            if (value_num == values_len)
+            {
+                size_t n = values_len ? values_len * 2 : 1024;
+                struct sink_value *new_values = realloc(values, n * sizeof(*values));
+                if (new_values == NULL)
+                    return -__LINE__;
+                values = new_values;
+                values_len = n;
+            }
+
+            if (i && *p++ != ',')
+                return -__LINE__;
+            if ((p = parse_value(p, end, &s, &values[value_num++])) == NULL)
+                return -__LINE__;
+            p = skip_space(p, end);
+        }
+
+        if (p >= end || *p++ != ')')
+            return -__LINE__;
+
+        ++row_num;
+    }
+
+    rows->table         = table;
+    rows->values        = values;
+    rows->row_num       = row_num;
+    rows->column_num    = num;
+
+    return 0;
+}
+
+int sink_render_insert(struct sink_rows const *rows, char **sql)
+{
+    static char *buf;
+    static size_t buf_len;
+
+    /* escaped text at most double, blob in hex double */
+    size_t len = strlen(rows->table) + settings.columns_str_len + 50;
+    size_t i, n = rows->row_num * rows->column_num;
+    for (i = 0; i < n; ++i)
+        len += rows->values[i].len * 2 + 16;
+
+    if (auto_realloc((void **)&buf, &buf_len, len) == NULL)
+        return -__LINE__;
+
+    size_t use = snprintf(buf, buf_len, "INSERT INTO `%s` (%s) VALUES", rows->table, settings.columns_str);
+    for (i = 0; i < n; ++i)
+    {
+        struct sink_value const *v = &rows->values[i];
+        int col = i % rows->column_num;
+        if (col == 0)
+            use += lstrncpy(buf + use, i ? ", (" : " (", buf_len - use);
+        else
+            buf[use++] = ',';
+
+        switch (v->type)
+        {
+        case SINK_VALUE_NULL:
+            use += lstrncpy(buf + use, "NULL", buf_len - use);
+            break;
+        case SINK_VALUE_INT:
+        case SINK_VALUE_FLOAT:
+            memcpy(buf + use, v->str, v->len);
+            use += v->len;
+            break;
+        case SINK_VALUE_TEXT:
+            buf[use++] = '\'';
+            use += db_escape_string(buf + use, v->str, v->len);
+            buf[use++] = '\'';
+            break;
+        case SINK_VALUE_BLOB:
+            use += lstrncpy(buf + use, "unhex('", buf_len - use);
+            size_t j;
+            for (j = 0; j < v->len; ++j)
+                use += sprintf(buf + use, "%02X", (uint8_t)v->str[j]);
+            use += lstrncpy(buf + use, "')", buf_len - use);
+            break;
+        }
+
+        if (col == rows->column_num - 1)
+            buf[use++] = ')';
+    }
+    buf[use] = '\0';
+
+    *sql = buf;
+
+    return (int)use;
+}
+
+int sink_insert_rows(struct sink_rows const *rows)
+{
+    if (sink->insert_sql)
+    {
+        char *sql;
+        int len = sink_render_insert(rows, &sql);
+        if (len < 0)
+            return -__LINE__;
+
+        return sink->insert_sql(sql, len);
+    }
+
+    if (sink->begin_batch(rows->table) < 0)
+        return sink_fail();
+
+    size_t i;
+    for (i = 0; i < rows->row_num; ++i)
+    {
+        if (sink->append_row(rows->values + i * rows->column_num, rows->column_num) < 0)
+            return sink_fail();
+    }
+
+    int ret = sink->commit();
+    if (ret < 0)
+        return sink_fail();
+
+    return ret;
+}
+
+int sink_insert(char const *sql, size_t len)
+{
+    if (sink->insert_sql)
+        return sink->insert_sql(sql, len);
+
+    struct sink_rows rows;
+    int ret = sink_parse_insert(sql, len, &rows);
+    if (ret < 0)
+    {
+        log_error("split insert sql fail: %d", ret);
+
+        return ret;
+    }
+
+    return sink_insert_rows(&rows);
+}
+
+int sink_exec(char const *sql, size_t len)
+{
+    if (sink->exec(sql, len) < 0)
+        return sink_fail();
+
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * Description: storage sink of worker, the place records are written to
+ */
+
+# pragma once
+
+# include <stddef.h>
+# include <stdbool.h>
+
+enum
+{
+    SINK_VALUE_NULL,
+    SINK_VALUE_INT,     /* str is a decimal integer */
+    SINK_VALUE_FLOAT,   /* str is a decimal float */
+    SINK_VALUE_TEXT,
+    SINK_VALUE_BLOB,
+};
+
+struct sink_value
+{
+    int                 type;
+    char const          *str;
+    size_t              len;
+};
+
+/* classification of the last error */
+enum
+{
+    SINK_ERR_RETRY = 1, /* connection lost, busy: keep and retry later */
+    SINK_ERR_FATAL,     /* bad statement or data: write to fail log */
+};
+
+/*
+ * Worker receive a batch as INSERT statement of mysql dialect.
+ * A sink either take the statement as is by insert_sql, or take
+ * rows by begin_batch, append_row and commit. Values passed to
+ * append_row are valid until commit return.
+ */
+struct sink
+{
+    char const          *name;
+
+    int                 (*open)(void);
+    void                (*close)(void);
+
+    int                 (*create_table)(char const *table);
+    int                 (*drop_table)(char const *table);
+
+    /* exec other sql, such as COMMAND_SQL from client */
+    int                 (*exec)(char const *sql, size_t len);
+
+    /* return rows inserted */
+    int                 (*insert_sql)(char const *sql, size_t len);
+
+    int                 (*begin_batch)(char const *table);
+    int                 (*append_row)(struct sink_value const *values, int num);
+    /* return rows inserted */
+    int                 (*commit)(void);
+
+    int                 (*error_class)(void);
+    char const          *(*error)(void);
+};
+
+extern struct sink const *sink;
+
+extern struct sink const mysql_sink;
+extern struct sink const sqlite_sink;
+extern struct sink const segment_sink;
+
+/* select sink by settings.sink_name */
+int sink_init(void);
+
+/* rows of a batch, values of row i are values[i * column_num ...] */
+struct sink_rows
+{
+    char const          *table;
+    struct sink_value const *values;
+    size_t              row_num;
+    int                 column_num;
+};
+
+/* number of storage columns */
+int sink_column_num(void);
+
+/* split INSERT statement of mysql dialect, rows are valid until next call */
+int sink_parse_insert(char const *sql, size_t len, struct sink_rows *rows);
+
+/* render rows to INSERT statement, return length, sql valid until next call */
+int sink_render_insert(struct sink_rows const *rows, char **sql);
+
+/* write a batch of rows, return rows inserted, -1 if retryable */
+int sink_insert_rows(struct sink_rows const *rows);
+
+/* write a batch in INSERT statement, return rows inserted */
+int sink_insert(char const *sql, size_t len);
+
+/* exec other sql, -1 if retryable */
+int sink_exec(char const *sql, size_t len);
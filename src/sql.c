@@ -103,6 +103,31 @@ char *get_table_name(int table_id, int offset)
     return name;
 }
 
+/* the period sec is in, unique over years, so the same hour or day of
+ * another day or month never look as the same period */
+int get_shift_period(time_t sec)
+{
+    struct tm *tm = localtime_cached(sec);
+    switch (settings.shift_table_type)
+    {
+    case TABLE_SHIFT_BY_HOUR:
+        return (tm->tm_year * 366 + tm->tm_yday) * 24 + tm->tm_hour;
+    case TABLE_SHIFT_BY_DAY:
+        return tm->tm_year * 366 + tm->tm_yday;
+    case TABLE_SHIFT_BY_MON:
+        return tm->tm_year * 12 + tm->tm_mon;
+    case TABLE_SHIFT_BY_YEAR:
+        return tm->tm_year;
+    case TABLE_NO_SHIFT:
+        return 0;
+    default:
+        log_fatal("unknown shift type: %d", settings.shift_table_type);
+        break;
+    }
+
+    return 0;
+}
+
 static char *sql;
 static size_t sql_buf_len;
 
@@ -5,8 +5,13 @@
 
 # pragma once
 
+# include <time.h>
+
 char *get_table_name(int table_id, int offset);
 
+/* a value change when tables shift to the next period */
+int get_shift_period(time_t sec);
+
 char *create_table_sql(char *table_name);
 
 char *create_merge_table_sql(int offset);
@@ -0,0 +1,367 @@
+/*
+ * Description: sqlite sink, write rows by prepared multi row insert
+ *              in wal mode, for edge deployments and test without mysql
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <inttypes.h>
+
+# include <sqlite3.h>
+
+# include "conf.h"
+# include "utils.h"
+# include "sink.h"
+
+/* rows of a prepared insert statement */
+# define SQLITE_BATCH_ROWS 64
+
+static sqlite3 *db;
+
+static char     *curr_table;
+static int      column_num;
+static int      batch_rows;
+static int      row_num;
+static int      insert_rows;
+static struct sink_value const *rows[SQLITE_BATCH_ROWS];
+
+/* stmts[n] insert n rows to curr_table */
+static sqlite3_stmt *stmts[SQLITE_BATCH_ROWS + 1];
+
+static int last_errcode;
+
+static int check(int ret)
+{
+    last_errcode = ret;
+    if (ret != SQLITE_OK && ret != SQLITE_DONE && ret != SQLITE_ROW)
+        return -__LINE__;
+
+    return 0;
+}
+
+static int sqlite_exec(char const *sql, size_t len)
+{
+    (void)len;
+
+    return check(sqlite3_exec(db, sql, NULL, NULL, NULL));
+}
+
+static void clear_stmts(void)
+{
+    int i;
+    for (i = 0; i <= SQLITE_BATCH_ROWS; ++i)
+    {
+        if (stmts[i])
+        {
+            sqlite3_finalize(stmts[i]);
+            stmts[i] = NULL;
+        }
+    }
+}
+
+static int sqlite_open(void)
+{
+    if (db)
+        return 0;
+
+    int ret = sqlite3_open_v2(settings.sqlite_file, &db, \
+            SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    if (ret != SQLITE_OK)
+    {
+        last_errcode = ret;
+
+        return -__LINE__;
+    }
+
+    /* workers write the same file, wait for the lock */
+    sqlite3_busy_timeout(db, 5000);
+
+    NEG_RET_LN(sqlite_exec("PRAGMA journal_mode=WAL", 0));
+    NEG_RET_LN(sqlite_exec("PRAGMA synchronous=NORMAL", 0));
+
+    column_num = 0;
+    struct column *curr = settings.columns;
+    while (curr)
+    {
+        if (curr->is_storage)
+            ++column_num;
+        curr = curr->next;
+    }
+
+    /* sqlite limit host parameters of a statement */
+    batch_rows = SQLITE_BATCH_ROWS;
+    int max_var = sqlite3_limit(db, SQLITE_LIMIT_VARIABLE_NUMBER, -1);
+    if (batch_rows * column_num > max_var)
+        batch_rows = max_var / column_num;
+    if (batch_rows == 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+static void sqlite_close(void)
+{
+    clear_stmts();
+    free(curr_table);
+    curr_table = NULL;
+
+    if (db)
+        sqlite3_close(db);
+    db = NULL;
+}
+
+static char const *affinity(struct column *curr)
+{
+    switch (curr->type)
+    {
+    case COLUMN_TYPE_TINY_INT:
+    case COLUMN_TYPE_SMALL_INT:
+    case COLUMN_TYPE_INT:
+    case COLUMN_TYPE_BIG_INT:
+        return "INTEGER";
+    case COLUMN_TYPE_FLOAT:
+    case COLUMN_TYPE_DOUBLE:
+        return "REAL";
+    case COLUMN_TYPE_BINARY:
+    case COLUMN_TYPE_VARBINARY:
+    case COLUMN_TYPE_TINY_BLOB:
+    case COLUMN_TYPE_BLOB:
+        return "BLOB";
+    default:
+        return "TEXT";
+    }
+}
+
+static int sqlite_create_table(char const *table)
+{
+    static char *sql;
+    static size_t sql_len;
+
+    size_t len = strlen(table) + 100;
+    struct column *curr;
+    for (curr = settings.columns; curr; curr = curr->next)
+        len += strlen(curr->name) * 2 + strlen(table) + 100;
+
+    if (auto_realloc((void **)&sql, &sql_len, len) == NULL)
+        return -__LINE__;
+
+    size_t use = snprintf(sql, sql_len, "CREATE TABLE IF NOT EXISTS `%s` (", table);
+    bool is_first = true;
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (curr->is_storage == false)
+            continue;
+
+        use += snprintf(sql + use, sql_len - use, "%s`%s` %s", is_first ? "" : ", ", curr->name, \
+                curr->is_auto_increment ? "INTEGER PRIMARY KEY AUTOINCREMENT" : affinity(curr));
+        is_first = false;
+    }
+    use += snprintf(sql + use, sql_len - use, ");");
+
+    for (curr = settings.columns; curr; curr = curr->next)
+    {
+        if (curr->is_storage && curr->is_index && !curr->is_auto_increment)
+        {
+            use += snprintf(sql + use, sql_len - use, \
+                    "CREATE INDEX IF NOT EXISTS `%s_%s` ON `%s` (`%s`);", \
+                    table, curr->name, table, curr->name);
+        }
+    }
+
+    log_info("worker: %d, sql: %s", settings.worker_id, sql);
+
+    return sqlite_exec(sql, use);
+}
+
+static int sqlite_drop_table(char const *table)
+{
+    char sql[30 + strlen(table)];
+    sprintf(sql, "DROP TABLE IF EXISTS `%s`", table);
+
+    log_debug("worker: %d, sql: %s", settings.worker_id, sql);
+
+    return sqlite_exec(sql, 0);
+}
+
+static sqlite3_stmt *get_stmt(int n)
+{
+    if (stmts[n])
+        return stmts[n];
+
+    size_t row_len = column_num * 2 + 3;
+    size_t len = strlen(curr_table) + settings.columns_str_len + row_len * n + 50;
+    char *sql = malloc(len);
+    if (sql == NULL)
+        return NULL;
+
+    size_t use = snprintf(sql, len, "INSERT INTO `%s` (%s) VALUES ", curr_table, settings.columns_str);
+    int i, j;
+    for (i = 0; i < n; ++i)
+    {
+        if (i)
+            sql[use++] = ',';
+        sql[use++] = '(';
+        for (j = 0; j < column_num; ++j)
+        {
+            if (j)
+                sql[use++] = ',';
+            sql[use++] = '?';
+        }
+        sql[use++] = ')';
+    }
+    sql[use] = '\0';
+
+    int ret = check(sqlite3_prepare_v2(db, sql, (int)use, &stmts[n], NULL));
+    free(sql);
+    if (ret < 0)
+        return NULL;
+
+    return stmts[n];
+}
+
+static int bind_value(sqlite3_stmt *stmt, int pos, struct sink_value const *v)
+{
+    switch (v->type)
+    {
+    case SINK_VALUE_NULL:
+        return check(sqlite3_bind_null(stmt, pos));
+    case SINK_VALUE_INT:
+        {
+            char str[32];
+            size_t n = v->len < sizeof(str) ? v->len : sizeof(str) - 1;
+            memcpy(str, v->str, n);
+            str[n] = '\0';
+
+            /* bigint unsigned above INT64_MAX wrap to negative */
+            if (str[0] == '-')
+                return check(sqlite3_bind_int64(stmt, pos, strtoll(str, NULL, 10)));
+
+            return check(sqlite3_bind_int64(stmt, pos, (sqlite3_int64)strtoull(str, NULL, 10)));
+        }
+    case SINK_VALUE_FLOAT:
+        {
+            char str[64];
+            size_t n = v->len < sizeof(str) ? v->len : sizeof(str) - 1;
+            memcpy(str, v->str, n);
+            str[n] = '\0';
+
+            return check(sqlite3_bind_double(stmt, pos, strtod(str, NULL)));
+        }
+    case SINK_VALUE_TEXT:
+        return check(sqlite3_bind_text(stmt, pos, v->str, (int)v->len, SQLITE_STATIC));
+    case SINK_VALUE_BLOB:
+        return check(sqlite3_bind_blob(stmt, pos, v->str, (int)v->len, SQLITE_STATIC));
+    }
+
+    return -__LINE__;
+}
+
+static int insert_rows_now(void)
+{
+    if (row_num == 0)
+        return 0;
+
+    sqlite3_stmt *stmt = get_stmt(row_num);
+    if (stmt == NULL)
+        return -__LINE__;
+
+    int pos = 1;
+    int i, j;
+    for (i = 0; i < row_num; ++i)
+    {
+        for (j = 0; j < column_num; ++j)
+        {
+            NEG_RET_LN(bind_value(stmt, pos++, &rows[i][j]));
+        }
+    }
+
+    int ret = check(sqlite3_step(stmt));
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+    if (ret < 0)
+        return -__LINE__;
+
+    insert_rows += row_num;
+    row_num = 0;
+
+    return 0;
+}
+
+static int sqlite_begin_batch(char const *table)
+{
+    /* last batch fail in the middle */
+    if (!sqlite3_get_autocommit(db))
+        sqlite_exec("ROLLBACK", 0);
+
+    if (curr_table == NULL || strcmp(curr_table, table) != 0)
+    {
+        clear_stmts();
+        free(curr_table);
+        if ((curr_table = strdup(table)) == NULL)
+            return -__LINE__;
+    }
+
+    row_num = 0;
+    insert_rows = 0;
+
+    return sqlite_exec("BEGIN", 0);
+}
+
+static int sqlite_append_row(struct sink_value const *values, int num)
+{
+    if (num != column_num)
+        return -__LINE__;
+
+    rows[row_num++] = values;
+    if (row_num == batch_rows)
+        NEG_RET_LN(insert_rows_now());
+
+    return 0;
+}
+
+static int sqlite_commit(void)
+{
+    NEG_RET_LN(insert_rows_now());
+    NEG_RET_LN(sqlite_exec("COMMIT", 0));
+
+    return insert_rows;
+}
+
+static int sqlite_error_class(void)
+{
+    switch (last_errcode & 0xff)
+    {
+    case SQLITE_BUSY:
+    case SQLITE_LOCKED:
+    case SQLITE_IOERR:
+    case SQLITE_FULL:
+    case SQLITE_CANTOPEN:
+        return SINK_ERR_RETRY;
+    }
+
+    return SINK_ERR_FATAL;
+}
+
+static char const *sqlite_error(void)
+{
+    if (db == NULL)
+        return sqlite3_errstr(last_errcode);
+
+    return sqlite3_errmsg(db);
+}
+
+struct sink const sqlite_sink =
+{
+    .name           = "sqlite",
+    .open           = sqlite_open,
+    .close          = sqlite_close,
+    .create_table   = sqlite_create_table,
+    .drop_table     = sqlite_drop_table,
+    .exec           = sqlite_exec,
+    .begin_batch    = sqlite_begin_batch,
+    .append_row     = sqlite_append_row,
+    .commit         = sqlite_commit,
+    .error_class    = sqlite_error_class,
+    .error          = sqlite_error,
+};
@@ -0,0 +1,182 @@
+/*
+ * Description: encoder benchmark, the generated encode_log against a
+ *              runtime encoder which walk a field table per record with
+ *              add_* of serialize.c, both must give the same bytes.
+ */
+
+/* generated by ./logdb -c test/api_bench.ini --api, first as it define _GNU_SOURCE */
+# include "log_bench_api.c"
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <stddef.h>
+# include <string.h>
+# include <sys/time.h>
+
+# include "serialize.h"
+
+# define LOG_NUM        1024
+# define BENCH_NUM      5000000
+
+enum
+{
+    FIELD_U64,
+    FIELD_I32,
+    FIELD_I8,
+    FIELD_DOUBLE,
+    FIELD_STR1,
+    FIELD_STR2,
+    FIELD_BIN2,
+};
+
+struct field
+{
+    int     type;
+    size_t  offset;
+    size_t  len_offset;
+    size_t  max;
+};
+
+# define FIELD(t, name)             { t, offsetof(log_bench, name), 0, 0 }
+# define FIELD_LEN(t, name, max)    { t, offsetof(log_bench, name), offsetof(log_bench, name ## _len), max }
+
+static struct field fields[] =
+{
+    FIELD(FIELD_U64, uid),
+    FIELD(FIELD_I32, score),
+    FIELD(FIELD_I8, level),
+    FIELD(FIELD_DOUBLE, ratio),
+    FIELD_LEN(FIELD_STR2, name, 64),
+    FIELD_LEN(FIELD_STR1, tag, 16),
+    FIELD_LEN(FIELD_BIN2, data, 128),
+    FIELD_LEN(FIELD_STR1, day, 19),
+};
+
+static int runtime_encode_log(uint8_t *buf, log_bench const *log)
+{
+    void *p = buf;
+    int len = LOGDB_RECORD_MAX_LEN;
+    char const *base = (char const *)log;
+
+    size_t i;
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); ++i)
+    {
+        struct field *f = &fields[i];
+        void *v = (void *)(base + f->offset);
+        size_t n = 0;
+
+        if (f->type == FIELD_STR1)
+            n = *(uint8_t *)(base + f->len_offset);
+        else if (f->type == FIELD_STR2 || f->type == FIELD_BIN2)
+            memcpy(&n, base + f->len_offset, sizeof(uint16_t));
+        if (n > f->max)
+            n = f->max;
+
+        int ret = 0;
+        switch (f->type)
+        {
+        case FIELD_U64:
+            ret = add_uint64(&p, &len, *(uint64_t *)v);
+            break;
+        case FIELD_I32:
+            ret = add_int32(&p, &len, *(int32_t *)v);
+            break;
+        case FIELD_I8:
+            ret = add_int8(&p, &len, *(int8_t *)v);
+            break;
+        case FIELD_DOUBLE:
+            ret = add_double(&p, &len, *(double *)v);
+            break;
+        case FIELD_STR1:
+            ret = add_bin1(&p, &len, v, n);
+            break;
+        case FIELD_STR2:
+        case FIELD_BIN2:
+            ret = add_bin2(&p, &len, v, n);
+            break;
+        }
+
+        if (ret < 0)
+            return -__LINE__;
+    }
+
+    return LOGDB_RECORD_MAX_LEN - len;
+}
+
+static double now_ns(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+}
+
+static void fill(log_bench *log, int i)
+{
+    memset(log, 0, sizeof(*log));
+
+    log->uid = 1000000007ull * i;
+    log->score = i * 37 - 5000;
+    log->level = (int8_t)(i % 7 - 3);
+    log->ratio = i / 3.0;
+    log->name_len = (uint16_t)snprintf(log->name, sizeof(log->name), "user_%d_%.*s", \
+            i, i % 40, "abcdefghijklmnopqrstuvwxyzabcdefghijklmnopqrstuvwxyz");
+    log->tag_len = (uint8_t)snprintf(log->tag, sizeof(log->tag), "tag%d", i % 100);
+    log->data_len = (uint16_t)(i % 129);
+    memset(log->data, i & 0xff, log->data_len);
+    log->day_len = (uint8_t)snprintf(log->day, sizeof(log->day), "2013-02-%02d 12:00:00", i % 28 + 1);
+}
+
+static log_bench logs[LOG_NUM];
+
+static double bench(char const *name, int (*encode)(uint8_t *, log_bench const *))
+{
+    uint8_t buf[LOGDB_RECORD_MAX_LEN];
+    uint64_t bytes = 0;
+
+    double start = now_ns();
+
+    int i;
+    for (i = 0; i < BENCH_NUM; ++i)
+    {
+        bytes += encode(buf, &logs[i % LOG_NUM]);
+        bytes += buf[i % 8];
+    }
+
+    double cost = (now_ns() - start) / BENCH_NUM;
+    printf("%s: %.1f ns per record (%lu)\n", name, cost, (unsigned long)(bytes & 1));
+
+    return cost;
+}
+
+int main(void)
+{
+    int ret = 0;
+    int i;
+    for (i = 0; i < LOG_NUM; ++i)
+    {
+        fill(&logs[i], i);
+
+        uint8_t a[LOGDB_RECORD_MAX_LEN];
+        uint8_t b[LOGDB_RECORD_MAX_LEN];
+        int alen = encode_log(a, &logs[i]);
+        int blen = runtime_encode_log(b, &logs[i]);
+
+        if (alen != blen || memcmp(a, b, alen) != 0)
+        {
+            if (ret++ < 5)
+                printf("record %d differ: generated %d bytes, runtime %d bytes\n", i, alen, blen);
+        }
+    }
+
+    printf("encode: %d records, %s\n", LOG_NUM, ret ? "differ" : "same bytes");
+
+    double generated = bench("generated", encode_log);
+    double runtime = bench("runtime", runtime_encode_log);
+    printf("speedup: %.2fx\n", runtime / generated);
+
+    printf("%s\n", ret ? "FAIL" : "PASS");
+
+    return ret ? 1 : 0;
+}
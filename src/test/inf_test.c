@@ -0,0 +1,347 @@
+/*
+ * Description: full batch through loginf, packages filled by send_<name>_logs
+ *              and the async flusher to the client limit are forwarded whole
+ *              with the client addr added, a package too large is rejected.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+# include <limits.h>
+# include <unistd.h>
+# include <signal.h>
+# include <poll.h>
+# include <dirent.h>
+# include <sys/socket.h>
+# include <arpa/inet.h>
+# include <netinet/in.h>
+
+# include "protocol.h"
+# include "log_bench_api.h"
+
+# define INF_PORT       22997
+# define RECEIVER_PORT  22998
+# define LOG_NUM        1000
+# define SEND_NUM       300
+
+static char test_dir[] = "/tmp/logdb_inf_test_XXXXXX";
+static log_bench logs[LOG_NUM];
+
+static struct sockaddr_in make_addr(uint16_t port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    return addr;
+}
+
+static int bind_udp(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -__LINE__;
+
+    int size = 8 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    struct sockaddr_in addr = make_addr(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -__LINE__;
+    }
+
+    return fd;
+}
+
+static int recv_timeout(int fd, uint8_t *buf, size_t size, int timeout_ms)
+{
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return -1;
+
+    return (int)recv(fd, buf, size, 0);
+}
+
+/* the daemon whose command line has conf */
+static pid_t find_pid(char const *conf)
+{
+    DIR *dir = opendir("/proc");
+    if (dir == NULL)
+        return -__LINE__;
+
+    pid_t pid = -__LINE__;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "/proc/%s/cmdline", entry->d_name);
+
+        FILE *fp = fopen(path, "r");
+        if (fp == NULL)
+            continue;
+
+        char cmdline[PATH_MAX * 2] = { 0 };
+        size_t n = fread(cmdline, 1, sizeof(cmdline) - 1, fp);
+        fclose(fp);
+
+        /* args are separated by '\0' */
+        size_t i;
+        for (i = 0; i < n; ++i)
+        {
+            if (cmdline[i] == 0)
+                cmdline[i] = ' ';
+        }
+
+        if (strstr(cmdline, "loginf") && strstr(cmdline, conf))
+        {
+            pid = (pid_t)atoi(entry->d_name);
+            break;
+        }
+    }
+    closedir(dir);
+
+    return pid;
+}
+
+/* start loginf as daemon, return its pid */
+static pid_t start_inf(void)
+{
+    char conf[PATH_MAX];
+    snprintf(conf, sizeof(conf), "%s/inf.ini", test_dir);
+
+    FILE *fp = fopen(conf, "w");
+    if (fp == NULL)
+        return -__LINE__;
+
+    fprintf(fp, "server name = inf_test\n");
+    fprintf(fp, "listen port = %d\n", INF_PORT);
+    fprintf(fp, "return pkg = true\n");
+    fprintf(fp, "receivers = 127.0.0.1:%d\n", RECEIVER_PORT);
+    fprintf(fp, "receiver reply time out = 60000\n");
+    fprintf(fp, "default log path = %s/default\n", test_dir);
+    fprintf(fp, "queue bin file path = %s/queue\n", test_dir);
+    fclose(fp);
+
+    /* return after daemon */
+    char cmd[PATH_MAX * 2];
+    snprintf(cmd, sizeof(cmd), "./loginf -c %s > %s/out 2>&1", conf, test_dir);
+    if (system(cmd) != 0)
+        return -__LINE__;
+
+    /* wait its threads start */
+    usleep(300 * 1000);
+
+    return find_pid(conf);
+}
+
+static void stop_inf(pid_t pid)
+{
+    kill(pid, SIGQUIT);
+
+    int i;
+    for (i = 0; i < 20 && kill(pid, 0) == 0; ++i)
+        usleep(100 * 1000);
+    kill(pid, SIGKILL);
+}
+
+/* 229 bytes with length, 286 of them fill a batch to 65504 bytes, which is
+ * over the limit after loginf add client addr */
+static void fill(log_bench *log, int i)
+{
+    memset(log, 0, sizeof(*log));
+
+    log->uid = i;
+    log->score = -i;
+    log->level = (int8_t)(i % 5);
+    log->ratio = i / 7.0;
+    log->name_len = 64;
+    memset(log->name, 'n', 64);
+    log->tag_len = 16;
+    memset(log->tag, 't', 16);
+    log->data_len = 101;
+    memset(log->data, i & 0xff, 101);
+    log->day_len = 19;
+    memcpy(log->day, "2013-06-25 12:00:00", 19);
+}
+
+static uint16_t get_u16(uint8_t const *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+/* every log arrive at receiver, in full packages under the udp limit */
+static int check_forward(int receiver)
+{
+    int i;
+    for (i = 0; i < LOG_NUM; ++i)
+        fill(&logs[i], i);
+
+    /* a few at a time, a burst of 64 KB datagrams overflow socket buffer */
+    struct sockaddr_in addr = make_addr(INF_PORT);
+    for (i = 0; i < LOG_NUM; i += SEND_NUM)
+    {
+        int n = LOG_NUM - i < SEND_NUM ? LOG_NUM - i : SEND_NUM;
+        if (send_bench_logs(&addr, logs + i, n) < 0)
+            return -__LINE__;
+        usleep(20 * 1000);
+    }
+
+    static uint8_t buf[UINT16_MAX + 1];
+    int pkg_num = 0, full_num = 0, log_num = 0;
+
+    while (log_num < LOG_NUM)
+    {
+        int len = recv_timeout(receiver, buf, sizeof(buf), 3000);
+        if (len < 0)
+            break;
+
+        size_t echo_len = get_u16(buf + 6);
+        size_t pos = PROTOCOL_HEAD_LEN + echo_len;
+        if (buf[1] != COMMAND_LOG_BATCH || echo_len != sizeof(struct inner_addr) || \
+                (size_t)len < pos + 2 || len > PROTOCOL_PKG_MAX_LEN)
+            return -__LINE__;
+
+        /* a record is less than 300 bytes */
+        if (len > PROTOCOL_PKG_MAX_LEN - 300)
+            ++full_num;
+        log_num += get_u16(buf + pos);
+        ++pkg_num;
+    }
+
+    printf("forward: %d logs in %d packages, %d near the udp limit, %d arrive\n", \
+            LOG_NUM, pkg_num, full_num, log_num);
+
+    if (log_num != LOG_NUM || full_num == 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+/* the async flusher fill packages to the same limit */
+static int check_async(int receiver)
+{
+    struct sockaddr_in addr = make_addr(INF_PORT);
+    if (send_bench_log_async_init(&addr) < 0)
+        return -__LINE__;
+
+    int i;
+    for (i = 0; i < LOG_NUM; ++i)
+    {
+        if (send_bench_log_async(&logs[i]) < 0)
+            return -__LINE__;
+        if (i % SEND_NUM == SEND_NUM - 1)
+            usleep(30 * 1000);
+    }
+
+    if (send_bench_log_async_fini() < 0)
+        return -__LINE__;
+
+    static uint8_t buf[UINT16_MAX + 1];
+    int pkg_num = 0, full_num = 0, log_num = 0;
+
+    while (log_num < LOG_NUM)
+    {
+        int len = recv_timeout(receiver, buf, sizeof(buf), 3000);
+        if (len < 0)
+            break;
+
+        size_t pos = PROTOCOL_HEAD_LEN + get_u16(buf + 6);
+        if (buf[1] != COMMAND_LOG_BATCH || (size_t)len < pos + 2)
+            return -__LINE__;
+
+        if (len > PROTOCOL_PKG_MAX_LEN - 300)
+            ++full_num;
+        log_num += get_u16(buf + pos);
+        ++pkg_num;
+    }
+
+    uint64_t sent, dropped;
+    send_bench_log_async_stat(&sent, &dropped);
+
+    printf("async: %d logs in %d packages, %d near the udp limit, %d arrive, "
+            "sent %lu, dropped %lu\n", LOG_NUM, pkg_num, full_num, log_num, \
+            (unsigned long)sent, (unsigned long)dropped);
+
+    if (log_num != LOG_NUM || full_num == 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+/* a package of max udp payload can't take the client addr, loginf reject it */
+static int check_reject(int receiver)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -__LINE__;
+
+    static uint8_t pkg[PROTOCOL_PKG_MAX_LEN];
+    memset(pkg, 0, sizeof(pkg));
+    pkg[1] = COMMAND_LOG_BATCH;
+    pkg[5] = 1;
+
+    struct sockaddr_in addr = make_addr(INF_PORT);
+    if (sendto(fd, pkg, sizeof(pkg), 0, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        close(fd);
+        return -__LINE__;
+    }
+
+    uint8_t reply[UINT16_MAX];
+    int len = recv_timeout(fd, reply, sizeof(reply), 3000);
+    close(fd);
+
+    int forwarded = recv_timeout(receiver, pkg, sizeof(pkg), 500);
+
+    printf("reject: reply %d bytes, result %d, forwarded %s\n", len, \
+            len >= PROTOCOL_HEAD_LEN ? reply[0] : -1, forwarded < 0 ? "no" : "yes");
+
+    if (len < PROTOCOL_HEAD_LEN || reply[0] != RESULT_PKG_FMT_ERROR || forwarded >= 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+int main(void)
+{
+    if (mkdtemp(test_dir) == NULL)
+        return 1;
+
+    int ret = 0;
+    int receiver = bind_udp(RECEIVER_PORT);
+    pid_t pid = receiver < 0 ? -1 : start_inf();
+
+    if (pid <= 0)
+    {
+        printf("start loginf fail: %d\n", pid);
+        ret = 1;
+    }
+    else
+    {
+        if (check_forward(receiver) < 0)
+            ret = 1;
+        if (check_async(receiver) < 0)
+            ret = 1;
+        if (check_reject(receiver) < 0)
+            ret = 1;
+
+        stop_inf(pid);
+    }
+
+    if (receiver >= 0)
+        close(receiver);
+
+    char cmd[PATH_MAX];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", test_dir);
+    if (system(cmd) != 0)
+        ret = 1;
+
+    printf("%s\n", ret ? "FAIL" : "PASS");
+
+    return ret;
+}
@@ -0,0 +1,296 @@
+/*
+ * Description: multi writer queue test, producer processes push records
+ *              to a small share memory queue which spill to file, reader
+ *              check every record arrive once and intact. Then throughput
+ *              of a memory only queue by 1, 2 and 4 producers.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <stddef.h>
+# include <inttypes.h>
+# include <string.h>
+# include <unistd.h>
+# include <sys/ipc.h>
+# include <sys/shm.h>
+# include <sys/wait.h>
+# include <sys/time.h>
+
+# include "queue.h"
+
+# define STRESS_PROC_NUM    4
+# define STRESS_NUM         200000
+# define STRESS_MEM_SIZE    (64 * 1024)
+# define BENCH_NUM          1000000
+# define BENCH_MEM_SIZE     (64 * 1024 * 1024)
+# define BENCH_RECORD_SIZE  64
+# define PAYLOAD_MAX        200
+
+struct record
+{
+    uint32_t    producer;
+    uint32_t    seq;
+    uint8_t     payload[PAYLOAD_MAX];
+};
+
+static char queue_file[] = "/tmp/logdb_queue_test_XXXXXX";
+static char stress_name[] = "mp_test";
+static char bench_name[] = "mp_bench";
+
+static double now_sec(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static key_t test_key(int i)
+{
+    return 0x7e570000 + ((getpid() & 0xfff) << 4) + i;
+}
+
+static void remove_shm(key_t key)
+{
+    int shm_id = shmget(key, 0, 0);
+    if (shm_id >= 0)
+        shmctl(shm_id, IPC_RMID, NULL);
+}
+
+static uint32_t payload_len(uint32_t producer, uint32_t seq)
+{
+    return (producer * 31 + seq) % PAYLOAD_MAX;
+}
+
+static void fill(struct record *r, uint32_t producer, uint32_t seq)
+{
+    r->producer = producer;
+    r->seq = seq;
+
+    uint32_t i, len = payload_len(producer, seq);
+    for (i = 0; i < len; ++i)
+        r->payload[i] = (uint8_t)(producer + seq + i);
+}
+
+static int push_all(key_t key, uint32_t producer, uint32_t num, uint32_t fixed_size)
+{
+    queue_t queue;
+    if (queue_attach(&queue, NULL, key) < 0)
+        return -__LINE__;
+
+    struct record r;
+    uint32_t seq;
+    for (seq = 0; seq < num; ++seq)
+    {
+        uint32_t size = fixed_size;
+        if (size == 0)
+        {
+            fill(&r, producer, seq);
+            size = offsetof(struct record, payload) + payload_len(producer, seq);
+        }
+        else
+        {
+            r.producer = producer;
+            r.seq = seq;
+        }
+
+        int ret;
+        while ((ret = queue_push(&queue, &r, size)) == -1)
+            usleep(10);
+        if (ret < 0)
+            return -__LINE__;
+    }
+
+    return 0;
+}
+
+static int start_producers(key_t key, int proc_num, uint32_t num, uint32_t fixed_size)
+{
+    int i;
+    for (i = 0; i < proc_num; ++i)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+            return -__LINE__;
+        if (pid == 0)
+            _exit(push_all(key, i, num, fixed_size) < 0 ? 1 : 0);
+    }
+
+    return 0;
+}
+
+static int wait_producers(void)
+{
+    int ret = 0;
+    int status;
+    while (wait(&status) > 0)
+    {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            ret = -__LINE__;
+    }
+
+    return ret;
+}
+
+/* max records in file seen by reader */
+static uint32_t file_num_max;
+
+/* pop total records, stop if nothing arrive in 10s */
+static int pop_all(queue_t *queue, uint64_t total, int (*check)(void *, uint32_t))
+{
+    uint64_t num = 0;
+    file_num_max = 0;
+    double last = now_sec();
+
+    while (num < total)
+    {
+        void *data;
+        uint32_t size;
+        int ret = queue_pop(queue, &data, &size);
+        if (ret == -1)
+        {
+            if (now_sec() - last > 10)
+                return -__LINE__;
+            queue_wait(queue, 100);
+
+            continue;
+        }
+        if (ret < 0)
+            return -__LINE__;
+
+        if (check && check(data, size) < 0)
+            return -__LINE__;
+
+        if ((num & 1023) == 0)
+        {
+            uint32_t mem_num, mem_size, file_num;
+            uint64_t file_size;
+            queue_stat(queue, &mem_num, &mem_size, &file_num, &file_size);
+            if (file_num > file_num_max)
+                file_num_max = file_num;
+        }
+
+        last = now_sec();
+        ++num;
+    }
+
+    return 0;
+}
+
+static uint8_t *seen;
+
+static int check_record(void *data, uint32_t size)
+{
+    struct record *r = data;
+    if (size < offsetof(struct record, payload) || r->producer >= STRESS_PROC_NUM || \
+            r->seq >= STRESS_NUM)
+        return -__LINE__;
+
+    uint32_t i, len = payload_len(r->producer, r->seq);
+    if (size != offsetof(struct record, payload) + len)
+        return -__LINE__;
+
+    for (i = 0; i < len; ++i)
+    {
+        if (r->payload[i] != (uint8_t)(r->producer + r->seq + i))
+            return -__LINE__;
+    }
+
+    uint8_t *s = &seen[(size_t)r->producer * STRESS_NUM + r->seq];
+    if (*s)
+        return -__LINE__;
+    *s = 1;
+
+    return 0;
+}
+
+static int stress(void)
+{
+    key_t key = test_key(0);
+    remove_shm(key);
+
+    queue_t queue;
+    if (queue_init_mp(&queue, stress_name, key, STRESS_MEM_SIZE, queue_file, 0) < 0)
+        return -__LINE__;
+
+    seen = calloc((size_t)STRESS_PROC_NUM * STRESS_NUM, 1);
+    if (seen == NULL)
+        return -__LINE__;
+
+    int ret = start_producers(key, STRESS_PROC_NUM, STRESS_NUM, 0);
+    if (ret == 0)
+        ret = pop_all(&queue, (uint64_t)STRESS_PROC_NUM * STRESS_NUM, check_record);
+    if (wait_producers() < 0 && ret == 0)
+        ret = -__LINE__;
+
+    uint32_t mem_num, mem_size, file_num;
+    uint64_t file_size;
+    queue_stat(&queue, &mem_num, &mem_size, &file_num, &file_size);
+
+    printf("stress: %d producers, %d records each, %s, max %u in file, "
+            "left mem %u/%u, file %u/%"PRIu64"\n", STRESS_PROC_NUM, STRESS_NUM, \
+            ret ? "lost or broken" : "all arrive once", file_num_max, \
+            mem_num, mem_size, file_num, file_size);
+
+    if (ret == 0 && (mem_num || mem_size || file_num || file_size || queue_num(&queue)))
+        ret = -__LINE__;
+
+    free(seen);
+    queue_fini(&queue);
+    remove_shm(key);
+    unlink(queue_file);
+
+    return ret;
+}
+
+static int bench(int proc_num)
+{
+    key_t key = test_key(proc_num);
+    remove_shm(key);
+
+    queue_t queue;
+    if (queue_init_mp(&queue, bench_name, key, BENCH_MEM_SIZE, NULL, 0) < 0)
+        return -__LINE__;
+
+    uint64_t total = (uint64_t)proc_num * BENCH_NUM;
+    double start = now_sec();
+
+    int ret = start_producers(key, proc_num, BENCH_NUM, BENCH_RECORD_SIZE);
+    if (ret == 0)
+        ret = pop_all(&queue, total, NULL);
+    if (wait_producers() < 0 && ret == 0)
+        ret = -__LINE__;
+
+    double cost = now_sec() - start;
+    printf("bench: %d producers, %d bytes record, %.2f M records/s, %.1f ns per record\n", \
+            proc_num, BENCH_RECORD_SIZE, total / cost / 1e6, cost * 1e9 / total);
+
+    queue_fini(&queue);
+    remove_shm(key);
+
+    return ret;
+}
+
+int main(void)
+{
+    int fd = mkstemp(queue_file);
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    int ret = 0;
+    if (stress() < 0)
+        ret = 1;
+
+    int n;
+    for (n = 1; n <= 4; n *= 2)
+    {
+        if (bench(n) < 0)
+            ret = 1;
+    }
+
+    printf("%s\n", ret ? "FAIL" : "PASS");
+
+    return ret;
+}
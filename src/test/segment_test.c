@@ -0,0 +1,234 @@
+/*
+ * Description: segment sink test, a batch of integer, dictionary and plain
+ *              string, float and blob columns is written by segment sink
+ *              and read back by segment_load value by value. A truncated
+ *              segment fail to load, error of a failed row is cleared by
+ *              the next batch.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+# include <limits.h>
+# include <dirent.h>
+# include <unistd.h>
+
+# include "conf.h"
+# include "sink.h"
+# include "segment.h"
+
+# define ROW_NUM        400
+# define COLUMN_NUM     6
+# define VALUE_LEN      64
+
+struct settings settings;
+
+static char test_dir[] = "/tmp/logdb_segment_test_XXXXXX";
+
+static struct column test_columns[COLUMN_NUM] =
+{
+    { .name = (char *)"id",     .type = COLUMN_TYPE_BIG_INT,    .is_storage = true },
+    { .name = (char *)"uid",    .type = COLUMN_TYPE_BIG_INT,    .is_storage = true, .is_unsigned = true },
+    { .name = (char *)"level",  .type = COLUMN_TYPE_VARCHAR,    .is_storage = true },
+    { .name = (char *)"msg",    .type = COLUMN_TYPE_VARCHAR,    .is_storage = true },
+    { .name = (char *)"cost",   .type = COLUMN_TYPE_DOUBLE,     .is_storage = true },
+    { .name = (char *)"data",   .type = COLUMN_TYPE_BLOB,       .is_storage = true },
+};
+
+static char strs[ROW_NUM][COLUMN_NUM][VALUE_LEN];
+static struct sink_value values[ROW_NUM][COLUMN_NUM];
+
+static void set_value(int row, int col, int type, size_t len)
+{
+    values[row][col].type = type;
+    values[row][col].str = strs[row][col];
+    values[row][col].len = len;
+}
+
+/* level has 3 distinct values so it is dictionary encoded, msg is plain */
+static void make_rows(void)
+{
+    static char const *levels[] = { "info", "warn", "error" };
+
+    int i;
+    for (i = 0; i < ROW_NUM; ++i)
+    {
+        int64_t id = (i % 2 ? -1 : 1) * (int64_t)i * 1000003;
+        if (i == 7)
+            id = INT64_MIN;
+        if (i == 8)
+            id = INT64_MAX;
+        set_value(i, 0, SINK_VALUE_INT, sprintf(strs[i][0], "%lld", (long long)id));
+
+        uint64_t uid = i == 9 ? UINT64_MAX : (uint64_t)i << 40;
+        set_value(i, 1, SINK_VALUE_INT, sprintf(strs[i][1], "%llu", (unsigned long long)uid));
+
+        set_value(i, 2, SINK_VALUE_TEXT, sprintf(strs[i][2], "%s", levels[i % 3]));
+        set_value(i, 3, SINK_VALUE_TEXT, sprintf(strs[i][3], "it's row %d\n", i));
+        set_value(i, 4, SINK_VALUE_FLOAT, sprintf(strs[i][4], "%g", i * -0.25));
+
+        int j;
+        for (j = 0; j < 8; ++j)
+            strs[i][5][j] = (char)(i + j * 37);
+        set_value(i, 5, SINK_VALUE_BLOB, 8);
+    }
+}
+
+static int segment_file(char const *table, char *path, size_t len)
+{
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s/%s", test_dir, table);
+
+    DIR *d = opendir(dir);
+    if (d == NULL)
+        return -__LINE__;
+
+    int num = 0;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+            continue;
+
+        snprintf(path, len, "%s/%s", dir, entry->d_name);
+        ++num;
+    }
+    closedir(d);
+
+    return num == 1 ? 0 : -__LINE__;
+}
+
+static int check_round_trip(void)
+{
+    if (segment_sink.begin_batch("log_20240101") < 0)
+        return -__LINE__;
+
+    int i;
+    for (i = 0; i < ROW_NUM; ++i)
+    {
+        if (segment_sink.append_row(values[i], COLUMN_NUM) < 0)
+            return -__LINE__;
+    }
+
+    int ret = segment_sink.commit();
+    if (ret != ROW_NUM)
+    {
+        printf("commit: %d, %s\n", ret, segment_sink.error());
+        return -__LINE__;
+    }
+
+    char path[PATH_MAX];
+    if (segment_file("log_20240101", path, sizeof(path)) < 0)
+        return -__LINE__;
+
+    struct sink_rows rows;
+    if ((ret = segment_load(path, &rows)) < 0)
+    {
+        printf("load %s: %d\n", path, ret);
+        return -__LINE__;
+    }
+
+    if (strcmp(rows.table, "log_20240101") != 0 || rows.row_num != ROW_NUM || rows.column_num != COLUMN_NUM)
+        return -__LINE__;
+
+    int bad = 0;
+    for (i = 0; i < ROW_NUM * COLUMN_NUM; ++i)
+    {
+        struct sink_value const *a = &values[i / COLUMN_NUM][i % COLUMN_NUM];
+        struct sink_value const *b = &rows.values[i];
+        if (a->type != b->type || a->len != b->len || memcmp(a->str, b->str, a->len) != 0)
+        {
+            if (bad++ < 5)
+                printf("row %d column %s: %.*s != %.*s\n", i / COLUMN_NUM, test_columns[i % COLUMN_NUM].name, \
+                        (int)a->len, a->str, (int)b->len, b->str);
+        }
+    }
+
+    printf("round trip: %d rows, %d bad values\n", ROW_NUM, bad);
+
+    return bad ? -__LINE__ : 0;
+}
+
+static int check_truncated(void)
+{
+    char path[PATH_MAX];
+    if (segment_file("log_20240101", path, sizeof(path)) < 0)
+        return -__LINE__;
+
+    FILE *fp = fopen(path, "r+");
+    if (fp == NULL)
+        return -__LINE__;
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    fclose(fp);
+
+    if (truncate(path, size - 20) < 0)
+        return -__LINE__;
+
+    struct sink_rows rows;
+    if (segment_load(path, &rows) >= 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+static int check_error_reset(void)
+{
+    if (segment_sink.begin_batch("log_20240102") < 0)
+        return -__LINE__;
+
+    if (segment_sink.append_row(values[0], COLUMN_NUM - 1) >= 0)
+        return -__LINE__;
+    if (segment_sink.error_class() != SINK_ERR_FATAL || segment_sink.error()[0] == '\0')
+        return -__LINE__;
+
+    printf("bad row: %s\n", segment_sink.error());
+
+    if (segment_sink.begin_batch("log_20240102") < 0)
+        return -__LINE__;
+    if (segment_sink.error()[0] != '\0')
+        return -__LINE__;
+
+    return 0;
+}
+
+int main(void)
+{
+    if (mkdtemp(test_dir) == NULL)
+        return 1;
+
+    int i;
+    for (i = 0; i < COLUMN_NUM - 1; ++i)
+        test_columns[i].next = &test_columns[i + 1];
+    settings.columns = test_columns;
+    settings.segment_path = test_dir;
+
+    make_rows();
+
+    int ret = 0;
+    if (segment_sink.open() < 0)
+    {
+        ret = 1;
+    }
+    else
+    {
+        if (check_round_trip() < 0)
+            ret = 1;
+        if (ret == 0 && check_truncated() < 0)
+            ret = 1;
+        if (check_error_reset() < 0)
+            ret = 1;
+
+        segment_sink.close();
+    }
+
+    char cmd[PATH_MAX];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", test_dir);
+    if (system(cmd) != 0)
+        ret = 1;
+
+    printf("%s\n", ret ? "FAIL" : "PASS");
+
+    return ret;
+}
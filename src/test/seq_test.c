@@ -0,0 +1,182 @@
+/*
+ * Description: global sequence test, ids of processes sharing a sequence
+ *              file or having their own snowflake instance id are unique,
+ *              and ns per id of both types.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/wait.h>
+# include <sys/time.h>
+
+# include "conf.h"
+# include "seq.h"
+
+# define PROC_NUM       4
+# define ID_NUM         200000
+# define BENCH_NUM      5000000
+
+struct settings settings;
+
+static char seq_file[] = "/tmp/logdb_seq_test_XXXXXX";
+
+static int cmp_id(const void *a, const void *b)
+{
+    uint64_t x = *(uint64_t *)a;
+    uint64_t y = *(uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double now_ns(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+}
+
+/* each process write its ids to ids[i * ID_NUM ...], check all are unique */
+static int check_unique(char const *name, int type)
+{
+    size_t size = sizeof(uint64_t) * PROC_NUM * ID_NUM;
+    uint64_t *ids = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ids == MAP_FAILED)
+        return -__LINE__;
+
+    int i, j;
+    for (i = 0; i < PROC_NUM; ++i)
+    {
+        pid_t pid = fork();
+        if (pid < 0)
+            return -__LINE__;
+        if (pid > 0)
+            continue;
+
+        /* as separate instances, init in each process */
+        settings.global_sequence_type = type;
+        settings.global_sequence_instance_id = i;
+        if (sequence_init() < 0)
+            _exit(1);
+
+        uint64_t *out = ids + (size_t)i * ID_NUM;
+        for (j = 0; j < ID_NUM; ++j)
+        {
+            out[j] = sequence_get();
+
+            /* give back some, the next get reuse it */
+            if (j % 7 == 3)
+            {
+                sequence_dec();
+                if (sequence_get() != out[j] && type == SEQUENCE_BY_FILE)
+                    _exit(2);
+            }
+
+            if (out[j] == 0 || (j && out[j] <= out[j - 1]))
+                _exit(3);
+        }
+
+        sequence_fini();
+        _exit(0);
+    }
+
+    int ret = 0;
+    int status;
+    while (wait(&status) > 0)
+    {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            printf("%s: child fail: %d\n", name, WEXITSTATUS(status));
+            ret = -__LINE__;
+        }
+    }
+
+    size_t num = (size_t)PROC_NUM * ID_NUM;
+    qsort(ids, num, sizeof(uint64_t), cmp_id);
+
+    size_t dup = 0;
+    for (j = 1; (size_t)j < num; ++j)
+    {
+        if (ids[j] == ids[j - 1])
+            ++dup;
+    }
+
+    printf("%s: %d processes, %zu ids, %zu duplicate\n", name, PROC_NUM, num, dup);
+    if (dup)
+        ret = -__LINE__;
+
+    munmap(ids, size);
+
+    return ret;
+}
+
+/* the rest of the last block is skipped after restart */
+static int check_restart(void)
+{
+    settings.global_sequence_type = SEQUENCE_BY_FILE;
+    if (sequence_init() < 0)
+        return -__LINE__;
+    uint64_t last = sequence_get();
+    sequence_fini();
+
+    if (sequence_init() < 0)
+        return -__LINE__;
+    uint64_t next = sequence_get();
+    sequence_fini();
+
+    printf("restart: last %lu, next %lu\n", (unsigned long)last, (unsigned long)next);
+    if (next != last - 1 + settings.global_sequence_lease_size + 1)
+        return -__LINE__;
+
+    return 0;
+}
+
+static void bench(char const *name, int type)
+{
+    settings.global_sequence_type = type;
+    sequence_init();
+
+    uint64_t sum = 0;
+    double start = now_ns();
+
+    int i;
+    for (i = 0; i < BENCH_NUM; ++i)
+        sum += sequence_get();
+
+    double cost = now_ns() - start;
+    sequence_fini();
+
+    printf("%s: %.1f ns per id (%lu)\n", name, cost / BENCH_NUM, (unsigned long)(sum & 1));
+}
+
+int main(void)
+{
+    int fd = mkstemp(seq_file);
+    if (fd < 0)
+        return 1;
+    close(fd);
+
+    settings.global_sequence_file = seq_file;
+    settings.global_sequence_lease_size = 100;
+
+    int ret = 0;
+    if (check_unique("file", SEQUENCE_BY_FILE) < 0)
+        ret = 1;
+    if (check_unique("snowflake", SEQUENCE_BY_TIME) < 0)
+        ret = 1;
+    if (check_restart() < 0)
+        ret = 1;
+
+    settings.global_sequence_lease_size = 1000;
+    bench("file, lease 1000", SEQUENCE_BY_FILE);
+    bench("snowflake", SEQUENCE_BY_TIME);
+
+    unlink(seq_file);
+
+    printf("%s\n", ret ? "FAIL" : "PASS");
+
+    return ret;
+}
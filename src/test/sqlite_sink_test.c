@@ -0,0 +1,238 @@
+/*
+ * Description: sqlite sink test, INSERT statements of mysql dialect go
+ *              through sink_insert to a temp sqlite file, then every row
+ *              is read back and compared: quotes and escapes, unhex blob,
+ *              NULL, negative integers and floats, and a batch larger
+ *              than a prepared statement.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <string.h>
+# include <limits.h>
+
+# include <sqlite3.h>
+
+# include "conf.h"
+# include "sink.h"
+
+# define TABLE          "log_20240101"
+# define COLUMNS        "`id`,`name`,`data`,`num`,`cost`"
+# define BIG_ROW_NUM    200
+
+static char test_dir[] = "/tmp/logdb_sqlite_test_XXXXXX";
+static char db_file[PATH_MAX];
+
+static struct column test_columns[] =
+{
+    { .name = (char *)"id",     .type = COLUMN_TYPE_INT,        .is_storage = true, .is_auto_increment = true },
+    { .name = (char *)"name",   .type = COLUMN_TYPE_VARCHAR,    .is_storage = true },
+    { .name = (char *)"data",   .type = COLUMN_TYPE_BLOB,       .is_storage = true },
+    { .name = (char *)"num",    .type = COLUMN_TYPE_BIG_INT,    .is_storage = true },
+    { .name = (char *)"cost",   .type = COLUMN_TYPE_DOUBLE,     .is_storage = true },
+};
+
+# define COLUMN_NUM     (int)(sizeof(test_columns) / sizeof(test_columns[0]))
+
+struct expect
+{
+    char const          *name;      /* NULL for NULL */
+    size_t              name_len;
+    char const          *data_hex;  /* NULL for NULL */
+    int64_t             num;
+    int                 cost_null;
+    double              cost;
+};
+
+# define STR(s) s, sizeof(s) - 1
+
+static char const special_sql[] =
+    "INSERT INTO `" TABLE "` (" COLUMNS ") VALUES "
+    "(NULL,'it\\'s a \\\"quote\\\" and it''s doubled',unhex('00ff41'),-42,-1.5), "
+    "(NULL,'back\\\\slash\\nline\\0end\\ttab',unhex(''),-9223372036854775808,0.25), "
+    "(NULL,NULL,NULL,9223372036854775807,NULL), "
+    "( NULL , '' , UNHEX('DEADBEEF') , 0 , -1e3 );";
+
+static struct expect const special[] =
+{
+    { STR("it's a \"quote\" and it's doubled"), "00FF41", -42, 0, -1.5 },
+    { STR("back\\slash\nline\0end\ttab"), "", INT64_MIN, 0, 0.25 },
+    { NULL, 0, NULL, INT64_MAX, 1, 0 },
+    { STR(""), "DEADBEEF", 0, 0, -1000 },
+};
+
+# define SPECIAL_NUM    (int)(sizeof(special) / sizeof(special[0]))
+
+static int insert(char const *sql, size_t len, int expect_rows)
+{
+    int ret = sink_insert(sql, len);
+    if (ret != expect_rows)
+    {
+        printf("insert: %d, expect %d, %s\n", ret, expect_rows, sink->error());
+        return -__LINE__;
+    }
+
+    return 0;
+}
+
+/* rows beyond a prepared statement of SQLITE_BATCH_ROWS */
+static int insert_big(void)
+{
+    size_t len = 100 + BIG_ROW_NUM * 64;
+    char *sql = malloc(len);
+    if (sql == NULL)
+        return -__LINE__;
+
+    size_t use = snprintf(sql, len, "INSERT INTO `" TABLE "` (" COLUMNS ") VALUES ");
+    int i;
+    for (i = 0; i < BIG_ROW_NUM; ++i)
+        use += snprintf(sql + use, len - use, "%s(NULL,'row %d',unhex('%02X'),%d,%d.5)", \
+                i ? ", " : "", i, i & 0xff, -i, i);
+
+    int ret = insert(sql, use, BIG_ROW_NUM);
+    free(sql);
+
+    return ret;
+}
+
+static int check_text(sqlite3_stmt *stmt, int col, char const *str, size_t len)
+{
+    if (str == NULL)
+        return sqlite3_column_type(stmt, col) == SQLITE_NULL ? 0 : -__LINE__;
+
+    if (sqlite3_column_type(stmt, col) != SQLITE_TEXT)
+        return -__LINE__;
+
+    char const *s = (char const *)sqlite3_column_text(stmt, col);
+    if ((size_t)sqlite3_column_bytes(stmt, col) != len || memcmp(s, str, len) != 0)
+        return -__LINE__;
+
+    return 0;
+}
+
+static int check_row(sqlite3_stmt *stmt, int64_t id, struct expect const *e)
+{
+    if (sqlite3_column_int64(stmt, 0) != id)
+        return -__LINE__;
+    if (check_text(stmt, 1, e->name, e->name_len) < 0)
+        return -__LINE__;
+
+    if (e->data_hex == NULL)
+    {
+        if (sqlite3_column_type(stmt, 2) != SQLITE_NULL)
+            return -__LINE__;
+    }
+    else
+    {
+        /* hex(data) of column 5 */
+        if (check_text(stmt, 5, e->data_hex, strlen(e->data_hex)) < 0)
+            return -__LINE__;
+    }
+
+    if (sqlite3_column_type(stmt, 3) != SQLITE_INTEGER || sqlite3_column_int64(stmt, 3) != e->num)
+        return -__LINE__;
+
+    if (e->cost_null)
+        return sqlite3_column_type(stmt, 4) == SQLITE_NULL ? 0 : -__LINE__;
+    if (sqlite3_column_type(stmt, 4) != SQLITE_FLOAT || sqlite3_column_double(stmt, 4) != e->cost)
+        return -__LINE__;
+
+    return 0;
+}
+
+static int check_rows(void)
+{
+    sqlite3 *db;
+    if (sqlite3_open_v2(db_file, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK)
+        return -__LINE__;
+
+    sqlite3_stmt *stmt;
+    char const *sql = "SELECT `id`,`name`,`data`,`num`,`cost`,hex(`data`) FROM `" TABLE "` ORDER BY `id`";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return -__LINE__;
+    }
+
+    int row_num = 0;
+    int bad = 0;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+    {
+        int ret;
+        if (row_num < SPECIAL_NUM)
+        {
+            ret = check_row(stmt, row_num + 1, &special[row_num]);
+        }
+        else
+        {
+            int i = row_num - SPECIAL_NUM;
+            char name[32];
+            char hex[8];
+            struct expect e = { name, snprintf(name, sizeof(name), "row %d", i), hex, -i, 0, i + 0.5 };
+            snprintf(hex, sizeof(hex), "%02X", i & 0xff);
+            ret = check_row(stmt, row_num + 1, &e);
+        }
+
+        if (ret < 0 && bad++ < 5)
+            printf("row %d bad: %d\n", row_num, ret);
+        ++row_num;
+    }
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    printf("read back: %d rows, %d bad\n", row_num, bad);
+
+    if (row_num != SPECIAL_NUM + BIG_ROW_NUM || bad)
+        return -__LINE__;
+
+    return 0;
+}
+
+int main(void)
+{
+    if (mkdtemp(test_dir) == NULL)
+        return 1;
+
+    int i;
+    for (i = 0; i < COLUMN_NUM - 1; ++i)
+        test_columns[i].next = &test_columns[i + 1];
+
+    snprintf(db_file, sizeof(db_file), "%s/test.db", test_dir);
+    settings.columns = test_columns;
+    settings.columns_str = (char *)COLUMNS;
+    settings.columns_str_len = strlen(COLUMNS);
+    settings.sink_name = (char *)"sqlite";
+    settings.sqlite_file = db_file;
+
+    int ret = 0;
+    if (sink_init() < 0 || sink->open() < 0)
+    {
+        printf("open %s fail\n", db_file);
+        ret = 1;
+    }
+    else
+    {
+        if (sink->create_table(TABLE) < 0)
+            ret = 1;
+        if (ret == 0 && insert(special_sql, sizeof(special_sql) - 1, SPECIAL_NUM) < 0)
+            ret = 1;
+        if (ret == 0 && insert_big() < 0)
+            ret = 1;
+
+        sink->close();
+
+        if (ret == 0 && check_rows() < 0)
+            ret = 1;
+    }
+
+    char cmd[PATH_MAX];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", test_dir);
+    if (system(cmd) != 0)
+        ret = 1;
+
+    printf("%s\n", ret ? "FAIL" : "PASS");
+
+    return ret;
+}
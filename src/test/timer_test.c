@@ -0,0 +1,159 @@
+/*
+ * Description: timing wheel test and benchmark, 1M outstanding timers
+ *              with time out from 1 ms to 1 hour, a tenth deleted, the
+ *              rest must fire in time, driven by a simulated clock.
+ */
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <stdint.h>
+# include <sys/time.h>
+
+# include "timer.h"
+
+# define TIMER_NUM      1000000
+# define DEL_NUM        (TIMER_NUM / 10)
+# define TICK_MS        5
+/* tick of wheel is 5 ms, a timer may fire up to a tick late */
+# define LATE_MAX_MS    (2 * TICK_MS)
+
+static struct timeval now;
+
+static uint64_t expire_at[TIMER_NUM];
+static uint32_t sequences[TIMER_NUM];
+static uint8_t  state[TIMER_NUM];   /* 0 wait, 1 fired, 2 deleted, 3 late is ok */
+
+static uint64_t fired_num;
+static uint64_t bad_num;
+
+static uint64_t now_ms(void)
+{
+    return now.tv_sec * 1000ull + now.tv_usec / 1000;
+}
+
+static void advance(uint64_t ms)
+{
+    uint64_t us = now.tv_usec + ms * 1000;
+    now.tv_sec += us / 1000000;
+    now.tv_usec = us % 1000000;
+}
+
+static double real_ns(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+}
+
+static void on_expire(uint32_t sequence, size_t size, void *data)
+{
+    uint32_t i = *(uint32_t *)data;
+    uint64_t t = now_ms();
+
+    if (state[i] == 3)
+    {
+        ++fired_num;
+
+        return;
+    }
+
+    if (state[i] != 0 || t < expire_at[i] || t > expire_at[i] + LATE_MAX_MS)
+    {
+        if (bad_num++ < 5)
+            printf("bad fire: timer %u, state %d, at %lu, expire %lu\n", i, state[i], \
+                    (unsigned long)t, (unsigned long)expire_at[i]);
+    }
+
+    state[i] = 1;
+    ++fired_num;
+}
+
+int main(void)
+{
+    if (timer_init(0) < 0)
+        return 1;
+
+    gettimeofday(&now, NULL);
+    timer_check(&now);
+
+    srand(1);
+
+    double start = real_ns();
+    uint32_t i;
+    for (i = 0; i < TIMER_NUM; ++i)
+    {
+        uint32_t timeout = (i % 7 == 0) ? 3600 * 1000 : (uint32_t)(rand() % 600000) + 1;
+
+        sequences[i] = 0;
+        if (timer_add(sizeof(i), &i, on_expire, timeout, &sequences[i], NULL) < 0)
+        {
+            printf("add timer fail\n");
+
+            return 1;
+        }
+
+        expire_at[i] = now_ms() + timeout;
+    }
+    double add_cost = real_ns() - start;
+
+    printf("add: %d timers, %.1f ns per add, outstanding %d\n", \
+            TIMER_NUM, add_cost / TIMER_NUM, timer_num());
+
+    start = real_ns();
+    for (i = 0; i < TIMER_NUM; i += TIMER_NUM / DEL_NUM)
+    {
+        if (timer_del(sequences[i], NULL) < 0)
+        {
+            printf("del timer fail\n");
+
+            return 1;
+        }
+
+        state[i] = 2;
+    }
+    double del_cost = real_ns() - start;
+
+    printf("del: %d timers, %.1f ns per del\n", DEL_NUM, del_cost / DEL_NUM);
+
+    /* an hour and a minute of ticks */
+    uint64_t tick_num = 0;
+    start = real_ns();
+    while (timer_num() > 0 && tick_num < 3700 * 1000 / TICK_MS)
+    {
+        advance(TICK_MS);
+        timer_check(&now);
+        ++tick_num;
+    }
+    double run_cost = real_ns() - start;
+
+    printf("run: %lu ticks, %.1f ns per tick, %.1f ns per fire, fired %lu, bad %lu, left %d\n", \
+            (unsigned long)tick_num, run_cost / tick_num, run_cost / fired_num, \
+            (unsigned long)fired_num, (unsigned long)bad_num, timer_num());
+
+    int ret = 0;
+    if (fired_num != TIMER_NUM - DEL_NUM || bad_num || timer_num())
+        ret = 1;
+
+    /* a stall of a day cost no more than the timers in the wheel */
+    uint32_t seq = 0;
+    uint32_t stall = 0;
+    state[stall] = 3;
+    timer_add(sizeof(stall), &stall, on_expire, 2 * 3600 * 1000, &seq, NULL);
+
+    advance(86400 * 1000ull);
+    fired_num = 0;
+    start = real_ns();
+    timer_check(&now);
+    double stall_cost = real_ns() - start;
+
+    printf("stall: a day in one check, %.1f us, fired %lu\n", \
+            stall_cost / 1000, (unsigned long)fired_num);
+
+    if (fired_num != 1)
+        ret = 1;
+
+    printf("%s\n", ret ? "FAIL" : "PASS");
+
+    return ret;
+}
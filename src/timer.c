@@ -7,96 +7,212 @@
 # include <stdlib.h>
 # include <stdint.h>
 # include <stdbool.h>
+# include <unistd.h>
+# include <pthread.h>
 # include <sys/time.h>
 
 # include "utils.h"
 # include "list.h"
 # include "cache.h"
-# include "bhash.h"
+# include "shash.h"
 # include "timer.h"
 
+/* tick in us */
 # define TIMER_CHECK_INTERVAL   5000
-# define TIMER_TIME_OUT         1000
 
-static struct   list_head vec[TIMER_TIME_OUT];
-static bhash_t  hash;
-static uint64_t time_pos;
-static int      node_num;
+/*
+ * hierarchical timing wheel, level n slot covers 256^n ticks, 4 levels
+ * cover 2^32 ticks. a timer is put in the lowest level its expire fit,
+ * and moved down when the tick reach the start of its slot, so a timer
+ * is cascaded at most 3 times.
+ */
+# define WHEEL_LEVEL            4
+# define WHEEL_BITS             8
+# define WHEEL_SIZE             (1 << WHEEL_BITS)
+# define WHEEL_MASK             (WHEEL_SIZE - 1)
+
+/* timers are split to shards by sequence, each has its own lock */
+# define TIMER_SHARD_NUM        8
+
+struct timer_shard
+{
+    pthread_mutex_t     lock;
+    struct list_head    wheel[WHEEL_LEVEL][WHEEL_SIZE];
+    int                 level_num[WHEEL_LEVEL];
+    shash_t             hash;
+    /* next tick to check, ticks before it are expired */
+    uint64_t            time_pos;
+};
+
+static struct timer_shard shards[TIMER_SHARD_NUM];
+static uint32_t inner_sequence;
 
+/* alloc with data after it, index by sequence in hash */
 struct timer_node
 {
     uint32_t            sequence;
     struct list_head    list;
+    uint64_t            expire;
+    int                 level;
+    uint64_t            add_time;   /* in us */
     expire_fun          *on_expire;
     size_t              size;
     void                *data;
 };
 
+struct timer_index
+{
+    uint32_t            sequence;
+    struct timer_node   *node;
+};
+
 static uint64_t relative_time(struct timeval *t)
 {
     return ((t->tv_sec * 1000000ull) + t->tv_usec) / TIMER_CHECK_INTERVAL;
 }
 
-static bool timer_init_flag = false;
+static struct timer_shard *get_shard(uint32_t sequence)
+{
+    return &shards[sequence % TIMER_SHARD_NUM];
+}
 
-int timer_init(void)
+static void wheel_add(struct timer_shard *s, struct timer_node *nodeptr)
 {
-    int i;
-    for (i = 0; i < TIMER_TIME_OUT; ++i)
+    uint64_t delta = nodeptr->expire - s->time_pos;
+
+    int level = 0;
+    while (level < WHEEL_LEVEL - 1 && (delta >> (WHEEL_BITS * (level + 1))))
+        ++level;
+
+    int slot = (nodeptr->expire >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    list_add_tail(&nodeptr->list, &s->wheel[level][slot]);
+
+    nodeptr->level = level;
+    ++s->level_num[level];
+}
+
+static void wheel_del(struct timer_shard *s, struct timer_node *nodeptr)
+{
+    list_del(&nodeptr->list);
+    --s->level_num[nodeptr->level];
+}
+
+/* time_pos is at the start of a level 1 slot, move timers down */
+static void cascade(struct timer_shard *s)
+{
+    int level;
+    for (level = 1; level < WHEEL_LEVEL; ++level)
     {
-        INIT_LIST_HEAD(&vec[i]);
-    }
+        int slot = (s->time_pos >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        struct list_head *head = &s->wheel[level][slot];
+        while (head->next != head)
+        {
+            struct timer_node *nodeptr = list_entry(head->next, struct timer_node, list);
 
-    NEG_RET(bhash_init(&hash, 20 * 10000, sizeof(struct timer_node), \
-                16, 0, NULL, NULL, NULL));
+            wheel_del(s, nodeptr);
+            wheel_add(s, nodeptr);
+        }
 
-    NEG_RET(cache_init());
+        if (slot != 0)
+            break;
+    }
+}
 
+static bool timer_init_flag = false;
+
+int timer_init(size_t max_memory)
+{
     struct timeval now;
     gettimeofday(&now, NULL);
-    time_pos = relative_time(&now);
+
+    int i, j, k;
+    for (i = 0; i < TIMER_SHARD_NUM; ++i)
+    {
+        struct timer_shard *s = &shards[i];
+
+        for (j = 0; j < WHEEL_LEVEL; ++j)
+        {
+            for (k = 0; k < WHEEL_SIZE; ++k)
+                INIT_LIST_HEAD(&s->wheel[j][k]);
+        }
+
+        NEG_RET(shash_init(&s->hash, 1024, sizeof(struct timer_index), NULL, NULL));
+
+        pthread_mutex_init(&s->lock, NULL);
+        s->time_pos = relative_time(&now);
+    }
+
+    NEG_RET(cache_init(max_memory));
+
+    /* random start, receiver dedup by sequence, don't reuse them after restart */
+    inner_sequence = (uint32_t)(now.tv_sec * 1000000ull + now.tv_usec) ^ ((uint32_t)getpid() << 16);
 
     timer_init_flag = true;
 
     return 0;
 }
 
-int timer_add(size_t size, void *ptr, expire_fun *on_expire, \
+int timer_add(size_t size, void *ptr, expire_fun *on_expire, uint32_t timeout, \
         uint32_t *sequence, void **data)
 {
     if (timer_init_flag == false)
         return -1;
 
-    static uint32_t inner_sequence = 0;
-    ++inner_sequence;
-    if (inner_sequence == 0)
-        ++inner_sequence;
+    struct timer_index index = { .sequence = *sequence };
 
-    struct timer_node node;
-    bzero(&node, sizeof(node));
-    node.sequence = inner_sequence;
+    while (index.sequence == 0)
+        index.sequence = __atomic_add_fetch(&inner_sequence, 1, __ATOMIC_RELAXED);
 
-    struct timer_node *nodeptr = bhash_put(&hash, &node);
+    struct timer_node *nodeptr = cache_alloc(sizeof(*nodeptr) + size);
     if (nodeptr == NULL)
-        return -3;
+        return -2;
 
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    nodeptr->sequence = index.sequence;
+    nodeptr->add_time = now.tv_sec * 1000000ull + now.tv_usec;
     nodeptr->on_expire = on_expire;
     nodeptr->size = size;
-    nodeptr->data = cache_alloc(size);
-    if (nodeptr->data == NULL)
-        return -2;
+    nodeptr->data = nodeptr + 1;
     if (ptr)
         memcpy(nodeptr->data, ptr, size);
 
-    INIT_LIST_HEAD(&nodeptr->list);
-    list_add_tail(&nodeptr->list, &vec[time_pos % TIMER_TIME_OUT]);
+    uint64_t ticks = timeout * 1000ull / TIMER_CHECK_INTERVAL;
+    if (ticks == 0)
+        ticks = 1;
+    else if (ticks > UINT32_MAX)
+        ticks = UINT32_MAX;
+
+    struct timer_shard *s = get_shard(index.sequence);
+    pthread_mutex_lock(&s->lock);
+
+    int ret = 0;
+    index.node = nodeptr;
+    if (*sequence && shash_get(&s->hash, &index))
+        ret = -4;
+    else if (shash_put(&s->hash, &index) == NULL)
+        ret = -3;
+
+    if (ret == 0)
+    {
+        nodeptr->expire = s->time_pos + ticks;
+        wheel_add(s, nodeptr);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    if (ret < 0)
+    {
+        cache_free(nodeptr, sizeof(*nodeptr) + size);
 
-    *sequence = inner_sequence;
+        return ret;
+    }
+
+    *sequence = index.sequence;
     if (data)
         *data = nodeptr->data;
 
-    ++node_num;
-
     return 0;
 }
 
@@ -105,43 +221,110 @@ int timer_get(uint32_t sequence, size_t *size, void **data)
     if (timer_init_flag == false)
         return -1;
 
-    struct timer_node node = { .sequence = sequence };
-    struct timer_node *nodeptr = bhash_get(&hash, &node);
-    if (nodeptr == NULL)
-        return -2;
+    struct timer_shard *s = get_shard(sequence);
+    pthread_mutex_lock(&s->lock);
 
-    *size = nodeptr->size;
-    *data = nodeptr->data;
+    struct timer_index index = { .sequence = sequence };
+    struct timer_index *indexptr = shash_get(&s->hash, &index);
+    if (indexptr)
+    {
+        *size = indexptr->node->size;
+        *data = indexptr->node->data;
+    }
 
-    return 0;
+    pthread_mutex_unlock(&s->lock);
+
+    return indexptr ? 0 : -2;
 }
 
-static void inner_timer_del(struct timer_node *nodeptr)
+/* remove from wheel and index, hold the shard lock */
+static void detach(struct timer_shard *s, struct timer_node *nodeptr)
 {
-    cache_free(nodeptr->data, nodeptr->size);
-    list_del(&nodeptr->list);
-    bhash_del(&hash, nodeptr);
+    struct timer_index index = { .sequence = nodeptr->sequence };
+    shash_del(&s->hash, &index);
 
-    --node_num;
+    wheel_del(s, nodeptr);
+}
 
-    return;
+static void node_free(struct timer_node *nodeptr)
+{
+    cache_free(nodeptr, sizeof(*nodeptr) + nodeptr->size);
 }
 
-int timer_del(uint32_t sequence)
+int timer_del(uint32_t sequence, uint32_t *age)
 {
     if (timer_init_flag == false)
         return -1;
 
-    struct timer_node node = { .sequence = sequence };
-    struct timer_node *nodeptr = bhash_get(&hash, &node);
+    struct timer_shard *s = get_shard(sequence);
+    pthread_mutex_lock(&s->lock);
+
+    struct timer_index index = { .sequence = sequence };
+    struct timer_index *indexptr = shash_get(&s->hash, &index);
+    struct timer_node *nodeptr = indexptr ? indexptr->node : NULL;
+    if (nodeptr)
+        detach(s, nodeptr);
+
+    pthread_mutex_unlock(&s->lock);
+
     if (nodeptr == NULL)
         return -2;
 
-    inner_timer_del(nodeptr);
+    if (age)
+    {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        uint64_t now_us = now.tv_sec * 1000000ull + now.tv_usec;
+        *age = now_us > nodeptr->add_time ? (now_us - nodeptr->add_time) / 1000 : 0;
+    }
+
+    node_free(nodeptr);
 
     return 0;
 }
 
+/* move expired timers of a shard to list expired */
+static void shard_check(struct timer_shard *s, uint64_t time_curr, struct list_head *expired)
+{
+    while (s->time_pos <= time_curr)
+    {
+        if ((s->time_pos & WHEEL_MASK) == 0)
+            cascade(s);
+
+        /* jump to the next cascade of the lowest level not empty,
+         * so a long stall cost no more than the timers in it */
+        if (s->level_num[0] == 0)
+        {
+            int level = 1;
+            while (level < WHEEL_LEVEL && s->level_num[level] == 0)
+                ++level;
+
+            uint64_t next = time_curr + 1;
+            if (level < WHEEL_LEVEL)
+            {
+                uint64_t span = 1ull << (WHEEL_BITS * level);
+                if (((s->time_pos | (span - 1)) + 1) < next)
+                    next = (s->time_pos | (span - 1)) + 1;
+            }
+
+            s->time_pos = next;
+            continue;
+        }
+
+        struct list_head *head = &s->wheel[0][s->time_pos & WHEEL_MASK];
+        while (head->next != head)
+        {
+            struct timer_node *nodeptr = list_entry(head->next, struct timer_node, list);
+
+            detach(s, nodeptr);
+            list_add_tail(&nodeptr->list, expired);
+        }
+
+        ++s->time_pos;
+    }
+}
+
 int timer_check(struct timeval *now)
 {
     if (timer_init_flag == false)
@@ -155,25 +338,31 @@ int timer_check(struct timeval *now)
     }
 
     uint64_t time_curr = relative_time(now);
-    if (time_curr == time_pos)
-        return 0;
 
-    int count = 0;
-    while (time_pos < time_curr)
+    /* call on_expire without lock, it may add timer */
+    struct list_head expired;
+    INIT_LIST_HEAD(&expired);
+
+    int i;
+    for (i = 0; i < TIMER_SHARD_NUM; ++i)
     {
-        time_pos++;
+        struct timer_shard *s = &shards[i];
 
-        struct list_head *head = &vec[time_pos % TIMER_TIME_OUT];
-        while (head->next != head)
-        {
-            struct list_head *curr = head->next;
-            struct timer_node *nodeptr = list_entry(curr, struct timer_node, list);
+        pthread_mutex_lock(&s->lock);
+        shard_check(s, time_curr, &expired);
+        pthread_mutex_unlock(&s->lock);
+    }
 
-            nodeptr->on_expire(nodeptr->sequence, nodeptr->size, nodeptr->data);
-            inner_timer_del(nodeptr);
+    int count = 0;
+    while (expired.next != &expired)
+    {
+        struct timer_node *nodeptr = list_entry(expired.next, struct timer_node, list);
+        list_del(&nodeptr->list);
 
-            ++count;
-        }
+        nodeptr->on_expire(nodeptr->sequence, nodeptr->size, nodeptr->data);
+        node_free(nodeptr);
+
+        ++count;
     }
 
     return count;
@@ -181,6 +370,15 @@ int timer_check(struct timeval *now)
 
 int timer_num(void)
 {
-    return node_num;
-}
+    int num = 0;
+
+    int i;
+    for (i = 0; i < TIMER_SHARD_NUM; ++i)
+    {
+        pthread_mutex_lock(&shards[i].lock);
+        num += shash_use(&shards[i].hash);
+        pthread_mutex_unlock(&shards[i].lock);
+    }
 
+    return num;
+}
@@ -9,17 +9,29 @@
 # include <stddef.h>
 # include <sys/time.h>
 
-int timer_init(void);
+/*
+ * timers are thread safe. max_memory limit memory of timer data,
+ * 0 means no limit
+ */
+int timer_init(size_t max_memory);
 
 typedef void expire_fun(uint32_t sequence, size_t size, void *data);
 
-int timer_add(size_t size, void *ptr, expire_fun *on_expire, \
+/*
+ * timeout in ms, on_expire is called by timer_check after it.
+ * if *sequence is not 0, use it as the sequence of new timer, for resend.
+ * return -2 if max memory is reached
+ */
+int timer_add(size_t size, void *ptr, expire_fun *on_expire, uint32_t timeout, \
         uint32_t *sequence, void **data);
 
+/* data is valid until timer_del or expire, call them in the same thread */
 int timer_get(uint32_t sequence, size_t *size, void **data);
 
-int timer_del(uint32_t sequence);
+/* if age is not NULL, it is set to ms since timer_add */
+int timer_del(uint32_t sequence, uint32_t *age);
 
+/* on_expire is called without lock, in the thread call timer_check */
 int timer_check(struct timeval *now);
 
 int timer_num(void);
@@ -16,6 +16,7 @@
 # include <unistd.h>
 # include <arpa/inet.h>
 # include <netinet/in.h>
+# include <sys/time.h>
 # include <sys/file.h>
 # include <sys/types.h>
 # include <sys/ipc.h>
@@ -97,12 +98,69 @@ char *strtoupper(char *str)
     return str;
 }
 
+struct tm *localtime_cached(time_t t)
+{
+    /* fields in the local hour of hour_start are the same but min and sec,
+     * offset of timezone and dst change only at a local hour */
+    static __thread time_t hour_start;
+    static __thread time_t hour_end;
+    static __thread struct tm hour_tm;
+    static __thread struct tm result;
+    static __thread time_t last = -1;
+
+    if (t == last)
+        return &result;
+
+    if (t < hour_start || t >= hour_end)
+    {
+        localtime_r(&t, &hour_tm);
+        hour_start = t - hour_tm.tm_min * 60 - hour_tm.tm_sec;
+        hour_end = hour_start + 3600;
+    }
+
+    time_t d = t - hour_start;
+    result = hour_tm;
+    result.tm_min = (int)(d / 60);
+    result.tm_sec = (int)(d % 60);
+    last = t;
+
+    return &result;
+}
+
+char *get_timeval_str(struct timeval *tv)
+{
+    /* room for the widest int fields */
+    static __thread char str[80];
+    static __thread time_t last = -1;
+    static __thread int end;
+
+    if (tv->tv_sec != last)
+    {
+        struct tm *tm = localtime_cached(tv->tv_sec);
+        end = snprintf(str, sizeof(str), "%04d-%02d-%02d %02d:%02d:%02d.000000", \
+                tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, \
+                tm->tm_hour, tm->tm_min, tm->tm_sec);
+        last = tv->tv_sec;
+    }
+
+    /* patch microseconds only */
+    long usec = tv->tv_usec;
+    int i;
+    for (i = end - 1; i >= end - 6; --i)
+    {
+        str[i] = '0' + usec % 10;
+        usec /= 10;
+    }
+
+    return str;
+}
+
 char *get_curr_date_time(void)
 {
     static char data_time[100];
 
     time_t now = time(NULL);
-    struct tm *tm = localtime(&now);
+    struct tm *tm = localtime_cached(now);
     snprintf(data_time, sizeof(data_time), "%04d-%02d-%02d %02d:%02d:%02d", \
             tm->tm_year + 1900, tm->tm_mon + 1, \
             tm->tm_mday, tm->tm_hour, tm->tm_min, tm->tm_sec);
@@ -232,7 +290,7 @@ char *get_hour_str(int offset, time_t *timeptr)
 	}
     now += offset * 3600;
 
-    struct tm *tm = localtime(&now);
+    struct tm *tm = localtime_cached(now);
     snprintf(hour_str, sizeof(hour_str), "%04d%02d%02d%02d", \
             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, tm->tm_hour);
 
@@ -255,7 +313,7 @@ char *get_day_str(int offset, time_t *timeptr)
 	}
     now += offset * 3600 * 24;
 
-    struct tm *tm = localtime(&now);
+    struct tm *tm = localtime_cached(now);
     snprintf(day_str, sizeof(day_str), "%04d%02d%02d", \
             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday);
 
@@ -277,7 +335,8 @@ char *get_mon_str(int offset, time_t *timeptr)
 # endif
 	}
 
-    struct tm *tm = localtime(&now);
+    struct tm t = *localtime_cached(now);
+    struct tm *tm = &t;
     tm->tm_mon  += offset;
     tm->tm_year += (tm->tm_mon / 12);
     tm->tm_mon  %= 12;
@@ -309,7 +368,8 @@ char *get_year_str(int offset, time_t *timeptr)
 # endif
 	}
 
-    struct tm *tm = localtime(&now);
+    struct tm t = *localtime_cached(now);
+    struct tm *tm = &t;
     tm->tm_year += offset;
 
     snprintf(year_str, sizeof(year_str), "%04d", tm->tm_year + 1900);
@@ -320,6 +380,7 @@ char *get_year_str(int offset, time_t *timeptr)
 char *get_date_str(int offset, time_t *timeptr)
 {
     static char date_str[20];
+    static time_t last = -1;
 
     time_t now;
     if (timeptr == NULL)
@@ -333,7 +394,12 @@ char *get_date_str(int offset, time_t *timeptr)
 	}
     now += offset;
 
-    struct tm *tm = localtime(&now);
+    /* records of a second share the string */
+    if (now == last)
+        return date_str;
+    last = now;
+
+    struct tm *tm = localtime_cached(now);
     snprintf(date_str, sizeof(date_str), "%04d-%02d-%02d", \
             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday);
 
@@ -343,6 +409,7 @@ char *get_date_str(int offset, time_t *timeptr)
 char *get_time_str(int offset, time_t *timeptr)
 {
     static char time_str[20];
+    static time_t last = -1;
 
     time_t now;
     if (timeptr == NULL)
@@ -356,7 +423,12 @@ char *get_time_str(int offset, time_t *timeptr)
 	}
     now += offset;
 
-    struct tm *tm = localtime(&now);
+    /* records of a second share the string */
+    if (now == last)
+        return time_str;
+    last = now;
+
+    struct tm *tm = localtime_cached(now);
     snprintf(time_str, sizeof(time_str), "%02d:%02d:%02d", \
             tm->tm_hour, tm->tm_min, tm->tm_sec);
 
@@ -366,6 +438,7 @@ char *get_time_str(int offset, time_t *timeptr)
 char *get_datetime_str(int offset, time_t *timeptr)
 {
     static char datetime_str[20];
+    static time_t last = -1;
 
     time_t now;
     if (timeptr == NULL)
@@ -379,7 +452,12 @@ char *get_datetime_str(int offset, time_t *timeptr)
 	}
     now += offset;
 
-    struct tm *tm = localtime(&now);
+    /* records of a second share the string */
+    if (now == last)
+        return datetime_str;
+    last = now;
+
+    struct tm *tm = localtime_cached(now);
     snprintf(datetime_str, sizeof(datetime_str), \
             "%04d-%02d-%02d %02d:%02d:%02d", \
             tm->tm_year + 1900, tm->tm_mon + 1, tm->tm_mday, \
@@ -11,6 +11,8 @@
 # include <stdbool.h>
 # include <error.h>
 # include <errno.h>
+# include <time.h>
+# include <sys/time.h>
 # include <netinet/in.h>
 
 char *sstrncpy(char *dest, const char *src, size_t n);
@@ -23,6 +25,12 @@ char *strtoupper(char *str);
 
 int is_server_exist(const char *name);
 
+/* localtime of t, localtime_r is called once an hour, per thread */
+struct tm *localtime_cached(time_t t);
+
+/* "YYYY-mm-dd HH:MM:SS.uuuuuu", formatted once a second, per thread */
+char *get_timeval_str(struct timeval *tv);
+
 char *get_curr_date_time(void);
 
 char *hex_dump_str(const char *data, size_t size);